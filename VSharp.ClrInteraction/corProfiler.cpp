@@ -44,6 +44,7 @@ HRESULT STDMETHODCALLTYPE CorProfiler::Initialize(IUnknown *pICorProfilerInfoUnk
         COR_PRF_MONITOR_GC |
         COR_PRF_ENABLE_OBJECT_ALLOCATED |
         COR_PRF_MONITOR_OBJECT_ALLOCATED |
+        COR_PRF_MONITOR_CLASS_LOADS |
         COR_PRF_ENABLE_REJIT;
 
     // TODO: place IfFailRet here, log fails!
@@ -198,8 +199,9 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ClassUnloadStarted(ClassID classId)
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ClassUnloadFinished(ClassID classId, HRESULT hrStatus)
 {
-    UNUSED(classId);
     UNUSED(hrStatus);
+    std::lock_guard<std::mutex> lock(typeDescriptorsMutex);
+    typeDescriptors.erase(classId);
     return S_OK;
 }
 
@@ -544,12 +546,17 @@ void CorProfiler::serializeType(const std::vector<bool> &isValid, const std::vec
     type = begin;
 }
 
-HRESULT STDMETHODCALLTYPE CorProfiler::ObjectAllocated(ObjectID objectId, ClassID classId)
+TypeDescriptor CorProfiler::typeDescriptor(ClassID classId)
 {
-    ULONG size;
-    this->corProfilerInfo->GetObjectSize(objectId, &size);
+    {
+        std::lock_guard<std::mutex> lock(typeDescriptorsMutex);
+        auto cached = typeDescriptors.find(classId);
+        if (cached != typeDescriptors.end())
+            return cached->second;
+    }
 
-    char *type = new char[0];
+    // the type is resolved without the lock, a concurrently resolved descriptor of the class wins
+    char *type = nullptr;
     unsigned long typeLength = 0;
 
     std::vector<bool> isValid;
@@ -563,8 +570,18 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ObjectAllocated(ObjectID objectId, ClassI
     std::vector<int> assemblySizes;
     resolveType(classId, isValid, isArray, arrayTypes, tokens, typeArgsCount, moduleNames, nameLengths, assemblyNames, assemblySizes);
     serializeType(isValid, isArray, arrayTypes, tokens, typeArgsCount, moduleNames, nameLengths, type, typeLength, assemblyNames, assemblySizes);
+    auto descriptor = std::make_shared<const std::vector<char>>(type, type + typeLength);
+    delete[] type;
+
+    std::lock_guard<std::mutex> lock(typeDescriptorsMutex);
+    return typeDescriptors.emplace(classId, descriptor).first->second;
+}
 
-    heap.allocateObject(objectId, size, type, typeLength);
+HRESULT STDMETHODCALLTYPE CorProfiler::ObjectAllocated(ObjectID objectId, ClassID classId)
+{
+    ULONG size;
+    this->corProfilerInfo->GetObjectSize(objectId, &size);
+    heap.allocateObject(objectId, size, typeDescriptor(classId));
     return S_OK;
 }
 
@@ -785,9 +802,20 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ThreadNameChanged(ThreadID threadId, ULON
 
 HRESULT STDMETHODCALLTYPE CorProfiler::GarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason)
 {
-    UNUSED(cGenerations);
-    UNUSED(generationCollected);
     UNUSED(reason);
+    std::vector<Interval> uncollected;
+    ULONG count = 0;
+    if (SUCCEEDED(corProfilerInfo->GetGenerationBounds(0, &count, nullptr)) && count > 0) {
+        std::vector<COR_PRF_GC_GENERATION_RANGE> ranges(count);
+        if (SUCCEEDED(corProfilerInfo->GetGenerationBounds(count, &count, ranges.data()))) {
+            for (ULONG i = 0; i < count; ++i) {
+                auto &range = ranges[i];
+                if (range.generation < cGenerations && !generationCollected[range.generation] && range.rangeLength > 0)
+                    uncollected.emplace_back(range.rangeStart, range.rangeLength);
+            }
+        }
+    }
+    heap.startGC(uncollected);
     return S_OK;
 }
 
@@ -2,6 +2,8 @@
 #define CORPROFILER_H_
 
 #include <atomic>
+#include <mutex>
+#include <unordered_map>
 #include "memory/heap.h"
 #include "cor.h"
 #include "corprof.h"
@@ -18,6 +20,11 @@ private:
     ICorProfilerInfo8 *corProfilerInfo;
     Instrumenter *instrumenter;
     Protocol *protocol;
+    // serialized types by class; dropped when the class is unloaded, since its id may be reused
+    std::mutex typeDescriptorsMutex;
+    std::unordered_map<ClassID, TypeDescriptor> typeDescriptors;
+
+    TypeDescriptor typeDescriptor(ClassID classId);
 
     void resolveType(ClassID classId, std::vector<bool> &isValid, std::vector<bool> &isArray, std::vector<std::pair<CorElementType, int>> &arrayTypes, std::vector<mdTypeDef> &tokens, std::vector<int> &typeArgsCount, std::vector<WCHAR> &moduleNames, std::vector<int> &moduleSizes, std::vector<WCHAR> &assemblyNames, std::vector<int> &assemblySizes);
     void serializeType(const std::vector<bool> &isValid, const std::vector<bool> &isArray, const std::vector<std::pair<CorElementType, int>> &arrayTypes, const std::vector<mdTypeDef> &tokens, const std::vector<int> &typeArgsCount, const std::vector<WCHAR> &moduleNames, const std::vector<int> &moduleSizes, char *&type, unsigned long &typeLength, const std::vector<WCHAR>& assemblyNames, const std::vector<int>& assemblySizes);
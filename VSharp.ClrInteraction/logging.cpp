@@ -2,16 +2,117 @@
 
 #ifdef _LOGGING
 
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <set>
+
 #define LOG_FILE_NAME "lastrun.log"
 
-std::ofstream tout;
+namespace {
+
+const size_t batchCapacity = 16 * 1024;
+
+struct LogBatch {
+    // taken by the owning thread and by 'close_log' only, so it is uncontended
+    std::mutex mutex;
+    std::string text;
+};
+
+std::ofstream logFile;
+std::mutex logFileMutex;
+std::mutex batchesMutex;
+std::set<LogBatch*> batches;
+// set on process exit, lines logged by threads still running afterwards are not batched
+std::atomic<bool> writeThrough(false);
+
+void writeBatch(LogBatch &batch, bool flush) {
+    std::lock_guard<std::mutex> fileLock(logFileMutex);
+    logFile.write(batch.text.data(), (std::streamsize) batch.text.size());
+    if (flush)
+        logFile.flush();
+    batch.text.clear();
+}
+
+// the batch of a thread is written when it is full, on errors and when the thread exits
+struct ThreadLogBatch {
+    LogBatch *batch = nullptr;
+
+    LogBatch &get() {
+        if (batch == nullptr) {
+            batch = new LogBatch();
+            std::lock_guard<std::mutex> lock(batchesMutex);
+            batches.insert(batch);
+        }
+        return *batch;
+    }
+
+    ~ThreadLogBatch() {
+        if (batch == nullptr)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(batchesMutex);
+            batches.erase(batch);
+        }
+        if (!batch->text.empty())
+            writeBatch(*batch, true);
+        delete batch;
+    }
+};
+
+thread_local ThreadLogBatch threadBatch;
+
+void writeAllBatches() {
+    std::lock_guard<std::mutex> lock(batchesMutex);
+    for (LogBatch *batch : batches) {
+        std::lock_guard<std::mutex> batchLock(batch->mutex);
+        writeBatch(*batch, false);
+    }
+}
+
+// the runtime may exit without shutting the profiler down, then batches of live threads are written here
+struct LogBatchesFlusher {
+    ~LogBatchesFlusher() {
+        writeThrough = true;
+        writeAllBatches();
+        std::lock_guard<std::mutex> fileLock(logFileMutex);
+        logFile.flush();
+    }
+} logBatchesFlusher;
+
+void commitLine(bool flush) {
+    LogBatch &batch = threadBatch.get();
+    {
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        batch.text += tout.str();
+        if (flush || writeThrough || batch.text.size() >= batchCapacity)
+            writeBatch(batch, flush);
+    }
+    tout.str(std::string());
+    tout.clear();
+}
+
+}
+
+thread_local std::ostringstream tout;
 
 void open_log() {
-    tout.open(LOG_FILE_NAME);
+    std::lock_guard<std::mutex> fileLock(logFileMutex);
+    logFile.open(LOG_FILE_NAME);
+}
+
+void commit_log_line() {
+    commitLine(false);
+}
+
+void commit_log_error() {
+    commitLine(true);
 }
 
 void close_log() {
-    tout.close();
+    writeAllBatches();
+    std::lock_guard<std::mutex> fileLock(logFileMutex);
+    logFile.close();
 }
 
 #endif
@@ -5,16 +5,22 @@
 #undef max
 #undef min
 #endif
-#include <fstream>
+#include <sstream>
+#include <stdexcept>
 
 #define HEX(x) std::hex << "0x" << (x) << std::dec
 
 #ifdef _LOGGING
-extern std::ofstream tout; 
+// line being formatted by the current thread; committed lines are batched per thread and
+// written to the log file without taking a global lock or flushing on every line
+extern thread_local std::ostringstream tout;
 #define LOG_CODE(CODE) { CODE } ((void) 0)
 
 void open_log();
 void close_log();
+void commit_log_line();
+// writes the batch of the current thread and flushes the file, so errors survive a crash
+void commit_log_error();
 
 #else
 #define LOG_CODE(CODE) ((void) 0)
@@ -23,12 +29,12 @@ static inline void open_log() {}
 static inline void close_log() {}
 #endif
 
-#define LOG(CODE) LOG_CODE(CODE ; tout << "\n"; tout.flush();)
+#define LOG(CODE) LOG_CODE(CODE ; tout << "\n"; commit_log_line();)
 //#define LOG(CODE) LOG_CODE(tout << "---------------- " << __FUNCTION__ << " " << __FILE__ << ":" << __LINE__ << " ---------\n"; CODE ; tout << "------------------------------------------------\n"; tout.flush();)
 //#define SLOG(CODE) LOG_CODE(CODE ; tout.flush();)
 //#define CLOG(COND, CODE) LOG_CODE(if (COND) { tout << "---------------- " << __FUNCTION__ << " " << __FILE__ << ":" << __LINE__ << " ---------\n"; CODE ; tout << "------------------------------------------------\n"; tout.flush(); })
-#define CLOG(COND, CODE) LOG_CODE(if (COND) { CODE ; tout << "\n"; tout.flush(); })
-#define LOG_ERROR(CODE) LOG_CODE(tout << "-------- [LOG_ERROR] " << __FUNCTION__ << " " << __FILE__ << ":" << __LINE__ << " ---------\n"; CODE ; tout << "------------------------------------------------\n"; tout.flush();)
+#define CLOG(COND, CODE) LOG_CODE(if (COND) { CODE ; tout << "\n"; commit_log_line(); })
+#define LOG_ERROR(CODE) LOG_CODE(tout << "-------- [LOG_ERROR] " << __FUNCTION__ << " " << __FILE__ << ":" << __LINE__ << " ---------\n"; CODE ; tout << "------------------------------------------------\n"; commit_log_error();)
 #define FAIL_LOUD(x) {LOG_ERROR(tout << (x)); throw std::logic_error(x);}
 
 #endif // LOGGING_H_
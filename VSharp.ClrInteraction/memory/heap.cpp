@@ -82,20 +82,70 @@ namespace vsharp {
         return flushed;
     }
 
+// --------------------------- BitmapSlabs ---------------------------
+
+    // Concreteness bitmaps of small objects are carved from slabs of equally sized blocks and reused
+    // through free lists, bitmaps of large objects are allocated directly. Like the heap, it is not thread-safe
+    class BitmapSlabs {
+    private:
+        // bitmaps of objects up to 1 KB
+        static const SIZE maxSlabWords = 16;
+        static const SIZE blocksPerSlab = 256;
+        // free blocks are linked through their first word
+        UINT64 *freeLists[maxSlabWords + 1] = {};
+
+    public:
+        UINT64 *allocate(SIZE words) {
+            if (words > maxSlabWords)
+                return new UINT64[words];
+            if (freeLists[words] == nullptr) {
+                // slabs live as long as the process, their blocks are only recycled
+                auto slab = new UINT64[words * blocksPerSlab];
+                for (SIZE i = 0; i < blocksPerSlab; ++i)
+                    release(slab + i * words, words);
+            }
+            UINT64 *block = freeLists[words];
+            freeLists[words] = (UINT64 *) block[0];
+            return block;
+        }
+
+        void release(UINT64 *block, SIZE words) {
+            if (words > maxSlabWords) {
+                delete[] block;
+                return;
+            }
+            block[0] = (UINT64) freeLists[words];
+            freeLists[words] = block;
+        }
+    };
+
+    static BitmapSlabs bitmapSlabs;
+
+    static const SIZE wordBits = 64;
+
+    // bits of the word 'index' covering bytes [begin, end)
+    static UINT64 wordMask(SIZE index, SIZE begin, SIZE end) {
+        SIZE from = max(begin, index * wordBits) - index * wordBits;
+        SIZE to = min(end, (index + 1) * wordBits) - index * wordBits;
+        UINT64 bits = to - from == wordBits ? ~(UINT64) 0 : ((UINT64) 1 << (to - from)) - 1;
+        return bits << from;
+    }
+
 // --------------------------- Object ---------------------------
 
     Object::Object(ADDR address, SIZE size)
         : Interval(address, size)
     {
         assert(size > 0);
-        SIZE squashedSize = (size + sizeofCell - 1) / sizeofCell;
-        concreteness = new cell[squashedSize];
-        // NOTE: all contents are concrete at the beginning
-        for (int i = 0; i < squashedSize; ++i) concreteness[i] = max;
     }
 
     Object::~Object() {
-        delete[] concreteness;
+        if (concreteness)
+            bitmapSlabs.release(concreteness, bitmapWords());
+    }
+
+    SIZE Object::bitmapWords() const {
+        return (right - left + wordBits) / wordBits;
     }
 
     std::string Object::toString() const {
@@ -104,51 +154,35 @@ namespace vsharp {
 
     bool Object::read(SIZE offset, SIZE size) const {
         assert(size > 0);
-        auto startOffset = offset % sizeofCell;
-        auto startIndex = offset / sizeofCell;
-        auto endOffset = (offset + size) % sizeofCell;
-        auto endIndex = (offset + size) / sizeofCell;
-        for (unsigned i = startIndex + (startOffset ? 1 : 0); i < endIndex; ++i) {
-            if (!(concreteness[i] == max)) {
+        if (!concreteness)
+            return true;
+        SIZE end = offset + size;
+        for (SIZE i = offset / wordBits; i <= (end - 1) / wordBits; ++i) {
+            UINT64 mask = wordMask(i, offset, end);
+            if ((concreteness[i] & mask) != mask)
                 return false;
-            }
         }
-
-        auto shift = sizeofCell - startOffset;
-        cell startMask = ((cell)1 << shift) - 1; // get 00..011...1
-        shift = sizeofCell - endOffset;
-        cell endMask = (max >> shift) << shift; // get 11..100..0
-        if (startOffset && ((concreteness[startIndex] & startMask) != startMask))
-            return false;
-        if (endOffset && ((concreteness[endIndex] & endMask) != endMask))
-            return false;
         return true;
     }
 
     void Object::write(SIZE offset, SIZE size, bool vConcreteness) {
         assert(size > 0);
-        auto startOffset = offset % sizeofCell;
-        auto startIndex = offset / sizeofCell;
-        auto endOffset = (offset + size) % sizeofCell;
-        auto endIndex = (offset + size) / sizeofCell;
-        for (unsigned i = startIndex + (startOffset ? 1 : 0); i < endIndex; ++i)
-            this->concreteness[i] = vConcreteness ? max : min;
-
-        auto shift = sizeofCell - startOffset;
-        cell startMask = ((cell)1 << shift) - 1; // get 00..011...1
-        shift = sizeofCell - endOffset;
-        cell endMask = (max >> shift) << shift; // get 11..100..0
-        if (startOffset) {
+        if (!concreteness) {
+            // NOTE: all contents are concrete at the beginning, so concrete writes change nothing
             if (vConcreteness)
-                this->concreteness[startIndex] |= startMask;
-            else
-                this->concreteness[startIndex] &= ~startMask;
+                return;
+            SIZE words = bitmapWords();
+            concreteness = bitmapSlabs.allocate(words);
+            for (SIZE i = 0; i < words; ++i)
+                concreteness[i] = ~(UINT64) 0;
         }
-        if (endOffset) {
+        SIZE end = offset + size;
+        for (SIZE i = offset / wordBits; i <= (end - 1) / wordBits; ++i) {
+            UINT64 mask = wordMask(i, offset, end);
             if (vConcreteness)
-                this->concreteness[endIndex] |= endMask;
+                concreteness[i] |= mask;
             else
-                this->concreteness[endIndex] &= ~endMask;
+                concreteness[i] &= ~mask;
         }
     }
 
@@ -156,18 +190,24 @@ namespace vsharp {
 
     Heap::Heap() = default;
 
-    OBJID Heap::allocateObject(ADDR address, SIZE size, char *type, unsigned long typeLength) {
+    OBJID Heap::allocateObject(ADDR address, SIZE size, const TypeDescriptor &type) {
         auto *obj = new Object(address, size);
         tree.add(*obj);
         auto id = (OBJID) obj;
-        newAddresses[id] = std::make_pair(type, typeLength);
+        newAddresses[id] = type;
         return id;
     }
 
+    void Heap::startGC(const std::vector<Interval> &uncollected) {
+        uncollectedRanges = uncollected;
+        movedRanges.clear();
+        survivedRanges.clear();
+    }
+
     void Heap::moveAndMark(ADDR oldLeft, ADDR newLeft, SIZE length) {
         Interval i(oldLeft, length);
         Shift s{oldLeft, newLeft};
-        tree.moveAndMark(i, s);
+        movedRanges.emplace_back(i, s);
     }
 
     bool Heap::read(ADDR address, SIZE sizeOfPtr) const {
@@ -200,23 +240,35 @@ namespace vsharp {
     }
 
     void Heap::markSurvivedObjects(ADDR start, SIZE length) {
-        Interval i(start, length);
-        tree.mark(i);
+        survivedRanges.emplace_back(start, length);
+    }
+
+    static bool leftIsLess(const Interval &a, const Interval &b) {
+        return a.left < b.left;
     }
 
     void Heap::clearAfterGC() {
+        std::sort(movedRanges.begin(), movedRanges.end(),
+                  [](const std::pair<Interval, Shift> &a, const std::pair<Interval, Shift> &b) { return leftIsLess(a.first, b.first); });
+        std::sort(survivedRanges.begin(), survivedRanges.end(), leftIsLess);
+        std::sort(uncollectedRanges.begin(), uncollectedRanges.end(), leftIsLess);
+        tree.moveAndMark(movedRanges);
+        tree.mark(survivedRanges);
+        tree.mark(uncollectedRanges);
+        movedRanges.clear();
+        survivedRanges.clear();
+        uncollectedRanges.clear();
+
         auto deleted = tree.clearUnmarked();
         for (Interval *address : deleted)
             deletedAddresses.push_back((OBJID) address);
     }
 
     // TODO: store new addresses or get them from tree? #do
-    std::map<OBJID, std::pair<char*, unsigned long>> Heap::flushObjects() {
+    std::map<OBJID, TypeDescriptor> Heap::flushObjects() {
 //        return tree.flush();
-        std::map<OBJID, std::pair<char*, unsigned long>> result;
-        for (const auto &address : newAddresses)
-            result[address.first] = address.second;
-        newAddresses.clear();
+        std::map<OBJID, TypeDescriptor> result;
+        result.swap(newAddresses);
         return result;
     }
 
@@ -2,6 +2,7 @@
 #define HEAP_H_
 
 #include <map>
+#include <memory>
 #include <vector>
 #include "intervalTree.h"
 #include "cor.h"
@@ -54,15 +55,13 @@ public:
 
 };
 
-typedef char cell;
-
 class Object : public Interval {
 private:
-    // NOTE: each bit corresponds of concreteness of memory byte
-    cell *concreteness = nullptr;
-    const cell max = 0xFF;
-    const cell min = 0x00;
-    const size_t sizeofCell = sizeof(cell) * 8;
+    // NOTE: each bit corresponds to concreteness of a memory byte, bit i of word j is byte 64 * j + i;
+    //       no bitmap means that all bytes are concrete, it is allocated by the first symbolic write
+    UINT64 *concreteness = nullptr;
+
+    SIZE bitmapWords() const;
 public:
     Object(ADDR address, SIZE size);
     ~Object() override;
@@ -73,6 +72,9 @@ public:
 
 typedef IntervalTree<Interval, Shift, ADDR> Intervals;
 
+// serialized type of an object, shared by all objects of its class
+typedef std::shared_ptr<const std::vector<char>> TypeDescriptor;
+
 struct VirtualAddress
 {
     OBJID obj;
@@ -82,8 +84,13 @@ struct VirtualAddress
 class Heap {
 private:
     Intervals tree;
+    // ranges reported during the current GC, applied to the tree when it finishes
+    std::vector<std::pair<Interval, Shift>> movedRanges;
+    std::vector<Interval> survivedRanges;
+    // objects in the generations which are not collected survive without being reported
+    std::vector<Interval> uncollectedRanges;
     // TODO: store new addresses or get them from tree? #do
-    std::map<OBJID, std::pair<char*, unsigned long>> newAddresses;
+    std::map<OBJID, TypeDescriptor> newAddresses;
     std::vector<OBJID> deletedAddresses;
 
     bool resolve(ADDR address, VirtualAddress &vAddress) const;
@@ -91,13 +98,15 @@ private:
 public:
     Heap();
 
-    OBJID allocateObject(ADDR address, SIZE size, char *type, unsigned long typeLength);
+    OBJID allocateObject(ADDR address, SIZE size, const TypeDescriptor &type);
 
+    // 'uncollected' are the address ranges of the generations this GC does not collect
+    void startGC(const std::vector<Interval> &uncollected);
     void moveAndMark(ADDR oldLeft, ADDR newLeft, SIZE length);
     void markSurvivedObjects(ADDR start, SIZE length);
     void clearAfterGC();
 
-    std::map<OBJID, std::pair<char*, unsigned long>> flushObjects();
+    std::map<OBJID, TypeDescriptor> flushObjects();
 
     VirtualAddress physToVirtAddress(ADDR physAddress) const;
     static ADDR virtToPhysAddress(const VirtualAddress &virtAddress);
@@ -2,75 +2,160 @@
 #define INTERVALTREE_H_
 
 #include "../logging.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <utility>
+#include <vector>
 
+// Index of disjoint intervals ordered by their left bounds. Intervals are kept in a sorted array searched
+// with binary search; intervals added below its end go to a smaller sorted buffer, merged once it is full.
+// The buffer grows with the square root of the array, so the linear merges stay amortized sublinear.
+// During GC the keys keep the addresses the intervals had before it, so moved and survived ranges
+// are resolved against them; the keys are rebuilt by 'clearUnmarked'. GC ranges are given sorted
+// by their left bounds and are applied in one merge pass over the index
 template<typename Interval, typename Shift, typename Point>
 class IntervalTree {
 private:
-    std::vector<Interval *> objects;
+    struct Entry {
+        Point key;
+        Interval *obj;
+
+        bool operator<(const Entry &other) const {
+            return key < other.key;
+        }
+    };
+
+    static const size_t minBufferCapacity = 64;
+
+    std::vector<Entry> sorted;
+    std::vector<Entry> buffer;
+
+    size_t bufferCapacity() const {
+        auto root = static_cast<size_t>(std::sqrt(static_cast<double>(sorted.size())));
+        return root > minBufferCapacity ? root : minBufferCapacity;
+    }
+
+    static const Interval *findIn(const std::vector<Entry> &entries, const Point &p) {
+        auto next = std::upper_bound(entries.begin(), entries.end(), Entry{p, nullptr});
+        if (next != entries.begin() && (next - 1)->obj->contains(p))
+            return (next - 1)->obj;
+        return nullptr;
+    }
+
+    void mergeBuffer() {
+        if (buffer.empty())
+            return;
+        size_t middle = sorted.size();
+        sorted.insert(sorted.end(), buffer.begin(), buffer.end());
+        std::inplace_merge(sorted.begin(), sorted.begin() + middle, sorted.end());
+        buffer.clear();
+    }
+
+    // size of the interval at the moment its key was taken
+    static Interval keyInterval(const Entry &e) {
+        return Interval(e.key, e.obj->right - e.obj->left + 1);
+    }
+
+    // calls 'f' for every interval keyed inside one of the sorted disjoint 'ranges'
+    template<typename Range, typename Bounds, typename F>
+    void forEachIncluded(const std::vector<Range> &ranges, Bounds bounds, F f) {
+        mergeBuffer();
+        auto e = sorted.begin();
+        for (const Range &range : ranges) {
+            const Interval &interval = bounds(range);
+            while (e != sorted.end() && e->key < interval.left)
+                ++e;
+            // intervals, which are not included into the range, must not intersect it
+            if (e != sorted.begin())
+                assert(!interval.intersects(keyInterval(*(e - 1))));
+            for (; e != sorted.end() && e->key <= interval.right; ++e) {
+                assert(interval.includes(keyInterval(*e)));
+                f(range, e->obj);
+            }
+        }
+    }
+
 public:
     void add(Interval &node) {
-        objects.push_back(&node);
+        Entry entry{node.left, &node};
+        // objects are mostly allocated at growing addresses, so they are appended to the sorted part;
+        // after compaction they grow below its end, then they are appended to the buffer
+        if (sorted.empty() || sorted.back().key < node.left) {
+            sorted.push_back(entry);
+            return;
+        }
+        buffer.insert(std::upper_bound(buffer.begin(), buffer.end(), entry), entry);
+        if (buffer.size() >= bufferCapacity())
+            mergeBuffer();
     }
 
     const Interval *find(const Point &p) const {
-        for (const Interval *obj : objects) {
-            if (obj->contains(p))
-                return obj;
-        }
+        if (const Interval *found = findIn(sorted, p))
+            return found;
+        if (const Interval *found = findIn(buffer, p))
+            return found;
         FAIL_LOUD("Unbound pointer!");
     }
 
-    void moveAndMark(const Interval &interval, const Shift &shift) {
-        for (Interval *obj : objects) {
-            if (interval.includes(*obj)) {
-                obj->move(shift);
+    // 'moved' are the ranges before the move with their shifts
+    void moveAndMark(const std::vector<std::pair<Interval, Shift>> &moved) {
+        forEachIncluded(moved,
+            [](const std::pair<Interval, Shift> &range) -> const Interval & { return range.first; },
+            [](const std::pair<Interval, Shift> &range, Interval *obj) {
+                obj->move(range.second);
                 obj->mark();
-            } else {
-                assert(!interval.intersects(*obj));
-            }
-        }
+            });
     }
 
-    void mark(const Interval &interval) {
-        for (Interval *obj : objects) {
-            if (interval.includes(*obj))
-                obj->mark();
-            else
-                assert(!interval.intersects(*obj));
-        }
+    // intervals already marked by other ranges are skipped
+    void mark(const std::vector<Interval> &ranges) {
+        forEachIncluded(ranges,
+            [](const Interval &range) -> const Interval & { return range; },
+            [](const Interval &, Interval *obj) {
+                if (!obj->isMarked())
+                    obj->mark();
+            });
     }
 
-    // TODO: copy all marked and clear or remove unmarked one by one?
     std::vector<Interval *> clearUnmarked() {
-        std::vector<Interval *> marked;
+        mergeBuffer();
         std::vector<Interval *> unmarked;
-        for (Interval *obj : objects)
-            if (obj->isMarked()) {
-                obj->unmark();
-                marked.push_back(obj);
+        size_t count = 0;
+        for (Entry &e : sorted) {
+            if (e.obj->isMarked()) {
+                e.obj->unmark();
+                // moved intervals get their new addresses as keys
+                sorted[count++] = Entry{e.obj->left, e.obj};
             } else {
-                unmarked.push_back(obj);
-                delete obj;
+                unmarked.push_back(e.obj);
+                delete e.obj;
             }
-        objects = marked;
+        }
+        sorted.resize(count);
+        // compaction keeps the order of objects, so the sort is needed only if GC reordered them
+        if (!std::is_sorted(sorted.begin(), sorted.end()))
+            std::sort(sorted.begin(), sorted.end());
         return unmarked;
     }
 
     std::vector<Interval*> flush() {
+        mergeBuffer();
         std::vector<Interval*> newAddresses;
-        for (Interval *obj : objects)
-            if (!obj->isFlushed()) {
-                newAddresses.push_back(obj);
-                obj->flush();
+        for (Entry &e : sorted)
+            if (!e.obj->isFlushed()) {
+                newAddresses.push_back(e.obj);
+                e.obj->flush();
             }
         return newAddresses;
     }
 
     std::string dumpObjects() const {
         std::string dump;
-        for (const Interval *obj : objects)
-            dump += obj->toString() + "\n";
+        for (const Entry &e : sorted)
+            dump += e.obj->toString() + "\n";
+        for (const Entry &e : buffer)
+            dump += e.obj->toString() + "\n";
         return dump;
     }
 };
@@ -150,19 +150,18 @@ void initCommand(OFFSET offset, bool isBranch, unsigned opsCount, EvalStackOpera
     command.newAddresses = new UINT_PTR[addressesSize];
     unsigned long fullTypesSize = 0;
     for (const auto &newAddress : newAddresses)
-        fullTypesSize += newAddress.second.second;
+        fullTypesSize += newAddress.second->size();
     command.newAddressesTypes = new char[fullTypesSize];
     command.newAddressesTypeLengths = new unsigned long[addressesSize];
     auto begin = command.newAddressesTypes;
     int i = 0;
     for (const auto &newAddress : newAddresses) {
         command.newAddresses[i] = newAddress.first;
-        auto pair = newAddress.second;
-        auto typeSize = pair.second;
+        const auto &type = newAddress.second;
+        auto typeSize = type->size();
         command.newAddressesTypeLengths[i] = typeSize;
-        if (typeSize != 0) memcpy(command.newAddressesTypes, pair.first, typeSize);
+        if (typeSize != 0) memcpy(command.newAddressesTypes, type->data(), typeSize);
         command.newAddressesTypes += typeSize;
-        delete pair.first;
         i++;
     }
     command.newAddressesTypes = begin;
@@ -0,0 +1,26 @@
+#ifndef TESTS_CHECKS_H_
+#define TESTS_CHECKS_H_
+
+#include <iostream>
+
+// failed checks are reported and counted, the test goes on
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+// the exit code of the test
+static int checksResult() {
+    if (failures != 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif // TESTS_CHECKS_H_
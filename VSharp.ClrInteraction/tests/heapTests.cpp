@@ -0,0 +1,81 @@
+#include "memory/heap.h"
+#include "checks.h"
+#include <stdexcept>
+
+using namespace vsharp;
+
+static bool resolvesTo(const Heap &heap, ADDR address, OBJID obj, SIZE offset) {
+    try {
+        VirtualAddress vAddress = heap.physToVirtAddress(address);
+        return vAddress.obj == obj && vAddress.offset == offset;
+    } catch (const std::logic_error &) {
+        return false;
+    }
+}
+
+static bool isUnbound(const Heap &heap, ADDR address) {
+    try {
+        heap.physToVirtAddress(address);
+        return false;
+    } catch (const std::logic_error &) {
+        return true;
+    }
+}
+
+static void appliesGCRangesInOneBatch() {
+    Heap heap;
+    TypeDescriptor type = std::make_shared<const std::vector<char>>();
+    OBJID young1 = heap.allocateObject(0x1000, 0x20, type);
+    OBJID young2 = heap.allocateObject(0x1020, 0x20, type);
+    heap.allocateObject(0x1040, 0x20, type);
+    OBJID survived = heap.allocateObject(0x2000, 0x20, type);
+    OBJID old = heap.allocateObject(0x9000, 0x20, type);
+    CHECK(heap.flushObjects().size() == 5);
+
+    heap.startGC({Interval(0x9000, 0x1000)});
+    // ranges are reported out of order, the objects keep their old addresses until the GC ends
+    heap.markSurvivedObjects(0x2000, 0x100);
+    heap.moveAndMark(0x1020, 0x5020, 0x20);
+    heap.moveAndMark(0x1000, 0x5000, 0x20);
+    CHECK(resolvesTo(heap, 0x1000, young1, 0));
+    heap.clearAfterGC();
+
+    CHECK(resolvesTo(heap, 0x5000, young1, 0));
+    CHECK(resolvesTo(heap, 0x503f, young2, 0x1f));
+    CHECK(resolvesTo(heap, 0x2010, survived, 0x10));
+    CHECK(resolvesTo(heap, 0x9008, old, 0x8));
+    CHECK(isUnbound(heap, 0x1000));
+    CHECK(isUnbound(heap, 0x1040));
+    CHECK(Heap::virtToPhysAddress(VirtualAddress{young2, 4}) == 0x5024);
+
+    // the moved object is tracked at its new address by the next GC
+    heap.startGC({});
+    heap.moveAndMark(0x5000, 0x100, 0x40);
+    heap.clearAfterGC();
+    CHECK(resolvesTo(heap, 0x100, young1, 0));
+    CHECK(resolvesTo(heap, 0x120, young2, 0));
+    CHECK(isUnbound(heap, 0x2000));
+    CHECK(isUnbound(heap, 0x9000));
+    CHECK(heap.flushObjects().empty());
+}
+
+static void keepsConcretenessOfMovedObjects() {
+    Heap heap;
+    TypeDescriptor type = std::make_shared<const std::vector<char>>();
+    heap.allocateObject(0x1000, 0x100, type);
+    heap.write(0x1010, 8, false);
+    CHECK(!heap.read(0x1010, 8));
+    CHECK(heap.read(0x1020, 8));
+
+    heap.startGC({});
+    heap.moveAndMark(0x1000, 0x3000, 0x100);
+    heap.clearAfterGC();
+    CHECK(!heap.read(0x3010, 8));
+    CHECK(heap.read(0x3020, 8));
+}
+
+int main() {
+    appliesGCRangesInOneBatch();
+    keepsConcretenessOfMovedObjects();
+    return checksResult();
+}
@@ -0,0 +1,131 @@
+#include "memory/heap.h"
+#include "checks.h"
+#include <stdexcept>
+
+using namespace vsharp;
+
+static bool isUnbound(const Intervals &tree, ADDR p) {
+    try {
+        tree.find(p);
+        return false;
+    } catch (const std::logic_error &) {
+        return true;
+    }
+}
+
+static Interval *add(Intervals &tree, ADDR left, SIZE size) {
+    auto interval = new Interval(left, size);
+    tree.add(*interval);
+    return interval;
+}
+
+static void findsGrowingAllocations() {
+    Intervals tree;
+    Interval *first = add(tree, 0x100, 0x10);
+    Interval *second = add(tree, 0x200, 0x20);
+    CHECK(tree.find(0x100) == first);
+    CHECK(tree.find(0x10f) == first);
+    CHECK(tree.find(0x21f) == second);
+    CHECK(isUnbound(tree, 0xff));
+    CHECK(isUnbound(tree, 0x110));
+    CHECK(isUnbound(tree, 0x220));
+    tree.clearUnmarked();
+}
+
+static void findsAllocationsBelowTheEnd() {
+    Intervals tree;
+    Interval *top = add(tree, 0x100000, 0x10);
+    // more than the minimal buffer capacity, both in order and reversed
+    std::vector<Interval *> inOrder, reversed;
+    for (ADDR i = 0; i < 200; ++i)
+        inOrder.push_back(add(tree, 0x1000 + i * 0x10, 0x8));
+    for (ADDR i = 200; i > 0; --i)
+        reversed.push_back(add(tree, 0x10000 + i * 0x10, 0x8));
+    CHECK(tree.find(0x100008) == top);
+    for (Interval *interval : inOrder) {
+        CHECK(tree.find(interval->left) == interval);
+        CHECK(tree.find(interval->right) == interval);
+        CHECK(isUnbound(tree, interval->right + 1));
+    }
+    for (Interval *interval : reversed)
+        CHECK(tree.find(interval->left + 4) == interval);
+    tree.clearUnmarked();
+}
+
+static void marksIncludedIntervals() {
+    Intervals tree;
+    Interval *a = add(tree, 0x100, 0x10);
+    Interval *b = add(tree, 0x110, 0x10);
+    Interval *c = add(tree, 0x300, 0x10);
+    // buffered ones are marked as well
+    Interval *d = add(tree, 0x200, 0x10);
+    tree.mark({Interval(0x100, 0x20), Interval(0x200, 0x10)});
+    CHECK(a->isMarked());
+    CHECK(b->isMarked());
+    CHECK(!c->isMarked());
+    CHECK(d->isMarked());
+    // already marked intervals are skipped
+    tree.mark({Interval(0x110, 0x10)});
+    CHECK(b->isMarked());
+
+    std::vector<Interval *> unmarked = tree.clearUnmarked();
+    CHECK(unmarked.size() == 1 && unmarked[0] == c);
+    CHECK(isUnbound(tree, 0x300));
+    CHECK(tree.find(0x105) == a && !a->isMarked());
+    CHECK(tree.find(0x205) == d && !d->isMarked());
+    tree.clearUnmarked();
+}
+
+static void rekeysMovedIntervals() {
+    Intervals tree;
+    Interval *a = add(tree, 0x1000, 0x10);
+    Interval *b = add(tree, 0x2000, 0x10);
+    Interval *c = add(tree, 0x3000, 0x10);
+    // 'a' is moved above 'c', so the keys are reordered; 'b' is compacted down
+    Shift up{0x1000, 0x5000};
+    Shift down{0x2000, 0x1800};
+    tree.moveAndMark({{Interval(0x1000, 0x100), up}, {Interval(0x2000, 0x100), down}});
+    tree.mark({Interval(0x3000, 0x10)});
+    CHECK(a->left == 0x5000 && a->right == 0x500f);
+    CHECK(b->left == 0x1800);
+
+    CHECK(tree.clearUnmarked().empty());
+    CHECK(tree.find(0x5008) == a);
+    CHECK(tree.find(0x1808) == b);
+    CHECK(tree.find(0x3008) == c);
+    CHECK(isUnbound(tree, 0x1008));
+    CHECK(isUnbound(tree, 0x2008));
+
+    // allocations after the compaction go below the end of the index
+    Interval *e = add(tree, 0x2000, 0x10);
+    Interval *f = add(tree, 0x6000, 0x10);
+    CHECK(tree.find(0x2000) == e);
+    CHECK(tree.find(0x6000) == f);
+    tree.mark({Interval(0x1800, 0x1000)});
+    CHECK(b->isMarked() && e->isMarked() && !a->isMarked());
+    std::vector<Interval *> unmarked = tree.clearUnmarked();
+    CHECK(unmarked.size() == 3);
+    CHECK(tree.find(0x1800) == b);
+    CHECK(tree.find(0x200f) == e);
+    tree.clearUnmarked();
+}
+
+static void flushesNewIntervalsOnce() {
+    Intervals tree;
+    add(tree, 0x200, 0x10);
+    add(tree, 0x100, 0x10);
+    CHECK(tree.flush().size() == 2);
+    add(tree, 0x300, 0x10);
+    std::vector<Interval *> flushed = tree.flush();
+    CHECK(flushed.size() == 1 && flushed[0]->left == 0x300);
+    tree.clearUnmarked();
+}
+
+int main() {
+    findsGrowingAllocations();
+    findsAllocationsBelowTheEnd();
+    marksIncludedIntervals();
+    rekeysMovedIntervals();
+    flushesNewIntervalsOnce();
+    return checksResult();
+}
@@ -2,6 +2,9 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "ILRewriter.h"
+#include "cComPtr.h"
+#include "profilerState.h"
+#include "profilerStats.h"
 #include "corhlpr.cpp"
 
     /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -409,7 +412,8 @@ ILRewriter::ILRewriter(
     mdToken tkMethod)
     : m_pICorProfilerInfo(pICorProfilerInfo), m_pICorProfilerFunctionControl(pICorProfilerFunctionControl),
       m_moduleId(moduleID), m_tkMethod(tkMethod), m_fGenerateTinyHeader(false),
-      m_pEH(nullptr), m_pOffsetToInstr(nullptr), m_pOutputBuffer(nullptr), m_pIMethodMalloc(nullptr)
+      m_pEH(nullptr), m_pOffsetToInstr(nullptr), m_pOutputBuffer(nullptr), m_pIMethodMalloc(nullptr),
+      m_pRewritten(nullptr)
 {
     m_IL.m_pNext = &m_IL;
     m_IL.m_pPrev = &m_IL;
@@ -694,6 +698,47 @@ ILInstr * ILRewriter::GetILList()
     return &m_IL;
 }
 
+HRESULT ILRewriter::AddLocal(IMetaDataImport* metadataImport, IMetaDataEmit* metadataEmit, CorElementType type, unsigned* index)
+{
+    COR_SIGNATURE typeSignature = (COR_SIGNATURE) type;
+    return AddLocal(metadataImport, metadataEmit, &typeSignature, 1, index);
+}
+
+HRESULT ILRewriter::AddLocal(IMetaDataImport* metadataImport, IMetaDataEmit* metadataEmit, PCCOR_SIGNATURE type, ULONG typeSize, unsigned* index)
+{
+    ULONG count = 0;
+    PCCOR_SIGNATURE types = nullptr;
+    ULONG typesSize = 0;
+    if (!IsNilToken(m_tkLocalVarSig))
+    {
+        PCCOR_SIGNATURE signature;
+        ULONG signatureSize;
+        IfFailRet(metadataImport->GetSigFromToken(m_tkLocalVarSig, &signature, &signatureSize));
+        types = signature;
+        if (CorSigUncompressData(types) != IMAGE_CEE_CS_CALLCONV_LOCAL_SIG)
+            return E_FAIL;
+        count = CorSigUncompressData(types);
+        typesSize = signatureSize - (ULONG)(types - signature);
+    }
+    // ldloc takes a 16-bit index
+    if (count >= 0xFFFE)
+        return E_FAIL;
+
+    std::vector<COR_SIGNATURE> newSignature;
+    newSignature.push_back(IMAGE_CEE_CS_CALLCONV_LOCAL_SIG);
+    COR_SIGNATURE compressedCount[4];
+    ULONG compressedSize = CorSigCompressData(count + 1, compressedCount);
+    newSignature.insert(newSignature.end(), compressedCount, compressedCount + compressedSize);
+    newSignature.insert(newSignature.end(), types, types + typesSize);
+    newSignature.insert(newSignature.end(), type, type + typeSize);
+
+    mdSignature token;
+    IfFailRet(metadataEmit->GetTokenFromSig(newSignature.data(), (ULONG) newSignature.size(), &token));
+    m_tkLocalVarSig = token;
+    *index = count;
+    return S_OK;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // E X P O R T
@@ -839,6 +884,7 @@ HRESULT ILRewriter::Export()
     }
 
     unsigned codeSize = offset;
+    vsharp::countStat(vsharp::ILBytesAdded, codeSize - m_CodeSize);
     unsigned totalSize;
     LPBYTE pBody = NULL;
     if (m_fGenerateTinyHeader)
@@ -914,12 +960,91 @@ HRESULT ILRewriter::Export()
         }
     }
 
+    if (m_pRewritten != nullptr) {
+        CollectRelocations(pBody, totalSize);
+    }
+
     IfFailRet(SetILFunctionBody(totalSize, pBody));
     DeallocateILMemory(pBody);
 
     return S_OK;
 }
 
+void ILRewriter::CollectRewritten(RewrittenIL *rewritten)
+{
+    m_pRewritten = rewritten;
+}
+
+void ILRewriter::AddRelocation(ILInstr *pInstr, ILRelocationKind kind, UINT32 probe)
+{
+    m_relocations.push_back({ pInstr, { 0, (UINT32)kind, probe } });
+}
+
+void ILRewriter::CollectRelocations(LPBYTE pBody, unsigned totalSize)
+{
+    unsigned headerSize = m_fGenerateTinyHeader ? sizeof(IMAGE_COR_ILMETHOD_TINY) : sizeof(IMAGE_COR_ILMETHOD_FAT);
+    constexpr unsigned CEE_LDC_I = sizeof(size_t) == 8 ? CEE_LDC_I8 : CEE_LDC_I4;
+
+    m_pRewritten->relocations.clear();
+    for (auto &relocation : m_relocations) {
+        ILInstr *pInstr = relocation.first;
+        ILRelocation patch = relocation.second;
+        unsigned expectedOpcode;
+        unsigned operandSize = sizeof(INT32);
+        switch (patch.kind) {
+            case RelocationMethodId:
+                expectedOpcode = CEE_LDC_I4;
+                break;
+            case RelocationProbeAddress:
+                expectedOpcode = CEE_LDC_I;
+                operandSize = sizeof(size_t);
+                break;
+            default:
+                expectedOpcode = CEE_CALLI;
+                break;
+        }
+        // the instruction was rewritten by a later pass, so the body cannot be patched safely
+        if (pInstr->m_opcode != expectedOpcode || (patch.kind != RelocationMethodId && vsharp::probeAt((int)patch.probe) == nullptr)) {
+            m_pRewritten->body.clear();
+            m_pRewritten->relocations.clear();
+            return;
+        }
+        patch.offset = headerSize + pInstr->m_pNext->m_offset - operandSize;
+        m_pRewritten->relocations.push_back(patch);
+    }
+    m_pRewritten->body.assign(pBody, pBody + totalSize);
+}
+
+HRESULT ILRewriter::ExportCached(const BYTE *body, UINT32 size, const std::vector<ILRelocation> &relocations, int methodId)
+{
+    LPBYTE pBody = AllocateILMemory(size);
+    IfNullRet(pBody);
+    CopyMemory(pBody, body, size);
+
+    for (auto &relocation : relocations) {
+        vsharp::ProbeCall *probe = vsharp::probeAt((int)relocation.probe);
+        switch (relocation.kind) {
+            case RelocationMethodId:
+                *(UNALIGNED INT32 *)&(pBody[relocation.offset]) = methodId;
+                break;
+            case RelocationProbeAddress:
+                *(UNALIGNED size_t *)&(pBody[relocation.offset]) = probe->addr;
+                break;
+            case RelocationProbeSignature:
+                *(UNALIGNED INT32 *)&(pBody[relocation.offset]) = probe->getSig();
+                break;
+            default:
+                DeallocateILMemory(pBody);
+                return E_FAIL;
+        }
+    }
+
+    IfFailRet(SetILFunctionBody(size, pBody));
+    DeallocateILMemory(pBody);
+
+    return S_OK;
+}
+
 HRESULT ILRewriter::SetILFunctionBody(unsigned size, LPBYTE pBody)
 {
     if (m_pICorProfilerFunctionControl != NULL)
@@ -965,6 +1090,20 @@ void ILRewriter::DeallocateILMemory(LPBYTE pBody)
     delete[] pBody;
 }
 
+int ProbeSiteIndexer::indexOf(unsigned offset) {
+    auto found = m_indices.find(offset);
+    if (found != m_indices.end())
+        return found->second;
+    int index = static_cast<int>(m_offsets.size());
+    m_indices[offset] = index;
+    m_offsets.push_back(offset);
+    return index;
+}
+
+const std::vector<OFFSET>& ProbeSiteIndexer::offsets() const {
+    return m_offsets;
+}
+
 HRESULT AddProbe(
     ILRewriter * pilr,
     UINT_PTR methodAddress,
@@ -975,15 +1114,20 @@ HRESULT AddProbe(
 
     constexpr auto CEE_LDC_I = sizeof(size_t) == 8 ? CEE_LDC_I8 : sizeof(size_t) == 4 ? CEE_LDC_I4 : throw std::logic_error("size_t must be defined as 8 or 4");
 
+    // unknown addresses are kept as UINT32_MAX, the rewritten body is not cached then
+    auto probeIndex = (UINT32)vsharp::indexOfProbe((INT_PTR)methodAddress);
+
     pNewInstr = pilr->NewILInstr();
     pNewInstr->m_opcode = CEE_LDC_I;
     pNewInstr->m_Arg64 = methodAddress;
     pilr->InsertBefore(pInsertProbeBeforeThisInstr, pNewInstr);
+    pilr->AddRelocation(pNewInstr, RelocationProbeAddress, probeIndex);
 
     pNewInstr = pilr->NewILInstr();
     pNewInstr->m_opcode = CEE_CALLI;
     pNewInstr->m_Arg32 = methodSignature;
     pilr->InsertBefore(pInsertProbeBeforeThisInstr, pNewInstr);
+    pilr->AddRelocation(pNewInstr, RelocationProbeSignature, probeIndex);
 
     return S_OK;
 }
@@ -1031,6 +1175,7 @@ HRESULT AddEnterProbe(
     offsetInstr->m_opcode = CEE_LDC_I4;
     offsetInstr->m_Arg32 = (INT32)methodId;
     pilr->InsertBefore(pFirstOriginalInstr, offsetInstr);
+    pilr->AddRelocation(offsetInstr, RelocationMethodId, 0);
 
     ILInstr * spontaneousInstr;
     spontaneousInstr = pilr->NewILInstr();
@@ -1096,6 +1241,12 @@ ILInstr *AddLDCInstrBefore(ILRewriter *pilr, ILInstr *pInstr, INT32 arg) {
     return pNewInstr;
 }
 
+ILInstr *AddMethodIdBefore(ILRewriter *pilr, ILInstr *pInstr, int methodId) {
+    ILInstr *pNewInstr = AddLDCInstrBefore(pilr, pInstr, methodId);
+    pilr->AddRelocation(pNewInstr, RelocationMethodId, 0);
+    return pNewInstr;
+}
+
 bool IsTailcallRet(ILInstr *pInstr) {
     return pInstr->m_opcode == CEE_RET && pInstr->m_pPrev->m_pPrev->m_opcode == CEE_TAILCALL;
 }
@@ -1144,7 +1295,8 @@ HRESULT AddCoverageProbeAfter(
     ILRewriter* pilr,
     ILInstr*& pInstr,
     vsharp::ProbeCall* probe,
-    int methodId)
+    int methodId,
+    ProbeSiteIndexer& sites)
 {
     // new instruction for easier exception handling
     ILInstr* pNewInstr = pilr->NewILInstr();
@@ -1153,7 +1305,9 @@ HRESULT AddCoverageProbeAfter(
 
     AddLDCInstrBefore(pilr, pNewInstr, (INT32)pInstr->m_offset);
 
-    AddLDCInstrBefore(pilr, pNewInstr, methodId);
+    AddMethodIdBefore(pilr, pNewInstr, methodId);
+
+    AddLDCInstrBefore(pilr, pNewInstr, sites.indexOf(pInstr->m_offset));
 
     // adding the probe
     IfFailRet(AddProbe(pilr, probe->addr, probe->getSig(), pNewInstr));
@@ -1169,7 +1323,8 @@ HRESULT AddCoverageProbeBefore(
         ILRewriter *pilr,
         ILInstr *&pInstr,
         vsharp::ProbeCall* probe,
-        int methodId)
+        int methodId,
+        ProbeSiteIndexer& sites)
 {
     // adding the new instruction
     ILInstr * pNewInstr = pilr->NewILInstr();
@@ -1181,7 +1336,9 @@ HRESULT AddCoverageProbeBefore(
 
     AddLDCInstrBefore(pilr, pNewInstr, (INT32)pInstr->m_offset);
 
-    AddLDCInstrBefore(pilr, pNewInstr, methodId);
+    AddMethodIdBefore(pilr, pNewInstr, methodId);
+
+    AddLDCInstrBefore(pilr, pNewInstr, sites.indexOf(pInstr->m_offset));
 
     // adding the probe
     IfFailRet(AddProbe(pilr, probe->addr, probe->getSig(), pNewInstr));
@@ -1194,7 +1351,8 @@ HRESULT AddCoverageProbeBefore(
 
 HRESULT AddExitProbe(
     ILRewriter* pilr,
-    int methodId)
+    int methodId,
+    ProbeSiteIndexer& sites)
 {
     BOOL isTailCall = FALSE;
     auto covProb = vsharp::getProbes();
@@ -1209,7 +1367,7 @@ HRESULT AddExitProbe(
             case CEE_TAILCALL:
             {
                 isTailCall = TRUE;
-                AddCoverageProbeBefore(pilr, pInstr, covProb->Tailcall, methodId);
+                AddCoverageProbeBefore(pilr, pInstr, covProb->Tailcall, methodId, sites);
                 break;
             }
             case CEE_RET:
@@ -1218,7 +1376,7 @@ HRESULT AddExitProbe(
                     isTailCall = FALSE;
                     break;
                 }
-                AddCoverageProbeBefore(pilr, pInstr, covProb->Leave, methodId);
+                AddCoverageProbeBefore(pilr, pInstr, covProb->Leave, methodId, sites);
                 break;
             }
 
@@ -1230,12 +1388,22 @@ HRESULT AddExitProbe(
     return S_OK;
 }
 
-HRESULT MakeProbeInsertion(ILRewriter *pilr, ProbeInsertion toInsert, int methodId) {
+// probes which only record coverage are omitted for the blocks covered by the baseline
+bool IsCoveredByBaseline(const std::set<OFFSET>* baselineOffsets, const ProbeInsertion& insertion) {
+    if (baselineOffsets == nullptr || baselineOffsets->count(insertion.target->m_offset) == 0)
+        return false;
+    auto covProb = vsharp::getProbes();
+    auto probe = insertion.probe;
+    return probe == covProb->Coverage || probe == covProb->Branch || probe == covProb->Stsfld
+        || probe == covProb->Call || probe == covProb->Throw;
+}
+
+HRESULT MakeProbeInsertion(ILRewriter *pilr, ProbeInsertion toInsert, int methodId, ProbeSiteIndexer& sites) {
     if (toInsert.isBeforeInstr) {
-        IfFailRet(AddCoverageProbeBefore(pilr, toInsert.target, toInsert.probe, methodId));
+        IfFailRet(AddCoverageProbeBefore(pilr, toInsert.target, toInsert.probe, methodId, sites));
     }
     else {
-        IfFailRet(AddCoverageProbeAfter(pilr, toInsert.target, toInsert.probe, methodId));
+        IfFailRet(AddCoverageProbeAfter(pilr, toInsert.target, toInsert.probe, methodId, sites));
     }
     return S_OK;
 }
@@ -1246,6 +1414,529 @@ bool OpcodeIsBranch(unsigned opcode) {
         || opcode == CEE_LEAVE || opcode == CEE_LEAVE_S;
 }
 
+// adds an instruction taking the index of a local
+ILInstr *AddInstrBefore(ILRewriter *pilr, ILInstr *pInstr, unsigned opcode, unsigned local) {
+    ILInstr *pNewInstr = pilr->NewILInstr();
+    pNewInstr->m_opcode = opcode;
+    pNewInstr->m_Arg16 = (INT16) local;
+    pilr->InsertBefore(pInstr, pNewInstr);
+    return pNewInstr;
+}
+
+//region Comparison operands capture
+struct ComparisonSite {
+    // the probe is inserted before this instruction; for integer comparisons it pushes the last operand,
+    // for string ones the runtime string operand is on the top of the stack before it
+    ILInstr *where;
+    unsigned offset;
+    vsharp::ComparisonKind kind;
+    // the constant operand for integer comparisons and the literal id for string ones
+    INT64 operand;
+};
+
+bool GetIntegerConstant(ILInstr *pInstr, INT64 &value) {
+    unsigned opcode = pInstr->m_opcode;
+    if (CEE_LDC_I4_M1 <= opcode && opcode <= CEE_LDC_I4_8) {
+        value = (INT64)opcode - CEE_LDC_I4_0;
+        return true;
+    }
+    switch (opcode) {
+        case CEE_LDC_I4_S:
+            value = pInstr->m_Arg8;
+            return true;
+        case CEE_LDC_I4:
+            value = pInstr->m_Arg32;
+            return true;
+        case CEE_LDC_I8:
+            value = pInstr->m_Arg64;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool GetIntegerComparisonKind(unsigned opcode, vsharp::ComparisonKind &kind) {
+    switch (opcode) {
+        case CEE_BEQ_S: case CEE_BEQ: case CEE_CEQ:
+            kind = vsharp::CompareEqual;
+            return true;
+        case CEE_BNE_UN_S: case CEE_BNE_UN:
+            kind = vsharp::CompareNotEqual;
+            return true;
+        case CEE_BLT_S: case CEE_BLT: case CEE_BLT_UN_S: case CEE_BLT_UN: case CEE_CLT: case CEE_CLT_UN:
+            kind = vsharp::CompareLess;
+            return true;
+        case CEE_BLE_S: case CEE_BLE: case CEE_BLE_UN_S: case CEE_BLE_UN:
+            kind = vsharp::CompareLessOrEqual;
+            return true;
+        case CEE_BGT_S: case CEE_BGT: case CEE_BGT_UN_S: case CEE_BGT_UN: case CEE_CGT: case CEE_CGT_UN:
+            kind = vsharp::CompareGreater;
+            return true;
+        case CEE_BGE_S: case CEE_BGE: case CEE_BGE_UN_S: case CEE_BGE_UN:
+            kind = vsharp::CompareGreaterOrEqual;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool IsSimplePush(ILInstr *pInstr) {
+    INT64 ignored;
+    unsigned opcode = pInstr->m_opcode;
+    return (CEE_LDARG_0 <= opcode && opcode <= CEE_LDLOC_3)
+        || opcode == CEE_LDARG_S || opcode == CEE_LDARG
+        || opcode == CEE_LDLOC_S || opcode == CEE_LDLOC
+        || GetIntegerConstant(pInstr, ignored);
+}
+
+bool EqualsAscii(const WCHAR *str, ULONG length, const char *ascii) {
+    ULONG i = 0;
+    // metadata lengths include the terminating null
+    for (; i < length && str[i] != 0; i++) {
+        if (ascii[i] == 0 || str[i] != (WCHAR)ascii[i])
+            return false;
+    }
+    return ascii[i] == 0;
+}
+
+// counts the arguments of the method including 'this' and how many of the first of them are strings
+bool CountStringArguments(PCCOR_SIGNATURE signature, ULONG signatureSize, ULONG &argsCount, ULONG &leadingStrings) {
+    PCCOR_SIGNATURE end = signature + signatureSize;
+    ULONG callingConvention = CorSigUncompressData(signature);
+    if (callingConvention & IMAGE_CEE_CS_CALLCONV_GENERIC)
+        return false;
+    bool hasThis = (callingConvention & IMAGE_CEE_CS_CALLCONV_HASTHIS) != 0;
+    ULONG paramsCount = CorSigUncompressData(signature);
+    // comparison methods return bool or int, so the return type takes one element
+    CorElementType returnType = CorSigUncompressElementType(signature);
+    if (returnType != ELEMENT_TYPE_BOOLEAN && returnType != ELEMENT_TYPE_I4)
+        return false;
+    argsCount = paramsCount + (hasThis ? 1 : 0);
+    // 'this' of System.String methods is a string
+    leadingStrings = hasThis ? 1 : 0;
+    for (ULONG i = 0; i < paramsCount && signature < end; i++) {
+        if (CorSigUncompressElementType(signature) != ELEMENT_TYPE_STRING)
+            break;
+        leadingStrings++;
+    }
+    return true;
+}
+
+// checks that the token refers to one of System.String comparison methods
+bool GetStringComparisonKind(IMetaDataImport *metadataImport, mdToken method, vsharp::ComparisonKind &kind, ULONG &argsCount, ULONG &leadingStrings) {
+    const ULONG nameCapacity = 64;
+    WCHAR name[nameCapacity];
+    ULONG nameLength = 0;
+    mdToken parent = mdTokenNil;
+    PCCOR_SIGNATURE signature = nullptr;
+    ULONG signatureSize = 0;
+    if (TypeFromToken(method) == mdtMemberRef) {
+        if (FAILED(metadataImport->GetMemberRefProps(method, &parent, name, nameCapacity, &nameLength, &signature, &signatureSize)))
+            return false;
+    } else if (TypeFromToken(method) == mdtMethodDef) {
+        if (FAILED(metadataImport->GetMethodProps(method, &parent, name, nameCapacity, &nameLength, nullptr, &signature, &signatureSize, nullptr, nullptr)))
+            return false;
+    } else {
+        return false;
+    }
+
+    WCHAR typeName[nameCapacity];
+    ULONG typeNameLength = 0;
+    if (TypeFromToken(parent) == mdtTypeRef) {
+        if (FAILED(metadataImport->GetTypeRefProps(parent, nullptr, typeName, nameCapacity, &typeNameLength)))
+            return false;
+    } else if (TypeFromToken(parent) == mdtTypeDef) {
+        if (FAILED(metadataImport->GetTypeDefProps(parent, typeName, nameCapacity, &typeNameLength, nullptr, nullptr)))
+            return false;
+    } else {
+        return false;
+    }
+    if (!EqualsAscii(typeName, typeNameLength, "System.String"))
+        return false;
+    if (!CountStringArguments(signature, signatureSize, argsCount, leadingStrings))
+        return false;
+
+    if (EqualsAscii(name, nameLength, "Equals") || EqualsAscii(name, nameLength, "op_Equality")
+        || EqualsAscii(name, nameLength, "op_Inequality")) {
+        kind = vsharp::CompareStringEquality;
+        return true;
+    }
+    if (EqualsAscii(name, nameLength, "CompareTo") || EqualsAscii(name, nameLength, "Compare")
+        || EqualsAscii(name, nameLength, "CompareOrdinal")) {
+        kind = vsharp::CompareStringOrder;
+        return true;
+    }
+    return false;
+}
+
+// string comparisons are captured only if one of the operands is a literal pushed right before the call
+// and the other one is a string; returns the instruction before which the other operand is on the top of the stack
+ILInstr *FindStringComparisonSite(ILInstr *pCall, ULONG argsCount, ULONG leadingStrings, ILInstr *&literal) {
+    // probes must not separate prefixes from the call
+    ILInstr *pFirst = pCall;
+    while (IsPrefix(pFirst->m_pPrev))
+        pFirst = pFirst->m_pPrev;
+    // tail calls are rewritten by the coverage probes, such sites are skipped
+    if (pFirst != pCall && pCall->m_pPrev->m_opcode == CEE_TAILCALL)
+        return nullptr;
+
+    ILInstr *pPrev = pFirst->m_pPrev;
+    // the literal is the last argument, the string below it is the other operand
+    if (pPrev->m_opcode == CEE_LDSTR) {
+        literal = pPrev;
+        return argsCount >= 2 && leadingStrings >= argsCount ? literal : nullptr;
+    }
+    if (!IsSimplePush(pPrev) || pPrev->m_pPrev->m_opcode != CEE_LDSTR)
+        return nullptr;
+    literal = pPrev->m_pPrev;
+    // the literal is followed by the other operand
+    INT64 ignored;
+    if (argsCount >= 2 && leadingStrings >= argsCount && !GetIntegerConstant(pPrev, ignored))
+        return pFirst;
+    // the literal is followed by the comparison options, the other operand is below it
+    if (argsCount >= 3 && leadingStrings >= argsCount - 1)
+        return literal;
+    return nullptr;
+}
+
+void CollectComparisonSite(IMetaDataImport *metadataImport, ILInstr *pInstr, std::vector<ComparisonSite> &sites) {
+    unsigned opcode = pInstr->m_opcode;
+    vsharp::ComparisonKind kind;
+    INT64 constant;
+
+    if (GetIntegerComparisonKind(opcode, kind)) {
+        if (GetIntegerConstant(pInstr->m_pPrev, constant))
+            sites.push_back({ pInstr->m_pPrev, pInstr->m_offset, kind, constant });
+        return;
+    }
+
+    if (opcode == CEE_SWITCH) {
+        sites.push_back({ pInstr, pInstr->m_offset, vsharp::CompareSwitch, (INT64)pInstr->m_Arg32 });
+        return;
+    }
+
+    if ((opcode != CEE_CALL && opcode != CEE_CALLVIRT) || metadataImport == nullptr)
+        return;
+    ULONG argsCount = 0;
+    ULONG leadingStrings = 0;
+    if (!GetStringComparisonKind(metadataImport, pInstr->m_Arg32, kind, argsCount, leadingStrings))
+        return;
+    ILInstr *literal = nullptr;
+    ILInstr *where = FindStringComparisonSite(pInstr, argsCount, leadingStrings, literal);
+    if (where == nullptr)
+        return;
+
+    ULONG length = 0;
+    if (FAILED(metadataImport->GetUserString(literal->m_Arg32, nullptr, 0, &length)))
+        return;
+    std::vector<WCHAR> value(length);
+    if (length > 0 && FAILED(metadataImport->GetUserString(literal->m_Arg32, value.data(), length, &length)))
+        return;
+    int literalId = vsharp::profilerState->coverageTracker->addComparedLiteral(value);
+    sites.push_back({ where, pInstr->m_offset, kind, literalId });
+}
+
+// the original instruction becomes the first instruction of the probe, so branches to it still reach the probe
+ILInstr *SplitInstrForProbe(ILRewriter *pilr, ILInstr *pInstr, unsigned firstOpcode) {
+    ILInstr *pNewInstr = pilr->NewILInstr();
+    pNewInstr->m_opcode = pInstr->m_opcode;
+    pNewInstr->m_Arg64 = pInstr->m_Arg64;
+    pilr->InsertAfter(pInstr, pNewInstr);
+
+    pInstr->m_opcode = firstOpcode;
+    CorrectHandlers(pilr, pInstr, pNewInstr);
+    return pNewInstr;
+}
+
+bool IsStringComparison(const ComparisonSite &site) {
+    return site.kind == vsharp::CompareStringEquality || site.kind == vsharp::CompareStringOrder;
+}
+
+// 'pinnedString' is a pinned string local, which keeps the runtime operand in place while the probe reads it
+HRESULT AddComparisonProbe(ILRewriter *pilr, const ComparisonSite &site, int methodId, unsigned pinnedString) {
+    auto covProb = vsharp::getProbes();
+
+    if (IsStringComparison(site)) {
+        // copying the runtime string into the pinned local and passing its address
+        ILInstr *pOriginal = SplitInstrForProbe(pilr, site.where, CEE_DUP);
+        AddInstrBefore(pilr, pOriginal, CEE_STLOC, pinnedString);
+        AddInstrBefore(pilr, pOriginal, CEE_LDLOC, pinnedString);
+        ILInstr *pNewInstr = pilr->NewILInstr();
+        pNewInstr->m_opcode = CEE_CONV_U;
+        pilr->InsertBefore(pOriginal, pNewInstr);
+        AddLDCInstrBefore(pilr, pOriginal, (INT32)site.offset);
+        AddMethodIdBefore(pilr, pOriginal, methodId);
+        AddLDCInstrBefore(pilr, pOriginal, (INT32)site.operand);
+        AddLDCInstrBefore(pilr, pOriginal, site.kind);
+        IfFailRet(AddProbe(pilr, covProb->CompareString->addr, covProb->CompareString->getSig(), pOriginal));
+        // unpinning
+        pNewInstr = pilr->NewILInstr();
+        pNewInstr->m_opcode = CEE_LDNULL;
+        pilr->InsertBefore(pOriginal, pNewInstr);
+        AddInstrBefore(pilr, pOriginal, CEE_STLOC, pinnedString);
+        return S_OK;
+    }
+
+    // copying the runtime operand which is on the top of the stack
+    ILInstr *pOriginal = SplitInstrForProbe(pilr, site.where, CEE_DUP);
+
+    ILInstr *pNewInstr = pilr->NewILInstr();
+    pNewInstr->m_opcode = CEE_CONV_I8;
+    pilr->InsertBefore(pOriginal, pNewInstr);
+
+    pNewInstr = pilr->NewILInstr();
+    pNewInstr->m_opcode = CEE_LDC_I8;
+    pNewInstr->m_Arg64 = site.operand;
+    pilr->InsertBefore(pOriginal, pNewInstr);
+
+    AddLDCInstrBefore(pilr, pOriginal, (INT32)site.offset);
+    AddMethodIdBefore(pilr, pOriginal, methodId);
+    AddLDCInstrBefore(pilr, pOriginal, site.kind);
+    return AddProbe(pilr, covProb->CompareInt->addr, covProb->CompareInt->getSig(), pOriginal);
+}
+//endregion
+
+//region Ball-Larus path profiling
+struct PathBlock {
+    ILInstr *first;
+    // for switches, the last switch argument
+    ILInstr *last;
+};
+
+struct PathEdge {
+    int from;
+    // the index of the target block, 'pathExit' for the method exit
+    int to;
+    // the branch or the switch argument whose target is rerouted; nullptr for fall-through and exit edges
+    ILInstr *jump;
+    bool isBack;
+};
+
+static const int pathExit = -1;
+static const UINT64 maxPathsCount = 0x7FFFFFFF;
+
+bool EndsPathBlock(unsigned opcode) {
+    return OpcodeIsBranch(opcode) || opcode == CEE_RET || opcode == CEE_THROW || opcode == CEE_RETHROW;
+}
+
+// splits the final IL into basic blocks; returns false for the methods path profiling does not support
+bool BuildPathBlocks(ILRewriter *pilr, std::vector<PathBlock> &blocks, std::map<ILInstr*, int> &blockOf) {
+    ILInstr *list = pilr->GetILList();
+    std::set<ILInstr*> leaders;
+    leaders.insert(list->m_pNext);
+    for (ILInstr *pInstr = list->m_pNext; pInstr != list; pInstr = pInstr->m_pNext) {
+        unsigned opcode = pInstr->m_opcode;
+        // exits after tail calls and jumps cannot be instrumented
+        if (opcode == CEE_TAILCALL || opcode == CEE_JMP)
+            return false;
+        if (opcode == CEE_SWITCH) {
+            INT32 argsCount = pInstr->m_Arg32;
+            for (int i = 0; i < argsCount; i++) {
+                pInstr = pInstr->m_pNext;
+                leaders.insert(pInstr->m_pTarget);
+            }
+        } else if (OpcodeIsBranch(opcode)) {
+            leaders.insert(pInstr->m_pTarget);
+        }
+        if (EndsPathBlock(opcode) && pInstr->m_pNext != list)
+            leaders.insert(pInstr->m_pNext);
+    }
+
+    for (ILInstr *pInstr = list->m_pNext; pInstr != list; pInstr = pInstr->m_pNext) {
+        if (leaders.count(pInstr) > 0) {
+            blockOf[pInstr] = static_cast<int>(blocks.size());
+            blocks.push_back({ pInstr, pInstr });
+        } else {
+            blocks.back().last = pInstr;
+        }
+    }
+    return true;
+}
+
+void CollectPathEdges(ILRewriter *pilr, const std::vector<PathBlock> &blocks, std::map<ILInstr*, int> &blockOf, std::vector<std::vector<PathEdge>> &edges) {
+    ILInstr *list = pilr->GetILList();
+    edges.resize(blocks.size());
+    for (int i = 0; i < (int) blocks.size(); i++) {
+        ILInstr *last = blocks[i].last;
+        unsigned opcode = last->m_opcode;
+        if (opcode == CEE_RET || opcode == CEE_THROW || opcode == CEE_RETHROW) {
+            edges[i].push_back({ i, pathExit, nullptr, false });
+            continue;
+        }
+        bool fallsThrough = opcode != CEE_BR && opcode != CEE_BR_S;
+        if (fallsThrough && last->m_pNext != list)
+            edges[i].push_back({ i, blockOf[last->m_pNext], nullptr, false });
+        if (opcode == CEE_SWITCH_ARG) {
+            ILInstr *pSwitch = last;
+            while (pSwitch->m_opcode == CEE_SWITCH_ARG)
+                pSwitch = pSwitch->m_pPrev;
+            for (ILInstr *arg = pSwitch->m_pNext; arg != last->m_pNext; arg = arg->m_pNext)
+                edges[i].push_back({ i, blockOf[arg->m_pTarget], arg, false });
+        } else if (OpcodeIsBranch(opcode)) {
+            edges[i].push_back({ i, blockOf[last->m_pTarget], last, false });
+        }
+    }
+}
+
+// marks the back edges of a depth-first search from the entry and returns the blocks in postorder
+std::vector<int> MarkBackEdges(std::vector<std::vector<PathEdge>> &edges) {
+    enum { notVisited, onStack, finished };
+    std::vector<int> state(edges.size(), notVisited);
+    std::vector<int> postorder;
+    // (block, index of the next edge to visit)
+    std::vector<std::pair<int, size_t>> stack;
+    stack.emplace_back(0, 0);
+    state[0] = onStack;
+    while (!stack.empty()) {
+        int block = stack.back().first;
+        size_t edgeIndex = stack.back().second;
+        if (edgeIndex == edges[block].size()) {
+            state[block] = finished;
+            postorder.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+        stack.back().second++;
+        PathEdge &edge = edges[block][edgeIndex];
+        if (edge.to == pathExit)
+            continue;
+        if (state[edge.to] == onStack) {
+            edge.isBack = true;
+        } else if (state[edge.to] == notVisited) {
+            state[edge.to] = onStack;
+            stack.emplace_back(edge.to, 0);
+        }
+    }
+    return postorder;
+}
+
+// expects the path register on the stack, records 'pathRegister + increment' as the path id
+HRESULT AddPathProbeBefore(ILRewriter *pilr, ILInstr *pInstr, INT32 increment, int methodId) {
+    auto probe = vsharp::getProbes()->Path;
+    AddLDCInstrBefore(pilr, pInstr, increment);
+    AddInstrBefore(pilr, pInstr, CEE_ADD, 0);
+    AddMethodIdBefore(pilr, pInstr, methodId);
+    return AddProbe(pilr, probe->addr, probe->getSig(), pInstr);
+}
+
+// Numbers the acyclic paths of the method with the Ball-Larus algorithm: the path register accumulates edge values
+// and the path id is recorded at the exits and the back edges, after which the register restarts from the loop header
+HRESULT AddPathProfiling(ILRewriter *pilr, IMetaDataImport *metadataImport, IMetaDataEmit *metadataEmit, int methodId) {
+    if (pilr->m_nEH > 0 || metadataImport == nullptr || metadataEmit == nullptr)
+        return S_OK;
+
+    std::vector<PathBlock> blocks;
+    std::map<ILInstr*, int> blockOf;
+    if (!BuildPathBlocks(pilr, blocks, blockOf))
+        return S_OK;
+    std::vector<std::vector<PathEdge>> edges;
+    CollectPathEdges(pilr, blocks, blockOf, edges);
+    std::vector<int> postorder = MarkBackEdges(edges);
+
+    // back edges v->w are replaced with the dummy edges v->EXIT and ENTRY->w
+    std::vector<bool> hasBackEdge(blocks.size(), false);
+    std::set<int> loopHeaders;
+    for (auto &blockEdges : edges) {
+        for (auto &edge : blockEdges) {
+            if (edge.isBack) {
+                hasBackEdge[edge.from] = true;
+                if (edge.to != 0)
+                    loopHeaders.insert(edge.to);
+            }
+        }
+    }
+
+    std::vector<UINT64> pathsCount(blocks.size(), 0);
+    // value of the edge to the block, or to 'pathExit', in the numbering order of the successors
+    std::vector<std::map<int, UINT64>> edgeValues(blocks.size());
+    std::vector<UINT64> backExitValues(blocks.size(), 0);
+    std::map<int, UINT64> loopHeaderValues;
+    for (int block : postorder) {
+        UINT64 count = 0;
+        for (auto &edge : edges[block]) {
+            if (edge.isBack || edgeValues[block].count(edge.to) > 0)
+                continue;
+            edgeValues[block][edge.to] = count;
+            count += edge.to == pathExit ? 1 : pathsCount[edge.to];
+        }
+        if (hasBackEdge[block]) {
+            backExitValues[block] = count;
+            count++;
+        }
+        if (block == 0) {
+            for (int header : loopHeaders) {
+                loopHeaderValues[header] = count;
+                count += pathsCount[header];
+            }
+        }
+        if (count > maxPathsCount) {
+            LOG(tout << "Too many paths in method " << methodId << ", path profiling skipped");
+            return S_OK;
+        }
+        pathsCount[block] = count;
+    }
+    loopHeaderValues[0] = 0;
+
+    unsigned pathRegister;
+    IfFailRet(pilr->AddLocal(metadataImport, metadataEmit, ELEMENT_TYPE_I4, &pathRegister));
+
+    ILInstr *list = pilr->GetILList();
+    std::vector<PathEdge> exits;
+    for (int block : postorder) {
+        for (auto &edge : edges[block]) {
+            if (edge.to == pathExit) {
+                exits.push_back(edge);
+                continue;
+            }
+            INT32 increment = (INT32) (edge.isBack ? backExitValues[block] : edgeValues[block][edge.to]);
+            if (!edge.isBack && increment == 0)
+                continue;
+
+            // fall-through code goes before the next block, so the branches to that block skip it;
+            // taken edges get a trampoline at the end of the method which jumps to the original target
+            ILInstr *pWhere;
+            if (edge.jump == nullptr) {
+                pWhere = blocks[block].last->m_pNext;
+            } else {
+                pWhere = pilr->NewILInstr();
+                pWhere->m_opcode = CEE_BR;
+                pWhere->m_pTarget = edge.jump->m_pTarget;
+                pilr->InsertBefore(list, pWhere);
+            }
+
+            ILInstr *pFirst = AddInstrBefore(pilr, pWhere, CEE_LDLOC, pathRegister);
+            if (edge.isBack) {
+                IfFailRet(AddPathProbeBefore(pilr, pWhere, increment, methodId));
+                AddLDCInstrBefore(pilr, pWhere, (INT32) loopHeaderValues[edge.to]);
+            } else {
+                AddLDCInstrBefore(pilr, pWhere, increment);
+                AddInstrBefore(pilr, pWhere, CEE_ADD, 0);
+            }
+            AddInstrBefore(pilr, pWhere, CEE_STLOC, pathRegister);
+
+            if (edge.jump != nullptr)
+                edge.jump->m_pTarget = pFirst;
+        }
+    }
+
+    // the exit instruction becomes the first instruction of the probe, so the branches to it still reach the probe
+    for (auto &edge : exits) {
+        ILInstr *pExit = blocks[edge.from].last;
+        ILInstr *pOriginal = SplitInstrForProbe(pilr, pExit, CEE_LDLOC);
+        pExit->m_Arg64 = 0;
+        pExit->m_Arg16 = (INT16) pathRegister;
+        IfFailRet(AddPathProbeBefore(pilr, pOriginal, (INT32) edgeValues[edge.from][pathExit], methodId));
+    }
+
+    ILInstr *pFirstOriginalInstr = list->m_pNext;
+    AddLDCInstrBefore(pilr, pFirstOriginalInstr, 0);
+    AddInstrBefore(pilr, pFirstOriginalInstr, CEE_STLOC, pathRegister);
+
+    vsharp::countStat(vsharp::PathProfiledMethods);
+    return S_OK;
+}
+//endregion
+
 // Uses the general-purpose ILRewriter class to import original
 // IL, rewrite it, and send the result to the CLR
 HRESULT RewriteIL(
@@ -1254,8 +1945,15 @@ HRESULT RewriteIL(
         ModuleID moduleID,
         mdMethodDef methodDef,
         int methodId,
-        bool isMain)
+        bool isMain,
+        bool captureComparisons,
+        bool profilePaths,
+        vsharp::InstrumentationGranularity granularity,
+        const std::set<OFFSET>* baselineOffsets,
+        std::vector<OFFSET>& blockOffsets,
+        RewrittenIL* rewritten)
 {
+    vsharp::StatTimer timer(vsharp::RewriteNanoseconds);
     ILRewriter rewriter(pICorProfilerInfo, pICorProfilerFunctionControl, moduleID, methodDef);
     auto pilr = &rewriter;
 
@@ -1275,23 +1973,49 @@ HRESULT RewriteIL(
     IfFailRet(rewriter.Import());
     countOffsets(&rewriter);
 
+    // the enter site always gets block index 0, enter probes rely on it
+    ProbeSiteIndexer sites;
+    sites.indexOf(pilr->GetILList()->m_pNext->m_offset);
+
     BOOL isTailCall = FALSE;
 
     std::vector<ProbeInsertion> addPriorityProbe;
     std::vector<ProbeInsertion> addTargetProbe;
     std::set<unsigned> coveredInstructions;
+    std::vector<ComparisonSite> comparisonSites;
+
+    CComPtr<IMetaDataImport> metadataImport;
+    if (captureComparisons || profilePaths) {
+        if (FAILED(pICorProfilerInfo->GetModuleMetaData(moduleID, ofRead, IID_IMetaDataImport, reinterpret_cast<IUnknown **>(&metadataImport))))
+            LOG(tout << "Failed to get metadata, string comparisons and paths will not be captured");
+    }
+    CComPtr<IMetaDataEmit> metadataEmit;
+    if (captureComparisons || profilePaths) {
+        if (FAILED(pICorProfilerInfo->GetModuleMetaData(moduleID, ofRead | ofWrite, IID_IMetaDataEmit, reinterpret_cast<IUnknown **>(&metadataEmit))))
+            LOG(tout << "Failed to get metadata emitter, string comparisons and paths will not be captured");
+    }
 
     bool PIBeforeInstr = true;
     bool PIAfterInstr = false;
 
+    bool blockProbes = granularity >= vsharp::GranularityBlock;
+    bool callProbes = granularity >= vsharp::GranularityEdge;
+    bool stsfldProbes = granularity >= vsharp::GranularityFull;
+
     // adding probes for coverage tracking, looking for the last instructions of basic blocks
     for (ILInstr * pInstr = pilr->GetILList()->m_pNext; pInstr != pilr->GetILList(); pInstr = pInstr->m_pNext)
     {
         unsigned opcode = pInstr->m_opcode;
+        if (captureComparisons) {
+            CollectComparisonSite(metadataImport, pInstr, comparisonSites);
+        }
         // branch coverage
         if (OpcodeIsBranch(opcode)) {
-            addPriorityProbe.push_back({ pInstr, nullptr, covProb->Branch, PIBeforeInstr });
+            // the branch is the last instruction of its block, targets only cover the blocks falling through to them
+            if (blockProbes)
+                addPriorityProbe.push_back({ pInstr, nullptr, covProb->Branch, PIBeforeInstr });
 
+            // targets are collected on every level, rets after tailcalls are rerouted through them
             // inserting all switch cases as possible target points
             if (opcode == CEE_SWITCH) {
                 ILInstr *curSwitchArg = pInstr->m_pNext;
@@ -1314,6 +2038,9 @@ HRESULT RewriteIL(
         {
             case CEE_STSFLD:
             {
+                if (!stsfldProbes) {
+                    break;
+                }
                 ILInstr* instr;
                 if (IsPrefix(pInstr->m_pPrev)) {
                     instr = pInstr->m_pPrev;
@@ -1341,7 +2068,8 @@ HRESULT RewriteIL(
 
                 addPriorityProbe.push_back({ newTailcall, nullptr, covProb->Tailcall, PIBeforeInstr });
                 // covering with usual coverage probe as tailcall already takes care of stack changes
-                addPriorityProbe.push_back({ pInstr, nullptr, covProb->Coverage, PIBeforeInstr });
+                if (blockProbes)
+                    addPriorityProbe.push_back({ pInstr, nullptr, covProb->Coverage, PIBeforeInstr });
 
                 // advancing pInstr to avoid loops
                 pInstr = newTailcall;
@@ -1352,7 +2080,7 @@ HRESULT RewriteIL(
             case CEE_CALLVIRT:
             case CEE_NEWOBJ:
             {
-                if (isTailCall) {
+                if (isTailCall || !callProbes) {
                     continue;
                 }
 
@@ -1377,13 +2105,15 @@ HRESULT RewriteIL(
             case CEE_ENDFINALLY:
             case CEE_ENDFILTER:
             {
-                addPriorityProbe.push_back({ pInstr, nullptr, covProb->Coverage, PIBeforeInstr });
+                if (blockProbes)
+                    addPriorityProbe.push_back({ pInstr, nullptr, covProb->Coverage, PIBeforeInstr });
                 break;
             }
             case CEE_THROW:
             case CEE_RETHROW:
             {
-                addPriorityProbe.push_back({ pInstr, nullptr, covProb->Throw, PIBeforeInstr });
+                if (blockProbes)
+                    addPriorityProbe.push_back({ pInstr, nullptr, covProb->Throw, PIBeforeInstr });
                 break;
             }
 
@@ -1392,7 +2122,7 @@ HRESULT RewriteIL(
         }
     }
 
-    if (pilr->m_pEH != nullptr) {
+    if (blockProbes && pilr->m_pEH != nullptr) {
         for (int i = 0; i < pilr->m_nEH; i++) {
             addPriorityProbe.push_back({ pilr->m_pEH[i].m_pHandlerBegin, nullptr, covProb->Throw, PIBeforeInstr });
         }
@@ -1400,8 +2130,12 @@ HRESULT RewriteIL(
 
     for (auto &insertion : addPriorityProbe) {
         // TODO: tailcall + ret can be broken into two basic blocks; but adding two probes is impossible
-        IfFailRet(MakeProbeInsertion(pilr, insertion, methodId));
         coveredInstructions.insert(insertion.target->m_offset);
+        if (IsCoveredByBaseline(baselineOffsets, insertion)) {
+            vsharp::countStat(vsharp::BaselineProbesSkipped);
+            continue;
+        }
+        IfFailRet(MakeProbeInsertion(pilr, insertion, methodId, sites));
     }
 
     // adding probes for branch targets now as they can point anywhere in the code
@@ -1415,7 +2149,14 @@ HRESULT RewriteIL(
 
         // targets on returns under tailcall require special treatment
         if (!IsTailcallRet(target->m_pNext)) {
-            IfFailRet(AddCoverageProbeAfter(pilr, target, insertion.probe, methodId));
+            if (!blockProbes) {
+                continue;
+            }
+            if (IsCoveredByBaseline(baselineOffsets, insertion)) {
+                vsharp::countStat(vsharp::BaselineProbesSkipped);
+                continue;
+            }
+            IfFailRet(AddCoverageProbeAfter(pilr, target, insertion.probe, methodId, sites));
             continue;
         }
         // target is a ret after a tailcall:
@@ -1443,7 +2184,9 @@ HRESULT RewriteIL(
         // remembering the original ret's offset
         ILInstr* probeStart = AddLDCInstrBefore(pilr, pNewRet, (INT32)target->m_offset);
 
-        AddLDCInstrBefore(pilr, pNewRet, methodId);
+        AddMethodIdBefore(pilr, pNewRet, methodId);
+
+        AddLDCInstrBefore(pilr, pNewRet, sites.indexOf(target->m_offset));
 
         // adding leave probe as it's a normal return without tailcall
         IfFailRet(AddProbe(pilr, leaveMethod->addr, leaveMethod->getSig(), pNewRet));
@@ -1461,6 +2204,27 @@ HRESULT RewriteIL(
         pilr->InsertAfter(branch, skipBranch);
     }
 
+    // inserted last, as coverage probes may replace the instructions the sites point to
+    unsigned pinnedString = 0;
+    bool skipStringSites = false;
+    if (std::any_of(comparisonSites.begin(), comparisonSites.end(), IsStringComparison)) {
+        static const COR_SIGNATURE pinnedStringType[] = { ELEMENT_TYPE_PINNED, ELEMENT_TYPE_STRING };
+        if (metadataEmit == nullptr || FAILED(pilr->AddLocal(metadataImport, metadataEmit, pinnedStringType, 2, &pinnedString))) {
+            LOG(tout << "Failed to add a pinned local, string comparisons of method " << methodId << " are skipped");
+            skipStringSites = true;
+        }
+    }
+    for (auto &site : comparisonSites) {
+        if (skipStringSites && IsStringComparison(site))
+            continue;
+        IfFailRet(AddComparisonProbe(pilr, site, methodId, pinnedString));
+    }
+
+    // numbered over the final control flow, so the probes above are parts of the blocks
+    if (profilePaths) {
+        IfFailRet(AddPathProfiling(pilr, metadataImport, metadataEmit, methodId));
+    }
+
     IfFailRet(AddEnterProbe(&rewriter, enterMethod->addr, enterMethod->getSig(), methodId));
 
     if (isMain) {
@@ -1468,7 +2232,12 @@ HRESULT RewriteIL(
         PrintILInstructions(pilr);
     }
 
+    if (rewritten != nullptr) {
+        rewriter.CollectRewritten(rewritten);
+    }
     IfFailRet(rewriter.Export());
 
+    blockOffsets = sites.offsets();
+
     return S_OK;
 }
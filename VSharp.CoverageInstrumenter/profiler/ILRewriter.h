@@ -6,6 +6,8 @@
 #include "corprof.h"
 #include <stdexcept>
 #include "probes.h"
+#include <map>
+#include <vector>
 
 #undef IfFailRet
 #define IfFailRet(EXPR) do { HRESULT hr = (EXPR); if(FAILED(hr)) { return (hr); } } while (0)
@@ -45,6 +47,37 @@ struct EHClause
     };
 };
 
+// Assigns dense per-method indices to probe sites; sites sharing an IL offset share an index
+class ProbeSiteIndexer {
+private:
+    std::map<unsigned, int> m_indices;
+    std::vector<OFFSET> m_offsets;
+public:
+    int indexOf(unsigned offset);
+    const std::vector<OFFSET>& offsets() const;
+};
+
+// operands of the rewritten IL which differ between processes, the cached IL is patched at them
+enum ILRelocationKind : UINT32 {
+    RelocationMethodId,
+    RelocationProbeAddress,
+    RelocationProbeSignature
+};
+
+struct ILRelocation {
+    // from the beginning of the method body, header included
+    UINT32 offset;
+    UINT32 kind;
+    // index of the probe for addresses and signatures
+    UINT32 probe;
+};
+
+// exported body of the rewritten method and its relocations, collected for the IL cache
+struct RewrittenIL {
+    std::vector<BYTE> body;
+    std::vector<ILRelocation> relocations;
+};
+
 struct ProbeInsertion {
     ILInstr* target;
     ILInstr* parent;
@@ -79,6 +112,10 @@ private:
 
     IMethodMalloc *m_pIMethodMalloc;
 
+    // operand offsets are known only after the export, so the instructions are kept
+    std::vector<std::pair<ILInstr*, ILRelocation>> m_relocations;
+    RewrittenIL *m_pRewritten;
+
     HRESULT ImportIL(LPCBYTE pIL);
     HRESULT ImportEH(const COR_ILMETHOD_SECT_EH* pILEH, unsigned nEH);
     ILInstr* GetInstrFromOffset(unsigned offset);
@@ -86,6 +123,7 @@ private:
     HRESULT SetILFunctionBody(unsigned size, LPBYTE pBody);
     LPBYTE AllocateILMemory(unsigned size);
     void DeallocateILMemory(LPBYTE pBody);
+    void CollectRelocations(LPBYTE pBody, unsigned totalSize);
 
 public:
     unsigned m_nEH;
@@ -99,12 +137,21 @@ public:
 
     HRESULT Import();
     HRESULT Export();
+    // installs the cached body, patching its relocations for this process
+    HRESULT ExportCached(const BYTE *body, UINT32 size, const std::vector<ILRelocation> &relocations, int methodId);
+    // the exported body is copied to 'rewritten' along with the relocations
+    void CollectRewritten(RewrittenIL *rewritten);
+    void AddRelocation(ILInstr *pInstr, ILRelocationKind kind, UINT32 probe);
 
     ILInstr * GetILList();
     ILInstr* NewILInstr();
     void InsertBefore(ILInstr * pWhere, ILInstr * pWhat);
     void InsertAfter(ILInstr * pWhere, ILInstr * pWhat);
     void PrintEhs();
+    // appends a local of the primitive 'type' to the locals signature, returns its index in 'index'
+    HRESULT AddLocal(IMetaDataImport* metadataImport, IMetaDataEmit* metadataEmit, CorElementType type, unsigned* index);
+    // appends a local of the type given by its signature blob
+    HRESULT AddLocal(IMetaDataImport* metadataImport, IMetaDataEmit* metadataEmit, PCCOR_SIGNATURE type, ULONG typeSize, unsigned* index);
 
     ~ILRewriter();
 };
@@ -115,7 +162,13 @@ HRESULT RewriteIL(
     ModuleID moduleID,
     mdMethodDef methodDef,
     int methodId,
-    bool isMain);
+    bool isMain,
+    bool captureComparisons,
+    bool profilePaths,
+    vsharp::InstrumentationGranularity granularity,
+    const std::set<OFFSET>* baselineOffsets,
+    std::vector<OFFSET>& blockOffsets,
+    RewrittenIL* rewritten);
 
 bool NeedFullInstrumentation(const WCHAR *moduleName, int moduleSize, mdMethodDef method);
 
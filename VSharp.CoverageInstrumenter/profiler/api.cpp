@@ -5,6 +5,10 @@
 #include "cComPtr.h"
 #include "os.h"
 #include "profilerState.h"
+#include "profilerStats.h"
+#include "sharedCoverageMap.h"
+#include "traceLog.h"
+#include "callingContextTree.h"
 #include <vector>
 
 using namespace vsharp;
@@ -13,6 +17,16 @@ extern "C" void SetEntryMain(char* assemblyName, int assemblyNameLength, char* m
     LOG(tout << "received entry main" << std::endl);
 }
 
+extern "C" int AddEntryTarget(char* assemblyName, int assemblyNameLength, char* moduleName, int moduleNameLength, int methodToken) {
+    LOG(tout << "received entry target" << std::endl);
+    return profilerState->addEntryTarget(assemblyName, assemblyNameLength, moduleName, moduleNameLength, methodToken);
+}
+
+extern "C" int RemoveEntryTarget(int targetId) {
+    LOG(tout << "entry target removal request received" << std::endl);
+    return profilerState->removeEntryTarget(targetId) ? 1 : 0;
+}
+
 extern "C" void GetHistory(UINT_PTR size, UINT_PTR bytes) {
     LOG(tout << "GetHistory request received! serializing and writing the response");
 
@@ -34,8 +48,58 @@ extern "C" void SetCurrentThreadId(int mapId) {
     vsharp::profilerState->threadTracker->mapCurrentThread(mapId);
 }
 
+extern "C" void GetProfilerStats(UINT_PTR size, UINT_PTR bytes) {
+    LOG(tout << "GetProfilerStats request received!");
+    auto buffer = std::vector<char>();
+    profilerStats.serialize(buffer);
+    auto array = new char[buffer.size()];
+    std::memcpy(array, &buffer[0], buffer.size());
+    *(ULONG*)size = buffer.size();
+    *(char**)bytes = array;
+}
+
+extern "C" void SetTraceMask(int mask) {
+    LOG(tout << "Set trace mask: " << HEX(mask));
+    traceLog.setMask(static_cast<UINT32>(mask));
+}
+
+extern "C" void GetCallingContextProfile(UINT_PTR size, UINT_PTR bytes) {
+    LOG(tout << "GetCallingContextProfile request received!");
+    auto buffer = std::vector<char>();
+    callingContextProfiler.serialize(buffer);
+    auto array = new char[buffer.size()];
+    std::memcpy(array, buffer.data(), buffer.size());
+    *(ULONG*)size = buffer.size();
+    *(char**)bytes = array;
+}
+
+extern "C" UINT64 TakeSharedMapNewEdges() {
+    return sharedCoverageMap.takeNewEdges();
+}
+
+extern "C" void BeginTest(char* testName, int testNameLength) {
+    LOG(tout << "BeginTest request received!");
+    if (!profilerState->isPersistentRun) return;
+    std::atomic_fetch_add(&shutdownBlockingRequestsCount, 1);
+    profilerState->beginTest(testName, testNameLength);
+    std::atomic_fetch_sub(&shutdownBlockingRequestsCount, 1);
+}
+
+extern "C" void EndTest() {
+    LOG(tout << "EndTest request received!");
+    if (!profilerState->isPersistentRun) return;
+    std::atomic_fetch_add(&shutdownBlockingRequestsCount, 1);
+    profilerState->endTest();
+    std::atomic_fetch_sub(&shutdownBlockingRequestsCount, 1);
+}
+
 extern "C" void SetStackBottom() {
     LOG(tout << "Bottom marker was set");
-    // TODO: Implement tracking stack size
+    // the native frame is right above the managed caller, so its locals mark the caller's stack depth
     int stackBottomMarker;
+    profilerState->threadTracker->markStackBottom(reinterpret_cast<UINT_PTR>(&stackBottomMarker));
+}
+
+extern "C" int TakeStackOverflowPrediction() {
+    return profilerState->threadTracker->takeStackOverflowPrediction();
 }
@@ -10,7 +10,17 @@
 #endif
 
 extern "C" IMAGEHANDLER_API void SetEntryMain(char* assemblyName, int assemblyNameLength, char* moduleName, int moduleNameLength, int methodToken);
+extern "C" IMAGEHANDLER_API int AddEntryTarget(char* assemblyName, int assemblyNameLength, char* moduleName, int moduleNameLength, int methodToken);
+extern "C" IMAGEHANDLER_API int RemoveEntryTarget(int targetId);
 extern "C" IMAGEHANDLER_API void GetHistory(UINT_PTR size, UINT_PTR bytes);
 extern "C" IMAGEHANDLER_API void SetCurrentThreadId(int mapId);
+extern "C" IMAGEHANDLER_API void GetProfilerStats(UINT_PTR size, UINT_PTR bytes);
+extern "C" IMAGEHANDLER_API void SetTraceMask(int mask);
+extern "C" IMAGEHANDLER_API void GetCallingContextProfile(UINT_PTR size, UINT_PTR bytes);
+extern "C" IMAGEHANDLER_API UINT64 TakeSharedMapNewEdges();
+extern "C" IMAGEHANDLER_API void BeginTest(char* testName, int testNameLength);
+extern "C" IMAGEHANDLER_API void EndTest();
+extern "C" IMAGEHANDLER_API void SetStackBottom();
+extern "C" IMAGEHANDLER_API int TakeStackOverflowPrediction();
 
 #endif //VSHARP_COVERAGEINSTRUMENTER_API_H
@@ -0,0 +1,172 @@
+#include "attachSession.h"
+#include "cComPtr.h"
+#include "eventPipeExport.h"
+#include "ilCache.h"
+#include "instrumenter.h"
+#include "logging.h"
+#include "os.h"
+#include "probes.h"
+#include "profilerState.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace vsharp;
+
+AttachSession vsharp::attachSession;
+
+static const auto requestPeriod = std::chrono::milliseconds(100);
+
+std::map<std::string, std::string> AttachSession::parseClientData(const void* clientData, UINT clientDataSize) {
+    std::map<std::string, std::string> settings;
+    if (clientData == nullptr) return settings;
+    std::string data(static_cast<const char*>(clientData), clientDataSize);
+    size_t start = 0;
+    while (start < data.size()) {
+        size_t end = data.find_first_of(std::string("\n\0", 2), start);
+        if (end == std::string::npos)
+            end = data.size();
+        auto line = data.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        auto separator = line.find('=');
+        if (separator != std::string::npos && separator > 0) {
+            settings[line.substr(0, separator)] = line.substr(separator + 1);
+        }
+        start = end + 1;
+    }
+    return settings;
+}
+
+void AttachSession::start(ICorProfilerInfo8* profilerInfo_) {
+    profilerInfo = profilerInfo_;
+    const char* duration = profilerState->setting("COVERAGE_TOOL_ATTACH_DURATION_MS");
+    if (duration != nullptr)
+        durationMilliseconds = std::stoull(duration);
+    const char* detachWait = profilerState->setting("COVERAGE_TOOL_ATTACH_DETACH_WAIT_MS");
+    if (detachWait != nullptr)
+        detachMilliseconds = static_cast<DWORD>(std::stoul(detachWait));
+    attached.store(true, std::memory_order_relaxed);
+    // the thread is not joined: it ends with the detach or with the process
+    std::thread(&AttachSession::workerLoop, this).detach();
+    LOG(tout << "Attach session started, duration: " << durationMilliseconds << " ms");
+}
+
+void AttachSession::instrumentJittedMethods() {
+    HRESULT hr;
+    CComPtr<ICorProfilerFunctionEnum> functions;
+    hr = profilerInfo->EnumJITedFunctions(&functions);
+    if (FAILED(hr)) {
+        LOG_ERROR(tout << "Failed to enumerate jitted functions: " << HEX(hr));
+        return;
+    }
+
+    size_t count = 0;
+    COR_PRF_FUNCTION function;
+    ULONG fetched;
+    while (functions->Next(1, &function, &fetched) == S_OK && fetched == 1) {
+        ClassID classId;
+        ModuleID moduleId;
+        mdToken token;
+        if (FAILED(profilerInfo->GetFunctionInfo(function.functionId, &classId, &moduleId, &token)))
+            continue;
+        bool isMain;
+        if (!Instrumenter::isInstrumentationNeeded(*profilerInfo, moduleId, token, &isMain))
+            continue;
+        if (isMain)
+            profilerState->addEntryFunction(function.functionId, moduleId);
+        methodJitted(moduleId, token);
+        count++;
+    }
+    LOG(tout << "Requesting ReJIT of " << count << " jitted functions");
+    requestPending();
+}
+
+void AttachSession::methodJitted(ModuleID moduleId, mdMethodDef token) {
+    lockCounted(mutex);
+    pending.emplace_back(moduleId, token);
+    mutex.unlock();
+}
+
+void AttachSession::requestPending() {
+    std::vector<ModuleID> modules;
+    std::vector<mdMethodDef> methods;
+    lockCounted(mutex);
+    for (auto& method : pending) {
+        // generic instantiations share the method, so it is requested once
+        if (requested.insert(method).second) {
+            modules.push_back(method.first);
+            methods.push_back(method.second);
+        }
+    }
+    pending.clear();
+    mutex.unlock();
+    if (methods.empty()) return;
+
+    HRESULT hr = profilerInfo->RequestReJIT(static_cast<ULONG>(methods.size()), modules.data(), methods.data());
+    if (FAILED(hr)) {
+        LOG_ERROR(tout << "ReJIT request of " << methods.size() << " methods failed: " << HEX(hr));
+    }
+}
+
+void AttachSession::workerLoop() {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(durationMilliseconds);
+    while (!profilerState->isFinished) {
+        std::this_thread::sleep_for(requestPeriod);
+        if (durationMilliseconds != 0 && std::chrono::steady_clock::now() >= deadline) {
+            detach();
+            return;
+        }
+        requestPending();
+    }
+}
+
+void AttachSession::detach() {
+    // new methods are not instrumented and the probes do nothing any more, once the running ones leave,
+    // the coverage is not changed and may be written
+    profilerState->isFinished = true;
+    while (std::atomic_load(&shutdownBlockingRequestsCount) > 0) {}
+    waitForProbes();
+    coverageEventPipe.finish();
+
+    std::vector<ModuleID> modules;
+    std::vector<mdMethodDef> methods;
+    lockCounted(mutex);
+    for (auto& method : requested) {
+        modules.push_back(method.first);
+        methods.push_back(method.second);
+    }
+    requested.clear();
+    pending.clear();
+    mutex.unlock();
+
+    if (!methods.empty()) {
+        std::vector<HRESULT> statuses(methods.size());
+        HRESULT hr = profilerInfo->RequestRevert(static_cast<ULONG>(methods.size()), modules.data(), methods.data(), statuses.data());
+        if (FAILED(hr)) {
+            LOG_ERROR(tout << "Revert of " << methods.size() << " methods failed: " << HEX(hr));
+        }
+    }
+
+    // invocations which are still running are reported as not finished
+    profilerState->writeResult();
+    ilCache.flush();
+    attached.store(false, std::memory_order_relaxed);
+
+    // the revert does not stop the frames which are already running the rewritten code, and they call
+    // the probes by their raw addresses, so the library must stay loaded after the runtime releases it
+    if (!OS::pinProfilerLibrary()) {
+        LOG_ERROR(tout << "Failed to pin the profiler library, it stays attached");
+        return;
+    }
+
+    HRESULT hr = profilerInfo->RequestProfilerDetach(detachMilliseconds);
+    if (hr == CORPROF_E_IRREVERSIBLE_INSTRUMENTATION_PRESENT) {
+        // runtimes which do not unload profilers after ReJIT keep it loaded, the reverted methods do not call it
+        LOG(tout << "Profiler stays loaded after ReJIT, reverted methods: " << methods.size());
+    } else if (FAILED(hr)) {
+        LOG_ERROR(tout << "Profiler detach request failed: " << HEX(hr));
+    } else {
+        LOG(tout << "Profiler detach requested, reverted methods: " << methods.size());
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_ATTACHSESSION_H
+#define VSHARP_COVERAGEINSTRUMENTER_ATTACHSESSION_H
+
+#include "cor.h"
+#include "corprof.h"
+#include "memory.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vsharp {
+
+// Coverage of a process the profiler was attached to. Methods are instrumented only with ReJIT,
+// so they can be reverted before the profiler is detached
+class AttachSession {
+private:
+    ICorProfilerInfo8* profilerInfo = nullptr;
+    std::atomic<bool> attached {false};
+    // 0 means the session lasts until the process exits
+    UINT64 durationMilliseconds = 0;
+    // time given to the runtime to leave the profiler callbacks before the profiler is released
+    DWORD detachMilliseconds = 5000;
+
+    std::mutex mutex;
+    // methods with requested ReJIT, they are reverted on detach
+    std::set<std::pair<ModuleID, mdMethodDef>> requested;
+    // methods jitted after the attach, requested by the worker in batches
+    std::vector<std::pair<ModuleID, mdMethodDef>> pending;
+
+    void requestPending();
+    void workerLoop();
+    void detach();
+public:
+    // 'clientData' holds 'NAME=VALUE' lines with the settings of the profiler; the environment is not changed,
+    // because the runtime threads of the attached process may read it concurrently
+    static std::map<std::string, std::string> parseClientData(const void* clientData, UINT clientDataSize);
+
+    bool isAttached() const {
+        return attached.load(std::memory_order_relaxed);
+    }
+
+    void start(ICorProfilerInfo8* profilerInfo);
+    // requests ReJIT of the already jitted methods that need instrumentation
+    void instrumentJittedMethods();
+    // the method was jitted without instrumentation, its ReJIT is requested by the worker
+    void methodJitted(ModuleID moduleId, mdMethodDef token);
+};
+
+extern AttachSession attachSession;
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_ATTACHSESSION_H
@@ -0,0 +1,201 @@
+#include "callingContextTree.h"
+#include "logging.h"
+#include "os.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include "serialization.h"
+
+using namespace vsharp;
+
+CallingContextProfiler vsharp::callingContextProfiler;
+
+static thread_local CallingContextTree* threadTree = nullptr;
+
+static const int rootNode = 0;
+
+static UINT64 nanosecondsNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//region CallingContextNode
+int CallingContextNode::findChild(int childMethodId) const {
+    for (auto& child : children) {
+        if (child.first == childMethodId)
+            return child.second;
+    }
+    return -1;
+}
+//endregion
+
+//region CallingContextTree
+CallingContextTree::CallingContextTree() {
+    nodes.push_back({-1, -1, 0, 0, 0, {}});
+    current = rootNode;
+}
+
+int CallingContextTree::childOf(int parent, int methodId) {
+    int child = nodes[parent].findChild(methodId);
+    if (child >= 0)
+        return child;
+    child = static_cast<int>(nodes.size());
+    // 'nodes' may be reallocated here, so only indices are kept
+    nodes.push_back({methodId, parent, 0, 0, 0, {}});
+    nodes[parent].children.emplace_back(methodId, child);
+    return child;
+}
+
+void CallingContextTree::enter(int methodId, UINT64 ticks) {
+    int node = childOf(current, methodId);
+    nodes[node].calls++;
+    frames.push_back({node, ticks});
+    current = node;
+}
+
+void CallingContextTree::leave(UINT64 ticks) {
+    if (frames.empty())
+        return;
+    auto frame = frames.back();
+    frames.pop_back();
+    auto elapsed = ticks - frame.enterTicks;
+    auto& node = nodes[frame.node];
+    node.inclusiveTicks += elapsed;
+    nodes[node.parent].childrenTicks += elapsed;
+    current = node.parent;
+}
+
+const std::vector<CallingContextNode>& CallingContextTree::getNodes() const {
+    return nodes;
+}
+
+void CallingContextTree::mergeInto(CallingContextTree& target, int targetNode, int sourceNode) const {
+    for (auto& child : nodes[sourceNode].children) {
+        auto& source = nodes[child.second];
+        int merged = target.childOf(targetNode, child.first);
+        target.nodes[merged].calls += source.calls;
+        target.nodes[merged].inclusiveTicks += source.inclusiveTicks;
+        target.nodes[merged].childrenTicks += source.childrenTicks;
+        mergeInto(target, merged, child.second);
+    }
+}
+//endregion
+
+//region CallingContextProfiler
+void CallingContextProfiler::initialize(const char* resultPath_, const char* format) {
+    resultPath = resultPath_;
+    isFolded = format != nullptr && std::strcmp(format, "folded") == 0;
+    startTicks = OS::cycleCounter();
+    startNanoseconds = nanosecondsNow();
+    enabled = true;
+    LOG(tout << "Calling-context profiling enabled, result: " << resultPath);
+}
+
+CallingContextTree* CallingContextProfiler::registerThread() {
+    auto tree = new CallingContextTree();
+    treesMutex.lock();
+    trees.push_back(tree);
+    treesMutex.unlock();
+    return tree;
+}
+
+void CallingContextProfiler::enter(int methodId) {
+    if (threadTree == nullptr)
+        threadTree = registerThread();
+    auto ticks = OS::cycleCounter();
+    threadTree->mutex.lock();
+    threadTree->enter(methodId, ticks);
+    threadTree->mutex.unlock();
+}
+
+void CallingContextProfiler::leave() {
+    if (threadTree == nullptr)
+        return;
+    auto ticks = OS::cycleCounter();
+    threadTree->mutex.lock();
+    threadTree->leave(ticks);
+    threadTree->mutex.unlock();
+}
+
+double CallingContextProfiler::nanosecondsPerTick() {
+    auto ticks = OS::cycleCounter() - startTicks;
+    auto nanoseconds = nanosecondsNow() - startNanoseconds;
+    return ticks == 0 ? 1.0 : static_cast<double>(nanoseconds) / static_cast<double>(ticks);
+}
+
+void CallingContextProfiler::merge(CallingContextTree& result) {
+    treesMutex.lock();
+    for (auto tree : trees) {
+        tree->mutex.lock();
+        tree->mergeInto(result, rootNode, rootNode);
+        tree->mutex.unlock();
+    }
+    treesMutex.unlock();
+}
+
+void CallingContextProfiler::serialize(std::vector<char>& buffer) {
+    CallingContextTree merged;
+    merge(merged);
+    auto& nodes = merged.getNodes();
+    auto scale = nanosecondsPerTick();
+
+    serializePrimitive(static_cast<int> (nodes.size() - 1), buffer);
+    // preorder, so parents always precede their children
+    std::vector<std::pair<int, int>> stack;
+    std::vector<int> newIndices(nodes.size(), -1);
+    int nextIndex = 0;
+    for (auto it = nodes[rootNode].children.rbegin(); it != nodes[rootNode].children.rend(); ++it)
+        stack.emplace_back(it->second, -1);
+    while (!stack.empty()) {
+        auto top = stack.back();
+        stack.pop_back();
+        auto& node = nodes[top.first];
+        newIndices[top.first] = nextIndex++;
+        serializePrimitive(top.second, buffer);
+        serializePrimitive(node.methodId, buffer);
+        serializePrimitive(node.calls, buffer);
+        serializePrimitive(static_cast<UINT64>(node.inclusiveTicks * scale), buffer);
+        serializePrimitive(static_cast<UINT64>((node.inclusiveTicks - node.childrenTicks) * scale), buffer);
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+            stack.emplace_back(it->second, newIndices[top.first]);
+    }
+}
+
+void CallingContextProfiler::serializeFolded(std::string& result, const std::function<std::string(int)>& methodName) {
+    CallingContextTree merged;
+    merge(merged);
+    auto& nodes = merged.getNodes();
+    auto scale = nanosecondsPerTick();
+
+    std::vector<std::pair<int, std::string>> stack;
+    for (auto& child : nodes[rootNode].children)
+        stack.emplace_back(child.second, methodName(child.first));
+    while (!stack.empty()) {
+        auto top = stack.back();
+        stack.pop_back();
+        auto& node = nodes[top.first];
+        auto exclusive = static_cast<UINT64>((node.inclusiveTicks - node.childrenTicks) * scale);
+        result += top.second + " " + std::to_string(exclusive) + "\n";
+        for (auto& child : node.children)
+            stack.emplace_back(child.second, top.second + ";" + methodName(child.first));
+    }
+}
+
+void CallingContextProfiler::writeResult(const std::function<std::string(int)>& methodName) {
+    if (!enabled) return;
+    std::ofstream fout;
+    if (isFolded) {
+        std::string folded;
+        serializeFolded(folded, methodName);
+        fout.open(resultPath, std::ios::out);
+        fout << folded;
+    } else {
+        std::vector<char> buffer;
+        serialize(buffer);
+        fout.open(resultPath, std::ios::out|std::ios::binary);
+        fout.write(buffer.data(), static_cast<long>(buffer.size()));
+    }
+    fout.close();
+    LOG(tout << "Calling-context profile written to " << resultPath);
+}
+//endregion
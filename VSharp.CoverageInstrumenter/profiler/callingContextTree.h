@@ -0,0 +1,80 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_CALLINGCONTEXTTREE_H
+#define VSHARP_COVERAGEINSTRUMENTER_CALLINGCONTEXTTREE_H
+
+#include "cor.h"
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vsharp {
+
+struct CallingContextNode {
+    int methodId;
+    int parent;
+    UINT64 calls;
+    // in cycle counter ticks
+    UINT64 inclusiveTicks;
+    UINT64 childrenTicks;
+    // (methodId, node index) pairs; nodes usually have only a few distinct callees
+    std::vector<std::pair<int, int>> children;
+
+    int findChild(int childMethodId) const;
+};
+
+struct CallingContextFrame {
+    int node;
+    UINT64 enterTicks;
+};
+
+// Calling-context tree of a single thread, only the owning thread modifies it
+class CallingContextTree {
+private:
+    std::vector<CallingContextNode> nodes;
+    std::vector<CallingContextFrame> frames;
+    int current;
+
+    int childOf(int parent, int methodId);
+public:
+    std::mutex mutex;
+
+    CallingContextTree();
+    void enter(int methodId, UINT64 ticks);
+    void leave(UINT64 ticks);
+    const std::vector<CallingContextNode>& getNodes() const;
+    void mergeInto(CallingContextTree& target, int targetNode, int sourceNode) const;
+};
+
+class CallingContextProfiler {
+private:
+    bool enabled = false;
+    bool isFolded = false;
+    std::string resultPath;
+    UINT64 startTicks = 0;
+    UINT64 startNanoseconds = 0;
+    std::mutex treesMutex;
+    std::vector<CallingContextTree*> trees;
+
+    double nanosecondsPerTick();
+    void merge(CallingContextTree& result);
+public:
+    void initialize(const char* resultPath, const char* format);
+    bool isEnabled() const { return enabled; }
+    CallingContextTree* registerThread();
+
+    void enter(int methodId);
+    void leave();
+
+    // layout: node count, then (parent, methodId, calls, inclusive ns, exclusive ns) per node in preorder
+    void serialize(std::vector<char>& buffer);
+    // one 'method;method;method exclusive_ns' line per node, ready for flame graph tools
+    void serializeFolded(std::string& result, const std::function<std::string(int)>& methodName);
+    void writeResult(const std::function<std::string(int)>& methodName);
+};
+
+extern CallingContextProfiler callingContextProfiler;
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_CALLINGCONTEXTTREE_H
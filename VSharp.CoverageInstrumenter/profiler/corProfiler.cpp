@@ -1,11 +1,17 @@
 #include "corProfiler.h"
+#include "attachSession.h"
 #include "logging.h"
 #include "memory.h"
 #include "cComPtr.h"
 #include "profiler.h"
 #include "os.h"
 #include "coverageTracker.h"
+#include "eventPipeExport.h"
+#include "ilCache.h"
 #include "profilerState.h"
+#include "probes.h"
+#include "profilerStats.h"
+#include "traceLog.h"
 #include <locale>
 #include <string>
 #include <cstring>
@@ -44,6 +50,7 @@ HRESULT STDMETHODCALLTYPE CorProfiler::Initialize(IUnknown *pICorProfilerInfoUnk
 
     DWORD eventMask =
         COR_PRF_MONITOR_JIT_COMPILATION |
+        COR_PRF_MONITOR_MODULE_LOADS |
         COR_PRF_DISABLE_ALL_NGEN_IMAGES |
         COR_PRF_DISABLE_OPTIMIZATIONS |
         COR_PRF_MONITOR_EXCEPTIONS |
@@ -59,6 +66,14 @@ HRESULT STDMETHODCALLTYPE CorProfiler::Initialize(IUnknown *pICorProfilerInfoUnk
 
     profilerState = new ProfilerState((ICorProfilerInfo8*)this);
 
+    if (std::getenv("COVERAGE_TOOL_EVENTPIPE")) {
+        ICorProfilerInfo12* eventPipeInfo;
+        if (FAILED(pICorProfilerInfoUnk->QueryInterface(__uuidof(ICorProfilerInfo12), reinterpret_cast<void **>(&eventPipeInfo)))
+            || !coverageEventPipe.initialize(eventPipeInfo)) {
+            LOG_ERROR(tout << "EventPipe export is not available, coverage is collected without it");
+        }
+    }
+
     LOG(tout << "Initialize finished" << std::endl);
     return S_OK;
 }
@@ -69,18 +84,14 @@ HRESULT STDMETHODCALLTYPE CorProfiler::Shutdown()
 
     // waiting until all current requests are resolved
     while (std::atomic_load(&shutdownBlockingRequestsCount) > 0) {}
+    waitForProbes();
+    coverageEventPipe.finish();
 
     LOG(tout << "SHUTDOWN");
-    if (profilerState->isPassiveRun) {
+    profilerState->writeResult();
+    ilCache.flush();
 
-        size_t tmpSize;
-        auto tmpBytes = profilerState->coverageTracker->serializeCoverageReport(&tmpSize);;
-
-        std::ofstream fout;
-        fout.open(profilerState->passiveResultPath, std::ios::out|std::ios::binary);
-        fout.write(tmpBytes, static_cast<long>(tmpSize));
-        fout.close();
-    }
+    traceLog.stop();
 
 #ifdef _LOGGING
     close_log();
@@ -162,7 +173,7 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ModuleLoadFinished(ModuleID moduleId, HRE
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ModuleUnloadStarted(ModuleID moduleId)
 {
-    UNUSED(moduleId);
+    Instrumenter::moduleUnloaded(moduleId);
     return S_OK;
 }
 
@@ -619,19 +630,45 @@ HRESULT STDMETHODCALLTYPE CorProfiler::HandleDestroyed(GCHandleID handleId)
 
 HRESULT STDMETHODCALLTYPE CorProfiler::InitializeForAttach(IUnknown *pCorProfilerInfoUnk, void *pvClientData, UINT cbClientData)
 {
-    UNUSED(pCorProfilerInfoUnk);
-    UNUSED(pvClientData);
-    UNUSED(cbClientData);
+    HRESULT queryInterfaceResult = pCorProfilerInfoUnk->QueryInterface(__uuidof(ICorProfilerInfo8), reinterpret_cast<void **>(&this->corProfilerInfo));
+
+    if (FAILED(queryInterfaceResult))
+    {
+        return E_FAIL;
+    }
+
+    // inlining and optimizations cannot be disabled after the startup, and the first JIT cannot be reverted
+    DWORD eventMask =
+        COR_PRF_MONITOR_JIT_COMPILATION |
+        COR_PRF_MONITOR_MODULE_LOADS |
+        COR_PRF_MONITOR_EXCEPTIONS |
+        COR_PRF_ENABLE_REJIT;
+
+    IfFailRet(this->corProfilerInfo->SetEventMask(eventMask));
+
+    // the attached process was started without the profiler environment, so the settings come with the client data
+    profilerState = new ProfilerState((ICorProfilerInfo8*)this, AttachSession::parseClientData(pvClientData, cbClientData));
+    attachSession.start(this->corProfilerInfo);
+
+    LOG(tout << "InitializeForAttach finished" << std::endl);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ProfilerAttachComplete()
 {
+    // methods jitted before the attach
+    attachSession.instrumentJittedMethods();
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ProfilerDetachSucceeded()
 {
+    LOG(tout << "DETACHED");
+    traceLog.stop();
+
+#ifdef _LOGGING
+    close_log();
+#endif
     return S_OK;
 }
 
@@ -645,10 +682,16 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ReJITCompilationStarted(FunctionID functi
 
 HRESULT STDMETHODCALLTYPE CorProfiler::GetReJITParameters(ModuleID moduleId, mdMethodDef methodId, ICorProfilerFunctionControl *pFunctionControl)
 {
-    UNUSED(moduleId);
-    UNUSED(methodId);
-    UNUSED(pFunctionControl);
-    return S_OK;
+    if (profilerState->isFinished) return S_OK;
+
+    std::atomic_fetch_add(&shutdownBlockingRequestsCount, 1);
+
+    auto instrument = new Instrumenter(*corProfilerInfo);
+    HRESULT hr = instrument->reinstrument(moduleId, methodId, pFunctionControl);
+    delete instrument;
+
+    std::atomic_fetch_sub(&shutdownBlockingRequestsCount, 1);
+    return hr;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ReJITCompilationFinished(FunctionID functionId, ReJITID rejitId, HRESULT hrStatus, BOOL fIsSafeToBlock)
@@ -662,10 +705,8 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ReJITCompilationFinished(FunctionID funct
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ReJITError(ModuleID moduleId, mdMethodDef methodId, FunctionID functionId, HRESULT hrStatus)
 {
-    UNUSED(moduleId);
-    UNUSED(methodId);
     UNUSED(functionId);
-    UNUSED(hrStatus);
+    LOG_ERROR(tout << "ReJIT of " << HEX(methodId) << " in module " << moduleId << " failed: " << HEX(hrStatus));
     return S_OK;
 }
 
@@ -0,0 +1,43 @@
+#include "coverageBaseline.h"
+#include "coverageReport.h"
+#include "logging.h"
+
+using namespace vsharp;
+
+static std::u16string toModuleKey(const WCHAR* name, ULONG length) {
+    std::u16string result(reinterpret_cast<const char16_t*>(name), length);
+    if (!result.empty() && result.back() == 0)
+        result.pop_back();
+    return result;
+}
+
+bool CoverageBaseline::load(const char* reportPath) {
+    report::Report baseline;
+    if (!report::readReportFile(reportPath, baseline)) {
+        LOG_ERROR(tout << "Failed to read coverage baseline " << reportPath);
+        return false;
+    }
+
+    size_t count = 0;
+    for (auto& thread : baseline.threads) {
+        for (auto& blocks : thread.coveredBlocks) {
+            auto method = baseline.methods.find(blocks.methodId);
+            if (method == baseline.methods.end())
+                continue;
+            auto& offsets = method->second.blockOffsets;
+            for (size_t i = 0; i < offsets.size() && i / 64 < blocks.bitset.size(); i++) {
+                if ((blocks.bitset[i / 64] >> (i % 64)) & 1) {
+                    auto& covered = coveredOffsets[{method->second.moduleName, method->second.token}];
+                    count += covered.insert(offsets[i]).second;
+                }
+            }
+        }
+    }
+    LOG(tout << "Coverage baseline loaded: " << count << " covered blocks of " << coveredOffsets.size() << " methods");
+    return true;
+}
+
+const std::set<OFFSET>* CoverageBaseline::find(const WCHAR* moduleName, ULONG moduleNameLength, mdMethodDef token) const {
+    auto found = coveredOffsets.find({toModuleKey(moduleName, moduleNameLength), token});
+    return found == coveredOffsets.end() ? nullptr : &found->second;
+}
@@ -0,0 +1,25 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_COVERAGEBASELINE_H
+#define VSHARP_COVERAGEINSTRUMENTER_COVERAGEBASELINE_H
+
+#include "memory.h"
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+namespace vsharp {
+
+// Blocks covered by an earlier run, their probes are not inserted again
+class CoverageBaseline {
+private:
+    // (module name, method token) -> IL offsets of covered probe sites
+    std::map<std::pair<std::u16string, mdMethodDef>, std::set<OFFSET>> coveredOffsets;
+public:
+    bool load(const char* reportPath);
+    // returns nullptr if the baseline has no covered blocks of the method
+    const std::set<OFFSET>* find(const WCHAR* moduleName, ULONG moduleNameLength, mdMethodDef token) const;
+};
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_COVERAGEBASELINE_H
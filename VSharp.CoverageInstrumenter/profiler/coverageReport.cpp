@@ -0,0 +1,307 @@
+#include "coverageReport.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace vsharp::report;
+
+namespace {
+
+// see 'CoverageHistory::serializeComparisons'
+const int32_t stringEqualityKind = 7;
+const int32_t stringOrderKind = 8;
+
+template <typename T> void write(const T value, std::vector<char>& buffer) {
+    auto size = buffer.size();
+    buffer.resize(size + sizeof(T));
+    std::memcpy(&buffer[size], &value, sizeof(T));
+}
+
+void writeString(const std::u16string& value, std::vector<char>& buffer) {
+    for (auto c : value)
+        write(c, buffer);
+}
+
+// names are serialized with the terminating null
+void writeName(const std::u16string& value, std::vector<char>& buffer) {
+    write(static_cast<uint32_t>(value.size() + 1), buffer);
+    writeString(value, buffer);
+    write(static_cast<char16_t>(0), buffer);
+}
+
+class Reader {
+private:
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+public:
+    bool failed = false;
+
+    Reader(const char* data_, size_t size_) : data(data_), size(size_) {}
+
+    size_t remaining() const { return size - offset; }
+    const char* current() const { return data + offset; }
+
+    void skip(size_t count) {
+        if (failed || remaining() < count)
+            failed = true;
+        else
+            offset += count;
+    }
+
+    template <typename T> T read() {
+        T result {};
+        if (failed || size - offset < sizeof(T)) {
+            failed = true;
+            return result;
+        }
+        std::memcpy(&result, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return result;
+    }
+
+    // returns false on a negative or truncated count
+    bool readCount(int32_t& count, size_t elementSize) {
+        count = read<int32_t>();
+        if (failed || count < 0 || (size - offset) / elementSize < static_cast<size_t>(count))
+            failed = true;
+        return !failed;
+    }
+
+    std::u16string readString(uint32_t length) {
+        std::u16string result;
+        if (failed || (size - offset) / sizeof(char16_t) < length) {
+            failed = true;
+            return result;
+        }
+        result.resize(length);
+        std::memcpy(&result[0], data + offset, length * sizeof(char16_t));
+        offset += length * sizeof(char16_t);
+        return result;
+    }
+
+    // names are serialized with the terminating null
+    std::u16string readName() {
+        auto result = readString(read<uint32_t>());
+        if (!result.empty() && result.back() == 0)
+            result.pop_back();
+        return result;
+    }
+};
+
+bool readMethod(Reader& reader, Method& method) {
+    method.token = reader.read<uint32_t>();
+    method.assemblyName = reader.readName();
+    method.moduleName = reader.readName();
+    int32_t count;
+    if (!reader.readCount(count, sizeof(uint32_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++)
+        method.blockOffsets.push_back(reader.read<uint32_t>());
+    if (!reader.readCount(count, sizeof(uint64_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++)
+        method.firstHits.push_back(reader.read<uint64_t>());
+    return !reader.failed;
+}
+
+bool readThread(Reader& reader, ThreadReport& thread) {
+    thread.threadId = reader.read<int32_t>();
+    thread.aborted = reader.read<int32_t>() == 1;
+    thread.overflowed = false;
+    thread.droppedRecords = 0;
+    if (thread.aborted)
+        return !reader.failed;
+
+    int32_t count;
+    if (!reader.readCount(count, 3 * sizeof(int32_t) + sizeof(uint64_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        Record record;
+        record.offset = reader.read<uint32_t>();
+        record.event = reader.read<int32_t>();
+        record.methodId = reader.read<int32_t>();
+        record.thread = reader.read<uint64_t>();
+        thread.records.push_back(record);
+    }
+
+    if (!reader.readCount(count, 2 * sizeof(int32_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        CoveredBlocks blocks;
+        blocks.methodId = reader.read<int32_t>();
+        blocks.blockCount = reader.read<int32_t>();
+        if (blocks.blockCount < 0)
+            return false;
+        for (int32_t word = 0; word < (blocks.blockCount + 63) / 64 && !reader.failed; word++)
+            blocks.bitset.push_back(reader.read<uint64_t>());
+        thread.coveredBlocks.push_back(blocks);
+    }
+
+    if (!reader.readCount(count, 3 * sizeof(int32_t) + 2 * sizeof(int64_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        Comparison comparison;
+        comparison.offset = reader.read<uint32_t>();
+        comparison.methodId = reader.read<int32_t>();
+        comparison.kind = reader.read<int32_t>();
+        comparison.left = reader.read<int64_t>();
+        comparison.right = reader.read<int64_t>();
+        if (comparison.kind == stringEqualityKind || comparison.kind == stringOrderKind) {
+            comparison.literal = reader.readString(reader.read<uint32_t>());
+            comparison.operand = reader.readString(reader.read<uint32_t>());
+        }
+        thread.comparisons.push_back(comparison);
+    }
+
+    thread.overflowed = reader.read<int32_t>() == 1;
+    thread.droppedRecords = reader.read<uint64_t>();
+    if (!reader.readCount(count, 2 * sizeof(int32_t) + sizeof(uint64_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        HitCount hitCount;
+        hitCount.methodId = reader.read<int32_t>();
+        hitCount.offset = reader.read<uint32_t>();
+        hitCount.hits = reader.read<uint64_t>();
+        thread.hitCounts.push_back(hitCount);
+    }
+
+    if (!reader.readCount(count, 2 * sizeof(int32_t) + sizeof(uint64_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        PathCount path;
+        path.methodId = reader.read<int32_t>();
+        path.pathId = reader.read<int32_t>();
+        path.hits = reader.read<uint64_t>();
+        thread.paths.push_back(path);
+    }
+    return !reader.failed;
+}
+
+}
+
+bool vsharp::report::readReport(const char* data, size_t size, Report& result) {
+    Reader reader(data, size);
+    int32_t count;
+    if (!reader.readCount(count, sizeof(int32_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        auto methodId = reader.read<int32_t>();
+        Method method;
+        if (!readMethod(reader, method))
+            return false;
+        result.methods[methodId] = method;
+    }
+
+    if (!reader.readCount(count, 2 * sizeof(int32_t)))
+        return false;
+    for (int32_t i = 0; i < count; i++) {
+        ThreadReport thread;
+        if (!readThread(reader, thread))
+            return false;
+        result.threads.push_back(thread);
+    }
+    return !reader.failed && reader.remaining() == 0;
+}
+
+bool vsharp::report::readTestReports(const char* data, size_t size, std::vector<std::pair<std::u16string, Report>>& result) {
+    Reader reader(data, size);
+    while (reader.remaining() > 0) {
+        auto name = reader.readString(reader.read<uint32_t>());
+        auto reportSize = reader.read<uint32_t>();
+        if (reader.failed || reader.remaining() < reportSize)
+            return false;
+        Report report;
+        if (!readReport(reader.current(), reportSize, report))
+            return false;
+        result.emplace_back(name, report);
+        reader.skip(reportSize);
+    }
+    return !reader.failed;
+}
+
+void vsharp::report::writeReport(const Report& report, std::vector<char>& buffer) {
+    write(static_cast<int32_t>(report.methods.size()), buffer);
+    for (auto& el : report.methods) {
+        write(el.first, buffer);
+        write(el.second.token, buffer);
+        writeName(el.second.assemblyName, buffer);
+        writeName(el.second.moduleName, buffer);
+        write(static_cast<int32_t>(el.second.blockOffsets.size()), buffer);
+        for (auto offset : el.second.blockOffsets)
+            write(offset, buffer);
+        write(static_cast<int32_t>(el.second.firstHits.size()), buffer);
+        for (auto time : el.second.firstHits)
+            write(time, buffer);
+    }
+
+    write(static_cast<int32_t>(report.threads.size()), buffer);
+    for (auto& thread : report.threads) {
+        write(thread.threadId, buffer);
+        write(static_cast<int32_t>(thread.aborted), buffer);
+        if (thread.aborted)
+            continue;
+        write(static_cast<int32_t>(thread.records.size()), buffer);
+        for (auto& record : thread.records) {
+            write(record.offset, buffer);
+            write(record.event, buffer);
+            write(record.methodId, buffer);
+            write(record.thread, buffer);
+        }
+        write(static_cast<int32_t>(thread.coveredBlocks.size()), buffer);
+        for (auto& blocks : thread.coveredBlocks) {
+            write(blocks.methodId, buffer);
+            write(blocks.blockCount, buffer);
+            for (auto word : blocks.bitset)
+                write(word, buffer);
+        }
+        write(static_cast<int32_t>(thread.comparisons.size()), buffer);
+        for (auto& comparison : thread.comparisons) {
+            write(comparison.offset, buffer);
+            write(comparison.methodId, buffer);
+            write(comparison.kind, buffer);
+            write(comparison.left, buffer);
+            write(comparison.right, buffer);
+            if (comparison.kind == stringEqualityKind || comparison.kind == stringOrderKind) {
+                write(static_cast<uint32_t>(comparison.literal.size()), buffer);
+                writeString(comparison.literal, buffer);
+                write(static_cast<uint32_t>(comparison.operand.size()), buffer);
+                writeString(comparison.operand, buffer);
+            }
+        }
+        write(static_cast<int32_t>(thread.overflowed), buffer);
+        write(thread.droppedRecords, buffer);
+        write(static_cast<int32_t>(thread.hitCounts.size()), buffer);
+        for (auto& hitCount : thread.hitCounts) {
+            write(hitCount.methodId, buffer);
+            write(hitCount.offset, buffer);
+            write(hitCount.hits, buffer);
+        }
+        write(static_cast<int32_t>(thread.paths.size()), buffer);
+        for (auto& path : thread.paths) {
+            write(path.methodId, buffer);
+            write(path.pathId, buffer);
+            write(path.hits, buffer);
+        }
+    }
+}
+
+bool vsharp::report::readReportFile(const std::string& path, Report& result) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (readReport(data.data(), data.size(), result))
+        return true;
+
+    // a persistent passive mode result; method ids are shared by all tests of the process
+    std::vector<std::pair<std::u16string, Report>> tests;
+    result = Report();
+    if (!readTestReports(data.data(), data.size(), tests))
+        return false;
+    for (auto& test : tests) {
+        result.methods.insert(test.second.methods.begin(), test.second.methods.end());
+        result.threads.insert(result.threads.end(), test.second.threads.begin(), test.second.threads.end());
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_COVERAGEREPORT_H
+#define VSHARP_COVERAGEINSTRUMENTER_COVERAGEREPORT_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reader and writer of serialized coverage reports; shared with offline tools, so it must not depend on PAL headers
+
+namespace vsharp {
+namespace report {
+
+struct Method {
+    uint32_t token;
+    std::u16string assemblyName;
+    std::u16string moduleName;
+    std::vector<uint32_t> blockOffsets;
+    // nanoseconds since the profiler start per block, 0 if not hit; empty unless first hits are tracked
+    std::vector<uint64_t> firstHits;
+};
+
+struct Record {
+    uint32_t offset;
+    int32_t event;
+    int32_t methodId;
+    uint64_t thread;
+};
+
+struct CoveredBlocks {
+    int32_t methodId;
+    int32_t blockCount;
+    std::vector<uint64_t> bitset;
+};
+
+struct Comparison {
+    uint32_t offset;
+    int32_t methodId;
+    int32_t kind;
+    int64_t left;
+    int64_t right;
+    std::u16string literal;
+    // the first chars of the runtime string operand, 'right' is its full length
+    std::u16string operand;
+};
+
+struct HitCount {
+    int32_t methodId;
+    uint32_t offset;
+    uint64_t hits;
+};
+
+struct PathCount {
+    int32_t methodId;
+    int32_t pathId;
+    uint64_t hits;
+};
+
+struct ThreadReport {
+    int32_t threadId;
+    bool aborted;
+    std::vector<Record> records;
+    std::vector<CoveredBlocks> coveredBlocks;
+    std::vector<Comparison> comparisons;
+    bool overflowed;
+    uint64_t droppedRecords;
+    std::vector<HitCount> hitCounts;
+    std::vector<PathCount> paths;
+};
+
+struct Report {
+    std::map<int32_t, Method> methods;
+    std::vector<ThreadReport> threads;
+};
+
+// returns false if the data is truncated, malformed or has trailing bytes
+bool readReport(const char* data, size_t size, Report& result);
+bool readReportFile(const std::string& path, Report& result);
+// reads the result of the persistent passive mode: (test name, report) per test
+bool readTestReports(const char* data, size_t size, std::vector<std::pair<std::u16string, Report>>& result);
+
+void writeReport(const Report& report, std::vector<char>& buffer);
+
+}
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_COVERAGEREPORT_H
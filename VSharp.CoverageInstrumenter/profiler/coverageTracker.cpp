@@ -1,7 +1,14 @@
 #include "coverageTracker.h"
+#include "eventPipeExport.h"
+#include "firstHitTable.h"
+#include "sharedCoverageMap.h"
 #include "serialization.h"
 #include "threadTracker.h"
 #include "profilerState.h"
+#include "profilerStats.h"
+#include "traceLog.h"
+#include "os.h"
+#include <sstream>
 
 using namespace vsharp;
 
@@ -12,6 +19,8 @@ void MethodInfo::serialize(std::vector<char>& buffer) const {
     serializePrimitiveArray(assemblyName, assemblyNameLength, buffer);
     serializePrimitive(moduleNameLength, buffer);
     serializePrimitiveArray(moduleName, moduleNameLength, buffer);
+    serializePrimitive(static_cast<int> (blockOffsets.size()), buffer);
+    serializePrimitiveArray(blockOffsets.data(), blockOffsets.size(), buffer);
 }
 //endregion
 
@@ -24,92 +33,328 @@ void CoverageRecord::serialize(std::vector<char>& buffer) const {
 }
 //endregion
 
+//region CoverageBudget
+const size_t CoverageBudget::maxChargeChunk;
+
+CoverageBudget::CoverageBudget(size_t invocationLimit_, size_t processLimit_, CoverageOverflowPolicy policy_)
+    : invocationLimit(invocationLimit_), processLimit(processLimit_), policy(policy_) {}
+
+bool CoverageBudget::fitsInvocation(size_t records) const {
+    return invocationLimit == 0 || records <= invocationLimit;
+}
+
+size_t CoverageBudget::charge() {
+    if (processLimit == 0) return maxChargeChunk;
+    auto charged = processCharged.load(std::memory_order_relaxed);
+    while (charged < processLimit) {
+        auto chunk = std::min(maxChargeChunk, processLimit - charged);
+        if (processCharged.compare_exchange_weak(charged, charged + chunk, std::memory_order_relaxed))
+            return chunk;
+    }
+    return 0;
+}
+
+void CoverageBudget::refund(size_t records) {
+    if (processLimit == 0) return;
+    processCharged.fetch_sub(records, std::memory_order_relaxed);
+}
+//endregion
+
 //region CoverageHistory
-CoverageHistory::CoverageHistory(OFFSET offset, int methodId) {
+CoverageHistory::CoverageHistory(OFFSET offset, int methodId, CoverageBudget* budget_, UINT64 epoch_)
+    : budget(budget_), epoch(epoch_) {
     auto insertResult = visitedMethods.insert(methodId);
     LOG(if (insertResult.second) {
         tout << "Visit method: " << methodId;
     });
-    auto record = new CoverageRecord({offset, EnterMain, profilerState->threadInfo->getCurrentThread(), methodId});
-    records.push_back(record);
+    addRecord({offset, EnterMain, profilerState->threadInfo->getCurrentThread(), methodId});
+    markBlock(methodId, 0);
+}
+
+bool CoverageHistory::reserveRecord() {
+    if (!budget->fitsInvocation(records.size() + 1))
+        return false;
+    if (records.size() < chargedRecords)
+        return true;
+    auto charged = budget->charge();
+    chargedRecords += charged;
+    return charged > 0;
+}
+
+void CoverageHistory::addRecord(const CoverageRecord& record) {
+    if (!overflowed) {
+        if (reserveRecord()) {
+            records.push_back(record);
+            return;
+        }
+        overflowed = true;
+        countStat(CoverageOverflows);
+        TRACE2(TraceReports, TraceCoverageOverflow, record.methodId, records.size());
+        LOG(tout << "Coverage budget exceeded after " << records.size() << " records");
+    }
+
+    switch (budget->policy) {
+        case OverflowHitCounts:
+            hitCounts[{record.methodId, record.offset}]++;
+            break;
+        case OverflowRing:
+            if (!records.empty()) {
+                records[ringStart] = record;
+                ringStart = (ringStart + 1) % records.size();
+            }
+            droppedRecords++;
+            break;
+        default:
+            droppedRecords++;
+            break;
+    }
+}
+
+void CoverageHistory::markBlock(int methodId, int blockIndex) {
+    auto& bits = coveredBlocks[methodId];
+    size_t word = static_cast<size_t>(blockIndex) / 64;
+    if (bits.size() <= word)
+        bits.resize(word + 1, 0);
+    bits[word] |= static_cast<UINT64>(1) << (blockIndex % 64);
+    if (firstHitTable.isEnabled())
+        firstHitTable.hit(methodId, blockIndex);
 }
 
-void CoverageHistory::addCoverage(OFFSET offset, CoverageEvent event, int methodId) {
+void CoverageHistory::addCoverage(OFFSET offset, CoverageEvent event, int methodId, int blockIndex) {
     auto insertResult = visitedMethods.insert(methodId);
     LOG(
     if (insertResult.second) {
         tout << "Visit method: " << methodId;
     }
     );
-    auto record = new CoverageRecord({offset, event, profilerState->threadInfo->getCurrentThread(), methodId});
-    records.push_back(record);
+    addRecord({offset, event, profilerState->threadInfo->getCurrentThread(), methodId});
+    markBlock(methodId, blockIndex);
+    if (sharedCoverageMap.isAttached())
+        previousSharedSite = sharedCoverageMap.hit(methodId, offset, previousSharedSite);
 }
 
 void CoverageHistory::serialize(std::vector<char>& buffer) const {
     serializePrimitive(static_cast<int> (records.size()), buffer);
     LOG(tout << "Serialize reports count: " << static_cast<int> (records.size()));
-    for (auto r: records) {
-        r->serialize(buffer);
+    // for the overflowed ring the oldest record goes first
+    for (size_t i = 0; i < records.size(); i++) {
+        records[(ringStart + i) % records.size()].serialize(buffer);
+    }
+}
+
+void CoverageHistory::serializeOverflow(std::vector<char>& buffer) const {
+    serializePrimitive(static_cast<int> (overflowed), buffer);
+    serializePrimitive(droppedRecords, buffer);
+    serializePrimitive(static_cast<int> (hitCounts.size()), buffer);
+    for (auto& el: hitCounts) {
+        serializePrimitive(el.first.first, buffer);
+        serializePrimitive(el.first.second, buffer);
+        serializePrimitive(el.second, buffer);
+    }
+}
+
+void CoverageHistory::addPath(int methodId, int pathId) {
+    pathCounts[{methodId, pathId}]++;
+}
+
+void CoverageHistory::serializePaths(std::vector<char>& buffer) const {
+    serializePrimitive(static_cast<int> (pathCounts.size()), buffer);
+    for (auto& el: pathCounts) {
+        serializePrimitive(el.first.first, buffer);
+        serializePrimitive(el.first.second, buffer);
+        serializePrimitive(el.second, buffer);
+    }
+}
+
+void CoverageHistory::releaseBudget() {
+    budget->refund(chargedRecords);
+    chargedRecords = 0;
+}
+
+size_t CoverageHistory::transferCharge() {
+    auto kept = std::min(records.size(), chargedRecords);
+    budget->refund(chargedRecords - kept);
+    chargedRecords = 0;
+    return kept;
+}
+
+void CoverageHistory::serializeCoveredBlocks(std::vector<char>& buffer, const std::vector<MethodInfo>& methods) const {
+    serializePrimitive(static_cast<int> (coveredBlocks.size()), buffer);
+    LOG(tout << "Serialize covered blocks for methods count: " << static_cast<int> (coveredBlocks.size()));
+    for (auto& el: coveredBlocks) {
+        auto blockCount = methods[el.first].blockOffsets.size();
+        // padding with zero words, so every bitset covers all blocks of the method
+        auto words = el.second;
+        words.resize((blockCount + 63) / 64, 0);
+        serializePrimitive(el.first, buffer);
+        serializePrimitive(static_cast<int> (blockCount), buffer);
+        serializePrimitiveArray(words.data(), words.size(), buffer);
+    }
+}
+
+void CoverageHistory::addComparison(const ComparisonRecord& record) {
+    if (comparisons.size() < comparisonsCapacity) {
+        comparisons.push_back(record);
+    } else {
+        comparisons[comparisonsCount % comparisonsCapacity] = record;
+    }
+    comparisonsCount++;
+}
+
+void CoverageHistory::serializeComparisons(std::vector<char>& buffer, const std::vector<std::vector<WCHAR>>& literals) const {
+    serializePrimitive(static_cast<int> (comparisons.size()), buffer);
+    // the oldest record is overwritten first, so the ring is serialized starting from it
+    size_t start = comparisonsCount > comparisonsCapacity ? comparisonsCount % comparisonsCapacity : 0;
+    for (size_t i = 0; i < comparisons.size(); i++) {
+        auto& record = comparisons[(start + i) % comparisons.size()];
+        serializePrimitive(record.offset, buffer);
+        serializePrimitive(record.methodId, buffer);
+        serializePrimitive(static_cast<int> (record.kind), buffer);
+        serializePrimitive(record.left, buffer);
+        serializePrimitive(record.right, buffer);
+        if (record.kind == CompareStringEquality || record.kind == CompareStringOrder) {
+            auto& literal = literals[record.left];
+            serializePrimitive(static_cast<int> (literal.size()), buffer);
+            serializePrimitiveArray(literal.data(), literal.size(), buffer);
+            int captured = static_cast<int> (std::min<INT64>(std::max<INT64>(record.right, 0), maxCapturedStringLength));
+            serializePrimitive(captured, buffer);
+            serializePrimitiveArray(record.operand, captured, buffer);
+        }
     }
 }
 
 CoverageHistory::~CoverageHistory() {
-    records.clear();
+    releaseBudget();
 }
 //endregion
 
 //region CoverageTracker
-CoverageTracker::CoverageTracker(ThreadTracker* threadTracker_,ThreadInfo* threadInfo, bool collectMainOnly_) {
+namespace {
+
+// frees the history of an exited thread, the thread may have left it in an invocation dropped by a clear
+struct ThreadHistoryOwner {
+    CoverageTracker* tracker = nullptr;
+
+    ~ThreadHistoryOwner() {
+        if (tracker != nullptr)
+            tracker->threadExited();
+    }
+};
+
+thread_local ThreadHistoryOwner threadHistoryOwner;
+
+}
+
+CoverageTracker::CoverageTracker(ThreadTracker* threadTracker_,ThreadInfo* threadInfo, bool collectMainOnly_, CoverageBudget* budget_) {
     threadTracker = threadTracker_;
     collectMainOnly = collectMainOnly_;
+    budget = budget_;
     trackedCoverage = new ThreadStorage<CoverageHistory*>(threadInfo);
 }
 
-void CoverageTracker::addCoverage(UINT32 offset, CoverageEvent event, int methodId) {
+void CoverageTracker::addCoverage(UINT32 offset, CoverageEvent event, int methodId, int blockIndex) {
     profiler_assert(threadTracker->isCurrentThreadTracked());
+    countStat(RecordsProduced);
+    if (coverageEventPipe.isEnabled())
+        coverageEventPipe.addRecord(offset, event, methodId, blockIndex);
     bool mainOnly = isCollectMainOnly();
-    if ((event == EnterMain && mainOnly || !mainOnly) && !trackedCoverage->exist()) {
-        trackedCoverage->store(new CoverageHistory(offset, methodId));
-    } else {
-        trackedCoverage->load()->addCoverage(offset, event, methodId);
+    auto coverage = currentHistory();
+    if ((event == EnterMain && mainOnly || !mainOnly) && coverage == nullptr) {
+        threadHistoryOwner.tracker = this;
+        trackedCoverage->storeOrUpdate(new CoverageHistory(offset, methodId, budget, clearEpoch.load(std::memory_order_acquire)));
+    } else if (coverage != nullptr) {
+        coverage->addCoverage(offset, event, methodId, blockIndex);
     }
 }
 
+void CoverageTracker::addComparison(const ComparisonRecord& record) {
+    profiler_assert(threadTracker->isCurrentThreadTracked());
+    auto coverage = currentHistory();
+    if (coverage != nullptr) {
+        coverage->addComparison(record);
+    }
+}
+
+void CoverageTracker::addPath(int methodId, int pathId) {
+    profiler_assert(threadTracker->isCurrentThreadTracked());
+    auto coverage = currentHistory();
+    if (coverage != nullptr) {
+        coverage->addPath(methodId, pathId);
+    }
+}
+
+CoverageHistory* CoverageTracker::currentHistory() {
+    if (!trackedCoverage->exist())
+        return nullptr;
+    auto coverage = trackedCoverage->load();
+    if (coverage == nullptr || coverage->epoch == clearEpoch.load(std::memory_order_acquire))
+        return coverage;
+    trackedCoverage->remove();
+    delete coverage;
+    return nullptr;
+}
+
+int CoverageTracker::addComparedLiteral(const std::vector<WCHAR>& literal) {
+    lockCounted(comparedLiteralsMutex);
+    auto inserted = comparedLiteralIds.insert({literal, static_cast<int>(comparedLiterals.size())});
+    if (inserted.second)
+        comparedLiterals.push_back(literal);
+    int id = inserted.first->second;
+    comparedLiteralsMutex.unlock();
+    return id;
+}
+
 void CoverageTracker::invocationFinished() {
+    if (coverageEventPipe.isEnabled())
+        coverageEventPipe.flush();
     auto buffer = std::vector<char>();
-    auto coverage = trackedCoverage->load();
+    auto coverage = currentHistory();
 
     int threadId = 0;
     if (threadTracker->hasMapping()) {
         threadId = threadTracker->getCurrentThreadMappedId();
     }
 
-    visitedMethodsMutex.lock();
-    visitedMethods.insert(coverage->visitedMethods.begin(), coverage->visitedMethods.end());
-    visitedMethodsMutex.unlock();
-
     serializePrimitive(threadId, buffer);
 
+    size_t charged = 0;
     if (coverage == nullptr) {
         LOG(tout << "Serialize empty coverage (aborted) for thread id: " << threadId);
         serializePrimitive(1, buffer);
     } else {
+        lockCounted(visitedMethodsMutex);
+        visitedMethods.insert(coverage->visitedMethods.begin(), coverage->visitedMethods.end());
+        visitedMethodsMutex.unlock();
+
         LOG(tout << "Serialize coverage for thread id: " << threadId);
         serializePrimitive(0, buffer);
         coverage->serialize(buffer);
+        lockCounted(collectedMethodsMutex);
+        coverage->serializeCoveredBlocks(buffer, collectedMethods);
+        collectedMethodsMutex.unlock();
+        lockCounted(comparedLiteralsMutex);
+        coverage->serializeComparisons(buffer, comparedLiterals);
+        comparedLiteralsMutex.unlock();
+        coverage->serializeOverflow(buffer);
+        coverage->serializePaths(buffer);
+        charged = coverage->transferCharge();
     }
 
-    trackedCoverage->remove();
+    if (trackedCoverage->exist())
+        trackedCoverage->remove();
+    delete coverage;
 
-    serializedCoverageMutex.lock();
+    lockCounted(serializedCoverageMutex);
     serializedCoverageThreadIds.push_back(threadId);
     serializedCoverage.push_back(buffer);
+    serializedCoverageCharged += charged;
     serializedCoverageMutex.unlock();
 }
 
 char* CoverageTracker::serializeCoverageReport(size_t* size) {
-    collectedMethodsMutex.lock();
-    serializedCoverageMutex.lock();
+    StatTimer timer(SerializeNanoseconds);
+    lockCounted(collectedMethodsMutex);
+    lockCounted(serializedCoverageMutex);
 
     auto buffer = std::vector<char>();
     auto methodsToSerialize = std::vector<std::pair<int, MethodInfo>>();
@@ -125,6 +370,13 @@ char* CoverageTracker::serializeCoverageReport(size_t* size) {
     for (auto el: methodsToSerialize) {
         serializePrimitive(el.first, buffer);
         el.second.serialize(buffer);
+        auto archived = archivedFirstHits.find(el.first);
+        if (archived != archivedFirstHits.end()) {
+            serializePrimitive(static_cast<int> (archived->second.size()), buffer);
+            serializePrimitiveArray(archived->second.data(), archived->second.size(), buffer);
+        } else {
+            firstHitTable.serialize(el.first, buffer);
+        }
     }
 
     auto threadMapping = profilerState->threadTracker->getMapping();
@@ -148,42 +400,156 @@ char* CoverageTracker::serializeCoverageReport(size_t* size) {
         serializePrimitiveArray(&serializedCoverage[i][0], serializedCoverage[i].size(), buffer);
     }
 
-    trackedCoverage->clear();
+    clear();
     serializedCoverage.clear();
+    budget->refund(serializedCoverageCharged);
+    serializedCoverageCharged = 0;
     methodsToSerialize.clear();
 
     serializedCoverageMutex.unlock();
     collectedMethodsMutex.unlock();
 
     *size = buffer.size();
+    countStat(ReportsSerialized);
+    countStat(ReportBytesProduced, *size);
+    TRACE2(TraceReports, TraceReportSerialized, *size, coverageCount);
     char* array = new char[*size];
     std::memcpy(array, &buffer[0], *size);
     return array;
 }
 
-size_t CoverageTracker::collectMethod(MethodInfo info) {
-    collectedMethodsMutex.lock();
-    size_t result = collectedMethods.size();
-    collectedMethods.push_back(info);
+size_t CoverageTracker::collectMethod(MethodInfo info, ModuleID moduleId, UINT64 layoutHash) {
+    lockCounted(collectedMethodsMutex);
+    size_t result;
+    auto unloaded = unloadedMethods.end();
+    auto names = archivedNames.find(std::vector<WCHAR>(info.moduleName, info.moduleName + info.moduleNameLength));
+    if (names != archivedNames.end())
+        unloaded = unloadedMethods.find(std::make_tuple(names->first.data(), info.token, layoutHash));
+    if (unloaded != unloadedMethods.end()) {
+        result = unloaded->second;
+        unloadedMethods.erase(unloaded);
+        // the archived method points to the shared names, so only its block offsets are kept
+        auto& method = collectedMethods[result];
+        info.blockOffsets = std::move(method.blockOffsets);
+        method = info;
+        LOG(tout << "Method " << result << " of the unloaded module is reused");
+    } else {
+        result = collectedMethods.size();
+        collectedMethods.push_back(info);
+    }
+    moduleMethods[moduleId].push_back({result, layoutHash});
+    collectedMethodsMutex.unlock();
+    return result;
+}
+
+std::vector<size_t> CoverageTracker::getModuleMethods(ModuleID moduleId) {
+    lockCounted(collectedMethodsMutex);
+    std::vector<size_t> result;
+    auto module = moduleMethods.find(moduleId);
+    if (module != moduleMethods.end()) {
+        for (auto& method : module->second)
+            result.push_back(method.first);
+    }
     collectedMethodsMutex.unlock();
     return result;
 }
 
+void CoverageTracker::unloadModule(ModuleID moduleId) {
+    lockCounted(collectedMethodsMutex);
+    auto module = moduleMethods.find(moduleId);
+    if (module == moduleMethods.end() || module->second.empty()) {
+        if (module != moduleMethods.end())
+            moduleMethods.erase(module);
+        collectedMethodsMutex.unlock();
+        return;
+    }
+    // all methods of the module have the same names
+    auto& first = collectedMethods[module->second.front().first];
+    auto names = archivedNames.insert({
+        std::vector<WCHAR>(first.moduleName, first.moduleName + first.moduleNameLength),
+        std::vector<WCHAR>(first.assemblyName, first.assemblyName + first.assemblyNameLength)}).first;
+    for (auto& el : module->second) {
+        auto methodId = el.first;
+        auto& method = collectedMethods[methodId];
+        delete[] method.moduleName;
+        delete[] method.assemblyName;
+        method.moduleName = const_cast<WCHAR*>(names->first.data());
+        method.assemblyName = names->second.data();
+        method.blockOffsets.shrink_to_fit();
+        unloadedMethods.insert({std::make_tuple(names->first.data(), method.token, el.second), methodId});
+        // the code of the module cannot run anymore, so its probes do not read the table
+        if (firstHitTable.isEnabled()) {
+            auto times = firstHitTable.release(static_cast<int>(methodId));
+            if (!times.empty())
+                archivedFirstHits[methodId] = std::move(times);
+        }
+    }
+    moduleMethods.erase(module);
+    collectedMethodsMutex.unlock();
+}
+
+void CoverageTracker::setMethodBlocks(size_t methodId, const std::vector<OFFSET>& blockOffsets) {
+    lockCounted(collectedMethodsMutex);
+    collectedMethods[methodId].blockOffsets = blockOffsets;
+    // the reused method continues with the first hits of its archived sites
+    std::vector<UINT64> firstHits;
+    auto archived = archivedFirstHits.find(methodId);
+    if (archived != archivedFirstHits.end()) {
+        firstHits = std::move(archived->second);
+        archivedFirstHits.erase(archived);
+    }
+    collectedMethodsMutex.unlock();
+    if (firstHitTable.isEnabled())
+        firstHitTable.registerMethod(static_cast<int>(methodId), blockOffsets.size(), firstHits);
+}
+
+std::string CoverageTracker::getMethodName(int methodId) {
+    lockCounted(collectedMethodsMutex);
+    auto& info = collectedMethods[methodId];
+    auto moduleName = OS::unicodeToAnsi(info.moduleName);
+    auto token = info.token;
+    collectedMethodsMutex.unlock();
+
+    auto separator = moduleName.find_last_of("/\\");
+    if (separator != std::string::npos)
+        moduleName = moduleName.substr(separator + 1);
+    std::stringstream name;
+    name << moduleName << "!" << HEX(token);
+    return name.str();
+}
+
 bool CoverageTracker::isCollectMainOnly() const {
     return collectMainOnly;
 }
 
 void CoverageTracker::clear()  {
-    trackedCoverage->clear();
+    // probes may still be running on the histories, their budget is released when their threads free them
+    clearEpoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void CoverageTracker::threadExited() {
+    if (!trackedCoverage->exist())
+        return;
+    auto coverage = trackedCoverage->load();
+    trackedCoverage->remove();
+    delete coverage;
 }
 
 CoverageTracker::~CoverageTracker(){
-    clear();
+    // no thread runs probes anymore
+    for (auto& el: trackedCoverage->items()) {
+        delete el.second;
+    }
+    trackedCoverage->clear();
 }
 
 void CoverageTracker::invocationAborted() {
-    trackedCoverage->update([](CoverageHistory *cov) {
-        return (CoverageHistory*) nullptr;
-    });
+    if (coverageEventPipe.isEnabled())
+        coverageEventPipe.flush();
+    auto coverage = currentHistory();
+    if (coverage != nullptr) {
+        trackedCoverage->storeOrUpdate(nullptr);
+        delete coverage;
+    }
 }
 //endregion
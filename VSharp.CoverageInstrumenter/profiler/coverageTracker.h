@@ -6,7 +6,9 @@
 #include "threadTracker.h"
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <tuple>
 
 namespace vsharp {
 
@@ -19,7 +21,36 @@ enum CoverageEvent {
     Call,
     Tailcall,
     TrackCoverage,
-    StsfldHit
+    StsfldHit,
+    // the stack of the invocation is close to its limit, recorded once per invocation
+    StackOverflowPredicted
+};
+
+enum ComparisonKind {
+    CompareEqual,
+    CompareNotEqual,
+    CompareLess,
+    CompareLessOrEqual,
+    CompareGreater,
+    CompareGreaterOrEqual,
+    CompareSwitch,
+    CompareStringEquality,
+    CompareStringOrder
+};
+
+// runtime string operands are cut to this number of chars
+static const int maxCapturedStringLength = 64;
+
+struct ComparisonRecord {
+    OFFSET offset;
+    int methodId;
+    ComparisonKind kind;
+    // for string comparisons 'left' is the id of the compared literal
+    INT64 left;
+    // for string comparisons 'right' is the length of the runtime operand, -1 if it is null
+    INT64 right;
+    // the first chars of the runtime string operand
+    WCHAR operand[maxCapturedStringLength];
 };
 
 struct MethodInfo {
@@ -28,6 +59,8 @@ struct MethodInfo {
     WCHAR *assemblyName;
     ULONG moduleNameLength;
     WCHAR *moduleName;
+    // IL offsets of the method's probe sites, indexed by dense block index
+    std::vector<OFFSET> blockOffsets;
 
     void serialize(std::vector<char>& buffer) const;
 };
@@ -41,13 +74,82 @@ struct CoverageRecord {
     void serialize(std::vector<char>& buffer) const;
 };
 
+enum CoverageOverflowPolicy {
+    // records are dropped, covered blocks are still marked
+    OverflowStopRecording,
+    // records are replaced with per-site hit counts
+    OverflowHitCounts,
+    // the last records are kept, older ones are overwritten
+    OverflowRing
+};
+
+// Bounds the number of coverage records kept per invocation and by all live invocations of the process
+class CoverageBudget {
+private:
+    // in records, 0 means unlimited
+    size_t invocationLimit;
+    size_t processLimit;
+    std::atomic<size_t> processCharged {0};
+public:
+    // the process budget is charged by chunks to avoid contention on every record; a thread holds at most
+    // one chunk of charged but unused records, near the limit only the remaining records are charged
+    static const size_t maxChargeChunk = 1024;
+    const CoverageOverflowPolicy policy;
+
+    CoverageBudget(size_t invocationLimit, size_t processLimit, CoverageOverflowPolicy policy);
+    bool fitsInvocation(size_t records) const;
+    // returns the number of charged records, 0 if the process budget is exhausted
+    size_t charge();
+    void refund(size_t records);
+};
+
+struct CoverageHitCount {
+    int methodId;
+    OFFSET offset;
+    UINT64 hits;
+};
+
 class CoverageHistory {
 private:
-    std::vector<CoverageRecord*> records{};
+    CoverageBudget* budget;
+    std::vector<CoverageRecord> records{};
+    size_t chargedRecords = 0;
+    bool overflowed = false;
+    UINT64 droppedRecords = 0;
+    // index of the oldest record once the ring is full
+    size_t ringStart = 0;
+    // (methodId, offset) -> hits after overflow
+    std::map<std::pair<int, OFFSET>, UINT64> hitCounts;
+    // methodId -> bitset of covered block indices
+    std::map<int, std::vector<UINT64>> coveredBlocks;
+    // ring of the last compared operands
+    static const size_t comparisonsCapacity = 256;
+    std::vector<ComparisonRecord> comparisons;
+    size_t comparisonsCount = 0;
+    // (methodId, Ball-Larus path id) -> hits
+    std::map<std::pair<int, int>, UINT64> pathCounts;
+    // last site of the thread in the shared coverage map
+    UINT64 previousSharedSite = 0;
+
+    void markBlock(int methodId, int blockIndex);
+    bool reserveRecord();
+    void addRecord(const CoverageRecord& record);
 public:
-    explicit CoverageHistory(OFFSET offset, int methodId);
-    void addCoverage(OFFSET offset, CoverageEvent event, int methodId);
+    // the number of tracker clears before the history was started, a cleared history is freed by its thread
+    const UINT64 epoch;
+
+    explicit CoverageHistory(OFFSET offset, int methodId, CoverageBudget* budget, UINT64 epoch);
+    void addCoverage(OFFSET offset, CoverageEvent event, int methodId, int blockIndex);
     void serialize(std::vector<char>& buffer) const;
+    void serializeCoveredBlocks(std::vector<char>& buffer, const std::vector<MethodInfo>& methods) const;
+    void addComparison(const ComparisonRecord& record);
+    void serializeComparisons(std::vector<char>& buffer, const std::vector<std::vector<WCHAR>>& literals) const;
+    void serializeOverflow(std::vector<char>& buffer) const;
+    void addPath(int methodId, int pathId);
+    void serializePaths(std::vector<char>& buffer) const;
+    void releaseBudget();
+    // the records stay charged while their serialized copy is kept; returns their number, the rest is refunded
+    size_t transferCharge();
     ~CoverageHistory();
 
     std::set<int> visitedMethods;
@@ -57,24 +159,59 @@ class CoverageTracker {
 
 private:
     bool collectMainOnly;
+    CoverageBudget* budget;
     std::mutex collectedMethodsMutex;
     std::vector<MethodInfo> collectedMethods;
+    // methods of the loaded modules with the hashes of their layouts
+    std::map<ModuleID, std::vector<std::pair<size_t, UINT64>>> moduleMethods;
+    // module name -> assembly name, shared by the archived methods of the module instead of their own copies
+    std::map<std::vector<WCHAR>, std::vector<WCHAR>> archivedNames;
+    // (shared module name, token, layout hash) -> archived methods, reused when the module is loaded again
+    std::multimap<std::tuple<const WCHAR*, mdMethodDef, UINT64>, size_t> unloadedMethods;
+    // first hit times of the archived methods with hit sites, their tables are freed
+    std::map<size_t, std::vector<UINT64>> archivedFirstHits;
     std::mutex visitedMethodsMutex;
     std::set<int> visitedMethods;
     ThreadStorage<CoverageHistory*>* trackedCoverage;
+    // histories started before the last clear are dropped; probes use them outside the storage lock,
+    // so only their own threads free them
+    std::atomic<UINT64> clearEpoch {0};
     ThreadTracker* threadTracker;
     std::mutex serializedCoverageMutex;
     std::vector<std::vector<char>> serializedCoverage;
     std::vector<int> serializedCoverageThreadIds;
+    // records of 'serializedCoverage' charged to the budget
+    size_t serializedCoverageCharged = 0;
+    std::mutex comparedLiteralsMutex;
+    std::vector<std::vector<WCHAR>> comparedLiterals;
+    // literal -> its id in 'comparedLiterals'
+    std::map<std::vector<WCHAR>, int> comparedLiteralIds;
+
+    // returns the history of the current thread or nullptr, frees the history dropped by a clear
+    CoverageHistory* currentHistory();
 public:
-    explicit CoverageTracker(ThreadTracker* threadTracker, ThreadInfo* threadInfo, bool collectMainOnly);
+    explicit CoverageTracker(ThreadTracker* threadTracker, ThreadInfo* threadInfo, bool collectMainOnly, CoverageBudget* budget);
     bool isCollectMainOnly() const;
-    void addCoverage(OFFSET offset, CoverageEvent event, int methodId);
+    void addCoverage(OFFSET offset, CoverageEvent event, int methodId, int blockIndex);
+    void addComparison(const ComparisonRecord& record);
+    // equal literals get the same id
+    int addComparedLiteral(const std::vector<WCHAR>& literal);
+    void addPath(int methodId, int pathId);
     void invocationAborted();
     void invocationFinished();
-    size_t collectMethod(MethodInfo info);
+    // takes ownership of the names; the archived method with the same module name, token and layout is reused
+    size_t collectMethod(MethodInfo info, ModuleID moduleId, UINT64 layoutHash);
+    std::vector<size_t> getModuleMethods(ModuleID moduleId);
+    // archives the methods of the module: their names are shared, their first hit tables are folded into
+    // the archive; the methods stay collected, so their coverage is still reported
+    void unloadModule(ModuleID moduleId);
+    void setMethodBlocks(size_t methodId, const std::vector<OFFSET>& blockOffsets);
+    std::string getMethodName(int methodId);
     char* serializeCoverageReport(size_t* size);
+    // drops the histories of unfinished invocations, their threads free them on the next probe or on exit
     void clear();
+    // frees the history of the exiting thread
+    void threadExited();
     ~CoverageTracker();
 };
 
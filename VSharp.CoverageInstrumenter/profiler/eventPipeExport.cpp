@@ -0,0 +1,157 @@
+#include "eventPipeExport.h"
+#include "logging.h"
+#include "profilerStats.h"
+#include <set>
+#include <thread>
+
+using namespace vsharp;
+
+CoverageEventPipe vsharp::coverageEventPipe;
+
+const size_t CoverageEventBatch::capacity;
+
+static std::mutex batchesMutex;
+static std::set<CoverageEventBatch*> batches;
+
+namespace vsharp {
+
+// the batch of the thread is registered for 'flushAll' and written and freed when the thread exits
+struct ThreadCoverageEventBatch {
+    CoverageEventBatch *batch = nullptr;
+
+    CoverageEventBatch &get() {
+        if (batch == nullptr) {
+            batch = new CoverageEventBatch();
+            batch->thread = std::hash<std::thread::id>{}(std::this_thread::get_id());
+            std::lock_guard<std::mutex> lock(batchesMutex);
+            batches.insert(batch);
+        }
+        return *batch;
+    }
+
+    ~ThreadCoverageEventBatch() {
+        if (batch == nullptr)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(batchesMutex);
+            batches.erase(batch);
+        }
+        if (coverageEventPipe.isEnabled())
+            coverageEventPipe.writeBatch(*batch);
+        delete batch;
+    }
+};
+
+}
+
+static thread_local ThreadCoverageEventBatch threadBatch;
+
+#ifdef WIN
+#define WIDE(str) L##str
+#else
+#define WIDE(str) u##str
+#endif
+
+static const WCHAR providerName[] = WIDE("VSharp-Coverage");
+static const WCHAR coverageBatchName[] = WIDE("CoverageBatch");
+static const WCHAR methodLoadName[] = WIDE("MethodLoad");
+static const WCHAR threadParam[] = WIDE("Thread");
+static const WCHAR recordsParam[] = WIDE("Records");
+static const WCHAR methodIdParam[] = WIDE("MethodId");
+static const WCHAR tokenParam[] = WIDE("Token");
+static const WCHAR assemblyNameParam[] = WIDE("AssemblyName");
+static const WCHAR moduleNameParam[] = WIDE("ModuleName");
+
+static const UINT32 informationalLevel = 4;
+
+static size_t wideLength(const WCHAR* str) {
+    size_t length = 0;
+    while (str[length] != 0) length++;
+    return length;
+}
+
+bool CoverageEventPipe::initialize(ICorProfilerInfo12* profilerInfo_) {
+    profilerInfo = profilerInfo_;
+    if (FAILED(profilerInfo->EventPipeCreateProvider(providerName, &provider))) {
+        LOG_ERROR(tout << "Failed to create EventPipe provider");
+        return false;
+    }
+
+    // 'Records' is an array of packed CoverageEventRecord: u16 byte count, then bytes
+    COR_PRF_EVENTPIPE_PARAM_DESC batchParams[] = {
+        { COR_PRF_EVENTPIPE_UINT64, 0, threadParam },
+        { COR_PRF_EVENTPIPE_ARRAY, COR_PRF_EVENTPIPE_BYTE, recordsParam }
+    };
+    COR_PRF_EVENTPIPE_PARAM_DESC methodParams[] = {
+        { COR_PRF_EVENTPIPE_INT32, 0, methodIdParam },
+        { COR_PRF_EVENTPIPE_UINT32, 0, tokenParam },
+        { COR_PRF_EVENTPIPE_STRING, 0, assemblyNameParam },
+        { COR_PRF_EVENTPIPE_STRING, 0, moduleNameParam }
+    };
+    HRESULT hr = profilerInfo->EventPipeDefineEvent(
+        provider, coverageBatchName, 1, CoverageEventsKeyword, 1, informationalLevel, 0, FALSE,
+        2, batchParams, &coverageBatchEvent);
+    if (SUCCEEDED(hr)) {
+        hr = profilerInfo->EventPipeDefineEvent(
+            provider, methodLoadName, 2, MethodEventsKeyword, 1, informationalLevel, 0, FALSE,
+            4, methodParams, &methodLoadEvent);
+    }
+    if (FAILED(hr)) {
+        LOG_ERROR(tout << "Failed to define EventPipe events: " << HEX(hr));
+        return false;
+    }
+
+    enabled.store(true, std::memory_order_relaxed);
+    LOG(tout << "EventPipe export of coverage events enabled");
+    return true;
+}
+
+void CoverageEventPipe::writeBatch(CoverageEventBatch& batch) {
+    if (batch.count == 0) return;
+    UINT16 recordsSize = static_cast<UINT16>(batch.count * sizeof(CoverageEventRecord));
+    COR_PRF_EVENT_DATA data[3];
+    data[0] = { (UINT64) &batch.thread, sizeof(UINT64), 0 };
+    data[1] = { (UINT64) &recordsSize, sizeof(UINT16), 0 };
+    data[2] = { (UINT64) batch.records, recordsSize, 0 };
+    profilerInfo->EventPipeWriteEvent(coverageBatchEvent, 3, data, nullptr, nullptr);
+    countStat(EventPipeBatchesWritten);
+    batch.count = 0;
+}
+
+void CoverageEventPipe::addRecord(OFFSET offset, int event, int methodId, int blockIndex) {
+    CoverageEventBatch &batch = threadBatch.get();
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    batch.records[batch.count++] = { methodId, offset, event, blockIndex };
+    if (batch.count == CoverageEventBatch::capacity)
+        writeBatch(batch);
+}
+
+void CoverageEventPipe::flush() {
+    if (threadBatch.batch == nullptr) return;
+    std::lock_guard<std::mutex> lock(threadBatch.batch->mutex);
+    writeBatch(*threadBatch.batch);
+}
+
+void CoverageEventPipe::flushAll() {
+    std::lock_guard<std::mutex> lock(batchesMutex);
+    for (CoverageEventBatch *batch : batches) {
+        std::lock_guard<std::mutex> batchLock(batch->mutex);
+        writeBatch(*batch);
+    }
+}
+
+void CoverageEventPipe::finish() {
+    if (!isEnabled()) return;
+    flushAll();
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+void CoverageEventPipe::methodLoaded(int methodId, mdMethodDef token, const WCHAR* assemblyName, const WCHAR* moduleName) {
+    UINT32 tokenValue = token;
+    COR_PRF_EVENT_DATA data[4];
+    data[0] = { (UINT64) &methodId, sizeof(INT32), 0 };
+    data[1] = { (UINT64) &tokenValue, sizeof(UINT32), 0 };
+    data[2] = { (UINT64) assemblyName, static_cast<UINT32>((wideLength(assemblyName) + 1) * sizeof(WCHAR)), 0 };
+    data[3] = { (UINT64) moduleName, static_cast<UINT32>((wideLength(moduleName) + 1) * sizeof(WCHAR)), 0 };
+    profilerInfo->EventPipeWriteEvent(methodLoadEvent, 4, data, nullptr, nullptr);
+}
@@ -0,0 +1,68 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_EVENTPIPEEXPORT_H
+#define VSHARP_COVERAGEINSTRUMENTER_EVENTPIPEEXPORT_H
+
+#include "cor.h"
+#include "corprof.h"
+#include "memory.h"
+#include <atomic>
+#include <mutex>
+
+namespace vsharp {
+
+// Keywords of the 'VSharp-Coverage' provider
+enum CoverageEventKeywords : UINT64 {
+    CoverageEventsKeyword = 0x1,
+    MethodEventsKeyword = 0x2
+};
+
+struct CoverageEventRecord {
+    INT32 methodId;
+    OFFSET offset;
+    INT32 event;
+    INT32 blockIndex;
+};
+
+// Records of one thread, written as a single event when full, when the invocation ends, or by 'flushAll'
+struct CoverageEventBatch {
+    static const size_t capacity = 256;
+    CoverageEventRecord records[capacity];
+    size_t count = 0;
+    UINT64 thread = 0;
+    // taken by the thread adding records and by 'flushAll'
+    std::mutex mutex;
+};
+
+class CoverageEventPipe {
+private:
+    ICorProfilerInfo12* profilerInfo = nullptr;
+    EVENTPIPE_PROVIDER provider = 0;
+    EVENTPIPE_EVENT coverageBatchEvent = 0;
+    EVENTPIPE_EVENT methodLoadEvent = 0;
+    std::atomic<bool> enabled {false};
+
+    void writeBatch(CoverageEventBatch& batch);
+    friend struct ThreadCoverageEventBatch;
+public:
+    // takes the reference of 'profilerInfo', returns false if the runtime has no EventPipe support
+    bool initialize(ICorProfilerInfo12* profilerInfo);
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void addRecord(OFFSET offset, int event, int methodId, int blockIndex);
+    // writes the pending records of the current thread
+    void flush();
+    // writes the pending records of all threads, e.g. at the end of a test
+    void flushAll();
+    // writes the pending records of all threads, the records added later are dropped
+    void finish();
+    // names are null terminated, consumers use the event to resolve method ids of batches
+    void methodLoaded(int methodId, mdMethodDef token, const WCHAR* assemblyName, const WCHAR* moduleName);
+};
+
+extern CoverageEventPipe coverageEventPipe;
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_EVENTPIPEEXPORT_H
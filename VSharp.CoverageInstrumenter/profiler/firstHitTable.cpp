@@ -0,0 +1,95 @@
+#include "firstHitTable.h"
+#include "logging.h"
+#include "serialization.h"
+#include <algorithm>
+
+using namespace vsharp;
+
+FirstHitTable vsharp::firstHitTable;
+
+const size_t FirstHitTable::methodsChunkSize;
+const size_t FirstHitTable::maxMethodsChunks;
+
+void FirstHitTable::enable() {
+    start = std::chrono::steady_clock::now();
+    enabled = true;
+    LOG(tout << "First hit times are tracked");
+}
+
+std::atomic<FirstHitTable::MethodFirstHits*>& FirstHitTable::slot(size_t chunk, int methodId) {
+    auto slots = methods[chunk].load(std::memory_order_acquire);
+    if (slots == nullptr) {
+        // methods are rewritten concurrently, so the chunk may be allocated by another thread
+        auto allocated = new std::atomic<MethodFirstHits*>[methodsChunkSize]();
+        if (methods[chunk].compare_exchange_strong(slots, allocated, std::memory_order_acq_rel)) {
+            slots = allocated;
+        } else {
+            delete[] allocated;
+        }
+    }
+    return slots[methodId % methodsChunkSize];
+}
+
+void FirstHitTable::registerMethod(int methodId, size_t blockCount, const std::vector<UINT64>& firstHits) {
+    size_t chunk = static_cast<size_t>(methodId) / methodsChunkSize;
+    if (chunk >= maxMethodsChunks) return;
+    auto& method = slot(chunk, methodId);
+    // a reused method id keeps its table while the number of sites is the same
+    auto current = method.load(std::memory_order_acquire);
+    if (current != nullptr && current->blockCount == blockCount) return;
+    auto times = new std::atomic<UINT64>[blockCount]();
+    if (firstHits.size() == blockCount) {
+        for (size_t i = 0; i < blockCount; i++)
+            times[i].store(firstHits[i], std::memory_order_relaxed);
+    }
+    // probes of the previous code may still read the replaced table, so it is not freed
+    method.store(new MethodFirstHits{blockCount, times}, std::memory_order_release);
+}
+
+std::vector<UINT64> FirstHitTable::release(int methodId) {
+    std::vector<UINT64> result;
+    size_t chunk = static_cast<size_t>(methodId) / methodsChunkSize;
+    auto slots = chunk < maxMethodsChunks ? methods[chunk].load(std::memory_order_acquire) : nullptr;
+    if (slots == nullptr) return result;
+    auto method = slots[methodId % methodsChunkSize].exchange(nullptr, std::memory_order_acq_rel);
+    if (method == nullptr) return result;
+    bool isHit = false;
+    for (size_t i = 0; i < method->blockCount && !isHit; i++)
+        isHit = method->times[i].load(std::memory_order_relaxed) != 0;
+    if (isHit) {
+        for (size_t i = 0; i < method->blockCount; i++)
+            result.push_back(method->times[i].load(std::memory_order_relaxed));
+    }
+    delete[] method->times;
+    delete method;
+    return result;
+}
+
+void FirstHitTable::hit(int methodId, int blockIndex) {
+    size_t chunk = static_cast<size_t>(methodId) / methodsChunkSize;
+    auto slots = chunk < maxMethodsChunks ? methods[chunk].load(std::memory_order_acquire) : nullptr;
+    if (slots == nullptr) return;
+    auto method = slots[methodId % methodsChunkSize].load(std::memory_order_acquire);
+    if (method == nullptr || static_cast<size_t>(blockIndex) >= method->blockCount) return;
+
+    auto& time = method->times[blockIndex];
+    // the plain load keeps the cache line shared once the site was hit
+    if (time.load(std::memory_order_relaxed) != 0) return;
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    UINT64 expected = 0;
+    time.compare_exchange_strong(expected, std::max<UINT64>(1, static_cast<UINT64>(elapsed)), std::memory_order_relaxed);
+}
+
+void FirstHitTable::serialize(int methodId, std::vector<char>& buffer) {
+    size_t chunk = static_cast<size_t>(methodId) / methodsChunkSize;
+    auto slots = chunk < maxMethodsChunks ? methods[chunk].load(std::memory_order_acquire) : nullptr;
+    auto method = slots == nullptr ? nullptr : slots[methodId % methodsChunkSize].load(std::memory_order_acquire);
+    if (method == nullptr) {
+        serializePrimitive(0, buffer);
+        return;
+    }
+    serializePrimitive(static_cast<int> (method->blockCount), buffer);
+    for (size_t i = 0; i < method->blockCount; i++) {
+        serializePrimitive(method->times[i].load(std::memory_order_relaxed), buffer);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_FIRSTHITTABLE_H
+#define VSHARP_COVERAGEINSTRUMENTER_FIRSTHITTABLE_H
+
+#include "cor.h"
+#include "memory.h"
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace vsharp {
+
+// Time of the first hit of every probe site, indexed like the method's block offsets.
+// Times are nanoseconds since the table was enabled, 0 means the site was not hit yet
+class FirstHitTable {
+private:
+    static const size_t methodsChunkSize = 1024;
+    static const size_t maxMethodsChunks = 4096;
+
+    struct MethodFirstHits {
+        size_t blockCount;
+        std::atomic<UINT64>* times;
+    };
+
+    bool enabled = false;
+    std::chrono::steady_clock::time_point start;
+    // methodId -> first hits of the method; chunks are never freed and a method is freed only once the code of its
+    // module is unloaded, so probes read them without locks
+    std::atomic<std::atomic<MethodFirstHits*>*> methods[maxMethodsChunks] {};
+
+    std::atomic<MethodFirstHits*>& slot(size_t chunk, int methodId);
+public:
+    void enable();
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    // called once the probe sites of the method are known, before its code runs; the table of a reused id
+    // is reallocated if the number of sites changed, a new table starts with 'firstHits' of the same sites
+    void registerMethod(int methodId, size_t blockCount, const std::vector<UINT64>& firstHits);
+    // frees the table of the unloaded method, returns its times or nothing if no site was hit
+    std::vector<UINT64> release(int methodId);
+    void hit(int methodId, int blockIndex);
+    // writes the number of sites and their times, no sites if the method was not registered
+    void serialize(int methodId, std::vector<char>& buffer);
+};
+
+extern FirstHitTable firstHitTable;
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_FIRSTHITTABLE_H
@@ -0,0 +1,221 @@
+#include "ilCache.h"
+#include "logging.h"
+#include "os.h"
+#include "profilerStats.h"
+#include "serialization.h"
+#include <cstring>
+
+using namespace vsharp;
+
+ILCache vsharp::ilCache;
+
+static const UINT32 recordMagic = 0x4C495356; // "VSIL"
+// bumped whenever the record layout or the rewriting changes
+static const UINT32 recordVersion = 3;
+
+static const UINT64 fnvOffset = 14695981039346656037ULL;
+static const UINT64 fnvPrime = 1099511628211ULL;
+
+static UINT64 fnv(const void* data, size_t size, UINT64 hash = fnvOffset) {
+    auto bytes = static_cast<const BYTE*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * fnvPrime;
+    }
+    return hash;
+}
+
+//region Record layout
+struct RecordHeader {
+    UINT32 magic;
+    UINT32 version;
+    // of the whole record, header included
+    UINT32 size;
+    UINT32 bodySize;
+    UINT32 relocationCount;
+    UINT32 siteCount;
+    // of everything after the header
+    UINT64 checksum;
+    ILCacheKey key;
+};
+
+template <typename T> static T readAt(const char* at) {
+    T value;
+    std::memcpy(&value, at, sizeof(T));
+    return value;
+}
+
+static size_t recordSize(size_t bodySize, size_t relocationCount, size_t siteCount) {
+    return sizeof(RecordHeader) + bodySize + relocationCount * sizeof(ILRelocation) + siteCount * sizeof(OFFSET);
+}
+
+static bool relocationFits(const ILRelocation& relocation, UINT32 bodySize) {
+    size_t operandSize = relocation.kind == RelocationProbeAddress ? sizeof(size_t) : sizeof(INT32);
+    return relocation.kind <= RelocationProbeSignature
+        && static_cast<size_t>(relocation.offset) + operandSize <= bodySize
+        && (relocation.kind == RelocationMethodId || probeAt(static_cast<int>(relocation.probe)) != nullptr);
+}
+//endregion
+
+bool ILCacheKey::operator<(const ILCacheKey& other) const {
+    int mvidOrder = std::memcmp(&mvid, &other.mvid, sizeof(GUID));
+    if (mvidOrder != 0) return mvidOrder < 0;
+    if (token != other.token) return token < other.token;
+    if (ilHash != other.ilHash) return ilHash < other.ilHash;
+    return settingsHash < other.settingsHash;
+}
+
+void ILCache::open(const char* path_) {
+    path = path_;
+    enabled = true;
+    size_t size = 0;
+    mapped = static_cast<const char*>(OS::mapFileForReading(path_, &size));
+    if (mapped == nullptr) {
+        LOG(tout << "IL cache " << path << " is empty, rewritten methods are added at shutdown");
+        return;
+    }
+    mappedSize = size;
+    indexRecords(mapped, mapped + mappedSize);
+    LOG(tout << "IL cache " << path << " mapped, methods: " << records.size());
+}
+
+void ILCache::indexRecords(const char* begin, const char* end) {
+    const char* at = begin;
+    while (static_cast<size_t>(end - at) >= sizeof(RecordHeader)) {
+        auto header = readAt<RecordHeader>(at);
+        if (header.magic != recordMagic || header.size < sizeof(RecordHeader) || header.size > static_cast<size_t>(end - at)) {
+            // a torn append of a crashed process, the records after it cannot be found
+            LOG_ERROR(tout << "IL cache " << path << " is damaged at " << (at - begin) << ", the rest is ignored");
+            return;
+        }
+        const char* payload = at + sizeof(RecordHeader);
+        size_t payloadSize = header.size - sizeof(RecordHeader);
+        bool isValid = header.version == recordVersion
+            && header.size == recordSize(header.bodySize, header.relocationCount, header.siteCount)
+            && fnv(payload, payloadSize) == header.checksum;
+        if (isValid) {
+            auto relocations = payload + header.bodySize;
+            for (UINT32 i = 0; i < header.relocationCount && isValid; i++) {
+                isValid = relocationFits(readAt<ILRelocation>(relocations + i * sizeof(ILRelocation)), header.bodySize);
+            }
+        }
+        // records of other versions are skipped, runs of both versions may share the file
+        if (isValid) {
+            records.insert({header.key, at});
+        }
+        at += header.size;
+    }
+}
+
+UINT64 ILCache::settingsHash(InstrumentationGranularity granularity, bool isMain, const std::set<OFFSET>* baselineOffsets) {
+    UINT64 hash = fnvOffset;
+    UINT32 pointerSize = sizeof(size_t);
+    hash = fnv(&recordVersion, sizeof(recordVersion), hash);
+    hash = fnv(&pointerSize, sizeof(pointerSize), hash);
+    hash = fnv(&granularity, sizeof(granularity), hash);
+    hash = fnv(&isMain, sizeof(isMain), hash);
+    if (baselineOffsets != nullptr) {
+        for (auto offset : *baselineOffsets) {
+            hash = fnv(&offset, sizeof(offset), hash);
+        }
+    }
+    return hash;
+}
+
+HRESULT ILCache::makeKey(ICorProfilerInfo8& profilerInfo, IMetaDataImport* metadataImport, ModuleID moduleId,
+                         mdMethodDef token, UINT64 settingsHash, ILCacheKey& key) {
+    HRESULT hr;
+    std::memset(&key, 0, sizeof(key));
+    IfFailRet(metadataImport->GetScopeProps(nullptr, 0, nullptr, &key.mvid));
+    LPCBYTE body;
+    ULONG bodySize;
+    IfFailRet(profilerInfo.GetILFunctionBody(moduleId, token, &body, &bodySize));
+    key.token = token;
+    key.ilHash = fnv(body, bodySize);
+    key.settingsHash = settingsHash;
+    return S_OK;
+}
+
+HRESULT ILCache::layoutHash(ICorProfilerInfo8& profilerInfo, ModuleID moduleId, mdMethodDef token, UINT64 settingsHash, UINT64& hash) {
+    HRESULT hr;
+    LPCBYTE body;
+    ULONG bodySize;
+    IfFailRet(profilerInfo.GetILFunctionBody(moduleId, token, &body, &bodySize));
+    hash = fnv(body, bodySize, fnv(&settingsHash, sizeof(settingsHash)));
+    return S_OK;
+}
+
+bool ILCache::find(const ILCacheKey& key, CachedIL& method) {
+    lockCounted(mutex);
+    auto found = records.find(key);
+    if (found == records.end()) {
+        mutex.unlock();
+        return false;
+    }
+    const char* record = found->second;
+    mutex.unlock();
+
+    // records are immutable once indexed, so they are read without the lock
+    auto header = readAt<RecordHeader>(record);
+    const char* at = record + sizeof(RecordHeader);
+    method.body = reinterpret_cast<const BYTE*>(at);
+    method.bodySize = header.bodySize;
+    at += header.bodySize;
+    method.relocations.resize(header.relocationCount);
+    if (header.relocationCount > 0)
+        std::memcpy(method.relocations.data(), at, header.relocationCount * sizeof(ILRelocation));
+    at += header.relocationCount * sizeof(ILRelocation);
+    method.blockOffsets.resize(header.siteCount);
+    if (header.siteCount > 0)
+        std::memcpy(method.blockOffsets.data(), at, header.siteCount * sizeof(OFFSET));
+    return true;
+}
+
+void ILCache::add(const ILCacheKey& key, const RewrittenIL& method, const std::vector<OFFSET>& blockOffsets) {
+    std::vector<char> record;
+    record.reserve(recordSize(method.body.size(), method.relocations.size(), blockOffsets.size()));
+    record.resize(sizeof(RecordHeader));
+    serializePrimitiveArray(reinterpret_cast<const char*>(method.body.data()), method.body.size(), record);
+    serializePrimitiveArray(reinterpret_cast<const char*>(method.relocations.data()), method.relocations.size() * sizeof(ILRelocation), record);
+    serializePrimitiveArray(blockOffsets.data(), blockOffsets.size(), record);
+
+    RecordHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = recordMagic;
+    header.version = recordVersion;
+    header.size = static_cast<UINT32>(record.size());
+    header.bodySize = static_cast<UINT32>(method.body.size());
+    header.relocationCount = static_cast<UINT32>(method.relocations.size());
+    header.siteCount = static_cast<UINT32>(blockOffsets.size());
+    header.checksum = fnv(record.data() + sizeof(RecordHeader), record.size() - sizeof(RecordHeader));
+    header.key = key;
+    std::memcpy(record.data(), &header, sizeof(header));
+
+    lockCounted(mutex);
+    // another thread may have rewritten the same method meanwhile
+    if (records.find(key) == records.end()) {
+        added.push_back(std::move(record));
+        records.insert({key, added.back().data()});
+    }
+    mutex.unlock();
+}
+
+void ILCache::flush() {
+    if (!enabled) return;
+    std::vector<char> appended;
+    lockCounted(mutex);
+    // the records stay indexed, but are not written twice
+    size_t first = flushedCount, last = added.size();
+    for (size_t i = first; i < last; i++) {
+        appended.insert(appended.end(), added[i].begin(), added[i].end());
+    }
+    flushedCount = last;
+    mutex.unlock();
+    if (appended.empty()) return;
+
+    // records of the processes sharing the file are not interleaved, torn records are skipped by the checksum
+    if (!OS::appendToFile(path.c_str(), appended.data(), appended.size())) {
+        LOG_ERROR(tout << "IL cache " << path << ": failed to append " << last - first << " methods");
+        return;
+    }
+    LOG(tout << "IL cache " << path << ": " << last - first << " methods appended");
+}
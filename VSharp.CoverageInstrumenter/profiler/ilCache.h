@@ -0,0 +1,76 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_ILCACHE_H
+#define VSHARP_COVERAGEINSTRUMENTER_ILCACHE_H
+
+#include "ILRewriter.h"
+#include "cor.h"
+#include "corprof.h"
+#include "memory.h"
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace vsharp {
+
+struct ILCacheKey {
+    GUID mvid;
+    mdMethodDef token;
+    // of the original method body, header and exception clauses included
+    UINT64 ilHash;
+    // of the instrumentation settings which change the rewritten IL
+    UINT64 settingsHash;
+
+    bool operator<(const ILCacheKey& other) const;
+};
+
+// cached method, 'body' points into the mapped file or into the methods added by this process
+struct CachedIL {
+    const BYTE* body;
+    UINT32 bodySize;
+    std::vector<ILRelocation> relocations;
+    std::vector<OFFSET> blockOffsets;
+};
+
+// Rewritten IL of the methods shared by the runs with the same assemblies and settings.
+// The file is an append-only sequence of records, mapped at startup; the methods rewritten
+// by the process are appended at its shutdown
+class ILCache {
+private:
+    std::mutex mutex;
+    std::string path;
+    bool enabled = false;
+    const char* mapped = nullptr;
+    size_t mappedSize = 0;
+    // key -> record in the mapping or in 'added'
+    std::map<ILCacheKey, const char*> records;
+    // deque elements are not moved, so the index keeps pointing into them
+    std::deque<std::vector<char>> added;
+    size_t flushedCount = 0;
+
+    void indexRecords(const char* begin, const char* end);
+public:
+    void open(const char* path);
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    static UINT64 settingsHash(InstrumentationGranularity granularity, bool isMain, const std::set<OFFSET>* baselineOffsets);
+    static HRESULT makeKey(ICorProfilerInfo8& profilerInfo, IMetaDataImport* metadataImport, ModuleID moduleId,
+                           mdMethodDef token, UINT64 settingsHash, ILCacheKey& key);
+    // of the original body and the settings, which determine the probe sites of the rewritten method
+    static HRESULT layoutHash(ICorProfilerInfo8& profilerInfo, ModuleID moduleId, mdMethodDef token, UINT64 settingsHash, UINT64& hash);
+
+    bool find(const ILCacheKey& key, CachedIL& method);
+    void add(const ILCacheKey& key, const RewrittenIL& method, const std::vector<OFFSET>& blockOffsets);
+    // appends the methods rewritten by this process to the file
+    void flush();
+};
+
+extern ILCache ilCache;
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_ILCACHE_H
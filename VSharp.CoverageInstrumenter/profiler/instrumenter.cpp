@@ -1,8 +1,14 @@
 #include "instrumenter.h"
+#include "attachSession.h"
+#include "eventPipeExport.h"
+#include "ilCache.h"
+#include "sharedCoverageMap.h"
 #include "logging.h"
 #include "cComPtr.h"
 #include "os.h"
 #include "profilerState.h"
+#include "profilerStats.h"
+#include "traceLog.h"
 #include <vector>
 
 
@@ -22,13 +28,14 @@ using namespace vsharp;
 #define ELEMENT_TYPE_SIZE ELEMENT_TYPE_U
 
 std::set<std::pair<FunctionID, ModuleID>> vsharp::instrumentedMethods;
+std::mutex Instrumenter::mutex;
 
 HRESULT initTokens(const CComPtr<IMetaDataEmit> &metadataEmit, std::vector<mdSignature> &tokens) {
     auto covProb = getProbes();
     mdSignature signatureToken;
     SIG_DEF(0x01, ELEMENT_TYPE_VOID, ELEMENT_TYPE_OFFSET)
     covProb->Finalize_Call->setSig(signatureToken);
-    SIG_DEF(0x02, ELEMENT_TYPE_VOID, ELEMENT_TYPE_OFFSET, ELEMENT_TYPE_I4)
+    SIG_DEF(0x03, ELEMENT_TYPE_VOID, ELEMENT_TYPE_OFFSET, ELEMENT_TYPE_I4, ELEMENT_TYPE_I4)
     covProb->Branch->setSig(signatureToken);
     covProb->Call->setSig(signatureToken);
     covProb->Leave->setSig(signatureToken);
@@ -40,6 +47,12 @@ HRESULT initTokens(const CComPtr<IMetaDataEmit> &metadataEmit, std::vector<mdSig
     SIG_DEF(0x03, ELEMENT_TYPE_VOID, ELEMENT_TYPE_OFFSET, ELEMENT_TYPE_I4, ELEMENT_TYPE_I4)
     covProb->EnterMain->setSig(signatureToken);
     covProb->Enter->setSig(signatureToken);
+    SIG_DEF(0x05, ELEMENT_TYPE_VOID, ELEMENT_TYPE_SIZE, ELEMENT_TYPE_OFFSET, ELEMENT_TYPE_I4, ELEMENT_TYPE_I4, ELEMENT_TYPE_I4)
+    covProb->CompareString->setSig(signatureToken);
+    SIG_DEF(0x05, ELEMENT_TYPE_VOID, ELEMENT_TYPE_I8, ELEMENT_TYPE_I8, ELEMENT_TYPE_OFFSET, ELEMENT_TYPE_I4, ELEMENT_TYPE_I4)
+    covProb->CompareInt->setSig(signatureToken);
+    SIG_DEF(0x02, ELEMENT_TYPE_VOID, ELEMENT_TYPE_I4, ELEMENT_TYPE_I4)
+    covProb->Path->setSig(signatureToken);
     return S_OK;
 }
 
@@ -56,22 +69,45 @@ Instrumenter::~Instrumenter()
 }
 
 bool vsharp::IsMain(const WCHAR *moduleName, int moduleSize, mdMethodDef method) {
-    // NOTE: decrementing 'moduleSize', because of null terminator
-    if (profilerState->mainMethodInfo.moduleName == nullptr)
-        return false;
-    if (profilerState->mainMethodInfo.moduleNameLength != moduleSize - 1 || profilerState->mainMethodInfo.token != method)
-        return false;
-    for (int i = 0; i < profilerState->mainMethodInfo.moduleNameLength; i++)
-        if (profilerState->mainMethodInfo.moduleName[i] != moduleName[i]) return false;
-
-    return true;
+    return profilerState->findEntryTarget(moduleName, moduleSize, method) != -1;
 }
 
-bool vsharp::InstrumentationIsNeeded(const WCHAR *moduleName, int moduleSize, mdMethodDef method) {
-    return IsMain(moduleName, moduleSize, method) || !profilerState->collectMainOnly;
+bool vsharp::InstrumentationIsNeeded(const WCHAR *moduleName, int moduleSize, const WCHAR *assemblyName, mdMethodDef method) {
+    if (IsMain(moduleName, moduleSize, method))
+        return true;
+    return !profilerState->collectMainOnly && profilerState->isInstrumentedAssembly(assemblyName);
 }
 
-HRESULT Instrumenter::doInstrumentation(ModuleID oldModuleId, size_t methodId, const WCHAR *moduleName, ULONG moduleNameLength) {
+HRESULT GetMethodNames(ICorProfilerInfo8 &profilerInfo, ModuleID moduleId, WCHAR **moduleName, ULONG *moduleNameLength, WCHAR **assemblyName, ULONG *assemblyNameLength) {
+    HRESULT hr;
+    LPCBYTE baseLoadAddress;
+    AssemblyID assembly;
+    IfFailRet(profilerInfo.GetModuleInfo(moduleId, &baseLoadAddress, 0, moduleNameLength, nullptr, &assembly));
+    *moduleName = new WCHAR[*moduleNameLength];
+    IfFailRet(profilerInfo.GetModuleInfo(moduleId, &baseLoadAddress, *moduleNameLength, moduleNameLength, *moduleName, &assembly));
+    AppDomainID appDomainId;
+    ModuleID startModuleId;
+    IfFailRet(profilerInfo.GetAssemblyInfo(assembly, 0, assemblyNameLength, nullptr, &appDomainId, &startModuleId));
+    *assemblyName = new WCHAR[*assemblyNameLength];
+    IfFailRet(profilerInfo.GetAssemblyInfo(assembly, *assemblyNameLength, assemblyNameLength, *assemblyName, &appDomainId, &startModuleId));
+    return S_OK;
+}
+
+bool Instrumenter::isInstrumentationNeeded(ICorProfilerInfo8 &profilerInfo, ModuleID moduleId, mdMethodDef token, bool *isMain) {
+    WCHAR *moduleName = nullptr;
+    WCHAR *assemblyName = nullptr;
+    ULONG moduleNameLength;
+    ULONG assemblyNameLength;
+    bool result = SUCCEEDED(GetMethodNames(profilerInfo, moduleId, &moduleName, &moduleNameLength, &assemblyName, &assemblyNameLength))
+        && InstrumentationIsNeeded(moduleName, (int) moduleNameLength, assemblyName, token);
+    *isMain = result && IsMain(moduleName, (int) moduleNameLength, token);
+    delete[] moduleName;
+    delete[] assemblyName;
+    return result;
+}
+
+HRESULT Instrumenter::doInstrumentation(ModuleID oldModuleId, size_t methodId, const WCHAR *moduleName, ULONG moduleNameLength,
+                                        const std::set<OFFSET>* baselineOffsets, ICorProfilerFunctionControl *functionControl) {
     HRESULT hr;
     CComPtr<IMetaDataImport> metadataImport;
     CComPtr<IMetaDataEmit> metadataEmit;
@@ -87,14 +123,47 @@ HRESULT Instrumenter::doInstrumentation(ModuleID oldModuleId, size_t methodId, c
         memcpy(m_signatureTokens, (char *)&tokens[0], m_signatureTokensLength);
     }
 
-    RewriteIL(
+    bool isMain = IsMain(moduleName, moduleNameLength, m_jittedToken);
+
+    // comparison literals and path locals are specific to the process, so such IL is not cached
+    ILCacheKey cacheKey;
+    bool isCacheable = ilCache.isEnabled() && !profilerState->captureComparisons && !profilerState->profilePaths
+        && SUCCEEDED(ILCache::makeKey(m_profilerInfo, metadataImport, m_moduleId, m_jittedToken,
+                                      ILCache::settingsHash(profilerState->granularity, isMain, baselineOffsets), cacheKey));
+    if (isCacheable) {
+        CachedIL cached;
+        if (ilCache.find(cacheKey, cached)) {
+            ILRewriter rewriter(&m_profilerInfo, functionControl, m_moduleId, m_jittedToken);
+            if (SUCCEEDED(rewriter.ExportCached(cached.body, cached.bodySize, cached.relocations, (int) methodId))) {
+                profilerState->coverageTracker->setMethodBlocks(methodId, cached.blockOffsets);
+                countStat(ILCacheHits);
+                return S_OK;
+            }
+            LOG_ERROR(tout << "Failed to install the cached IL of " << HEX(m_jittedToken) << ", rewriting it");
+        }
+        countStat(ILCacheMisses);
+    }
+
+    std::vector<OFFSET> blockOffsets;
+    RewrittenIL rewritten;
+    hr = RewriteIL(
             &m_profilerInfo,
-            nullptr,
+            functionControl,
             m_moduleId,
             m_jittedToken,
             methodId,
-            IsMain(moduleName, moduleNameLength, m_jittedToken)
+            isMain,
+            profilerState->captureComparisons,
+            profilerState->profilePaths,
+            profilerState->granularity,
+            baselineOffsets,
+            blockOffsets,
+            isCacheable ? &rewritten : nullptr
     );
+    profilerState->coverageTracker->setMethodBlocks(methodId, blockOffsets);
+    if (isCacheable && SUCCEEDED(hr) && !rewritten.body.empty()) {
+        ilCache.add(cacheKey, rewritten, blockOffsets);
+    }
 
     return S_OK;
 }
@@ -104,49 +173,106 @@ HRESULT Instrumenter::instrument(FunctionID functionId) {
     ModuleID newModuleId;
     ClassID classId;
     IfFailRet(m_profilerInfo.GetFunctionInfo(functionId, &classId, &newModuleId, &m_jittedToken));
+    return instrumentMethod(functionId, newModuleId, nullptr);
+}
+
+HRESULT Instrumenter::reinstrument(ModuleID moduleId, mdMethodDef token, ICorProfilerFunctionControl *functionControl) {
+    m_jittedToken = token;
+    return instrumentMethod(0, moduleId, functionControl);
+}
+
+HRESULT Instrumenter::instrumentMethod(FunctionID functionId, ModuleID newModuleId, ICorProfilerFunctionControl *functionControl) {
+    StatTimer timer(InstrumentNanoseconds);
+    HRESULT hr = S_OK;
     assert((m_jittedToken & 0xFF000000L) == mdtMethodDef);
 
-    LPCBYTE baseLoadAddress;
+    WCHAR *moduleName = nullptr;
+    WCHAR *assemblyName = nullptr;
     ULONG moduleNameLength;
-    AssemblyID assembly;
-    IfFailRet(m_profilerInfo.GetModuleInfo(newModuleId, &baseLoadAddress, 0, &moduleNameLength, nullptr, &assembly));
-    WCHAR *moduleName = new WCHAR[moduleNameLength];
-    IfFailRet(m_profilerInfo.GetModuleInfo(newModuleId, &baseLoadAddress, moduleNameLength, &moduleNameLength, moduleName, &assembly));
     ULONG assemblyNameLength;
-    AppDomainID appDomainId;
-    ModuleID startModuleId;
-    IfFailRet(m_profilerInfo.GetAssemblyInfo(assembly, 0, &assemblyNameLength, nullptr, &appDomainId, &startModuleId));
-    WCHAR *assemblyName = new WCHAR[assemblyNameLength];
-    IfFailRet(m_profilerInfo.GetAssemblyInfo(assembly, assemblyNameLength, &assemblyNameLength, assemblyName, &appDomainId, &startModuleId));
+    hr = GetMethodNames(m_profilerInfo, newModuleId, &moduleName, &moduleNameLength, &assemblyName, &assemblyNameLength);
+    // skipping non-main methods and methods of not instrumented assemblies
+    if (FAILED(hr) || !InstrumentationIsNeeded(moduleName, (int) moduleNameLength, assemblyName, m_jittedToken)) {
+        delete[] moduleName;
+        delete[] assemblyName;
+        return hr;
+    }
 
-    // skipping non-main methods
-    if (!InstrumentationIsNeeded(moduleName, moduleNameLength, m_jittedToken)) {
-        return S_OK;
+    bool isMain = IsMain(moduleName, moduleNameLength, m_jittedToken);
+    if (isMain && functionId != 0) {
+        profilerState->addEntryFunction(functionId, newModuleId);
     }
 
-    if (profilerState->collectMainOnly) {
-        profilerState->mainFunctionId = functionId;
+    const std::set<OFFSET>* baselineOffsets = nullptr;
+    if (profilerState->coverageBaseline != nullptr) {
+        baselineOffsets = profilerState->coverageBaseline->find(moduleName, moduleNameLength, m_jittedToken);
     }
+    // the id of an unloaded method is reused only for the same probe sites
+    UINT64 layoutHash = 0;
+    ILCache::layoutHash(m_profilerInfo, newModuleId, m_jittedToken,
+                        ILCache::settingsHash(profilerState->granularity, isMain, baselineOffsets), layoutHash);
 
+    lockCounted(mutex);
     // checking if this method was rewritten before
     if (instrumentedMethods.find({ m_jittedToken, newModuleId }) != instrumentedMethods.end()) {
         // LOG(tout << "repeated JIT of " << m_jittedToken << "! skipped" << std::endl);
+        mutex.unlock();
+        delete[] moduleName;
+        delete[] assemblyName;
+        return S_OK;
+    }
+
+    // the code of the first JIT cannot be reverted, so the attached profiler instruments with ReJIT only
+    if (functionControl == nullptr && attachSession.isAttached()) {
+        mutex.unlock();
+        delete[] moduleName;
+        delete[] assemblyName;
+        attachSession.methodJitted(newModuleId, m_jittedToken);
         return S_OK;
     }
 
-    mutex.lock();
     size_t currentMethodId = profilerState->coverageTracker->collectMethod({
             m_jittedToken,
             assemblyNameLength,
             assemblyName,
             moduleNameLength,
-            moduleName}
-        );
+            moduleName},
+        newModuleId,
+        layoutHash);
     instrumentedMethods.insert({m_jittedToken, newModuleId});
+    if (sharedCoverageMap.isAttached()) {
+        sharedCoverageMap.registerMethod((int) currentMethodId, moduleName, moduleNameLength, m_jittedToken);
+    }
     mutex.unlock();
+    if (coverageEventPipe.isEnabled()) {
+        coverageEventPipe.methodLoaded((int) currentMethodId, m_jittedToken, assemblyName, moduleName);
+    }
+    if (isMain) {
+        profilerState->addEntryMethod((int) currentMethodId, {m_jittedToken, assemblyNameLength, assemblyName, moduleNameLength, moduleName});
+    }
     ModuleID oldModuleId = m_moduleId;
     m_moduleId = newModuleId;
-    hr = doInstrumentation(oldModuleId, currentMethodId, moduleName, moduleNameLength);
+    hr = doInstrumentation(oldModuleId, currentMethodId, moduleName, moduleNameLength, baselineOffsets, functionControl);
+    countStat(MethodsInstrumented);
+    TRACE3(TraceInstrumentation, TraceMethodInstrumented, currentMethodId, m_jittedToken, newModuleId);
 
     return hr;
 }
+
+void Instrumenter::moduleUnloaded(ModuleID moduleId) {
+    lockCounted(mutex);
+    for (auto method = instrumentedMethods.begin(); method != instrumentedMethods.end();) {
+        if (method->second == moduleId)
+            method = instrumentedMethods.erase(method);
+        else
+            ++method;
+    }
+    // the entry methods refer to the names, which are freed when the methods are archived
+    auto methodIds = profilerState->coverageTracker->getModuleMethods(moduleId);
+    profilerState->unloadEntryModule(moduleId, methodIds);
+    profilerState->coverageTracker->unloadModule(moduleId);
+    mutex.unlock();
+    countStat(ModulesUnloaded);
+    TRACE2(TraceInstrumentation, TraceModuleUnloaded, moduleId, methodIds.size());
+    LOG(tout << "Module " << moduleId << " unloaded, methods archived: " << methodIds.size());
+}
@@ -18,18 +18,27 @@ private:
 
     char *m_signatureTokens;
     unsigned m_signatureTokensLength;
-    std::mutex mutex;
-    HRESULT doInstrumentation(ModuleID oldModuleId, size_t methodId, const WCHAR *moduleName, ULONG moduleNameLength);
+    // an instrumenter is created per JIT compilation, so the lock is shared by all of them
+    static std::mutex mutex;
+    HRESULT doInstrumentation(ModuleID oldModuleId, size_t methodId, const WCHAR *moduleName, ULONG moduleNameLength,
+                              const std::set<OFFSET>* baselineOffsets, ICorProfilerFunctionControl *functionControl);
+    // 'functionId' is 0 for ReJIT, 'functionControl' is null for the first JIT
+    HRESULT instrumentMethod(FunctionID functionId, ModuleID newModuleId, ICorProfilerFunctionControl *functionControl);
 
 public:
     explicit Instrumenter(ICorProfilerInfo8 &profilerInfo);
     ~Instrumenter();
 
     HRESULT instrument(FunctionID functionId);
+    // supplies the instrumented IL for the requested ReJIT of the method
+    HRESULT reinstrument(ModuleID moduleId, mdMethodDef token, ICorProfilerFunctionControl *functionControl);
+    static bool isInstrumentationNeeded(ICorProfilerInfo8 &profilerInfo, ModuleID moduleId, mdMethodDef token, bool *isMain);
+    // forgets the state bound to the module id, so that the id may be reused by the runtime
+    static void moduleUnloaded(ModuleID moduleId);
 };
 
 bool IsMain(const WCHAR *moduleName, int moduleSize, mdMethodDef method);
-bool InstrumentationIsNeeded(const WCHAR *moduleName, int moduleSize, mdMethodDef method);
+bool InstrumentationIsNeeded(const WCHAR *moduleName, int moduleSize, const WCHAR *assemblyName, mdMethodDef method);
 
 }
 
@@ -5,21 +5,23 @@
 #undef max
 #undef min
 #endif
-#include <fstream>
-#include <mutex>
+#include <sstream>
 #include <thread>
 
 #define HEX(x) std::hex << "0x" << (x) << std::dec
 
 #ifdef _LOGGING
-extern std::ofstream tout;
-extern std::recursive_mutex logMutex;
+// line being formatted by the current thread; committed lines are batched per thread and
+// written to the log file without taking a global lock or flushing on every line
+extern thread_local std::ostringstream tout;
 
 #define LOG_CODE(CODE) { CODE } ((void) 0)
 
 void open_log(const char*& logName);
 void close_log();
-
+void commit_log_line();
+// writes the batch of the current thread and flushes the file, so errors survive a crash
+void commit_log_error();
 
 #else
 #define LOG_CODE(CODE) ((void) 0)
@@ -28,8 +30,8 @@ static inline void open_log() {}
 static inline void close_log() {}
 #endif
 
-#define LOG(CODE) LOG_CODE(logMutex.lock(); tout << "[" << std::this_thread::get_id() << "] "; CODE ; tout << "\n"; tout.flush(); logMutex.unlock();)
-#define LOG_ERROR(CODE) LOG_CODE(tout << "-------- [LOG_ERROR] " << __FUNCTION__ << " " << __FILE__ << ":" << __LINE__ << " ---------\n"; CODE ; tout << "------------------------------------------------\n"; tout.flush();)
+#define LOG(CODE) LOG_CODE(tout << "[" << std::this_thread::get_id() << "] "; CODE ; tout << "\n"; commit_log_line();)
+#define LOG_ERROR(CODE) LOG_CODE(tout << "-------- [LOG_ERROR] " << __FUNCTION__ << " " << __FILE__ << ":" << __LINE__ << " ---------\n"; CODE ; tout << "------------------------------------------------\n"; commit_log_error();)
 
 
 #endif // LOGGING_H_
@@ -8,5 +8,17 @@ class OS final {
 public:
     static std::string unicodeToAnsi(const WCHAR* str);
     static void sleepSeconds(int seconds);
+    // cheap monotonic tick counter; ticks are not nanoseconds and must be calibrated
+    static UINT64 cycleCounter();
+    // maps the whole file for reading and writing, changes are visible to other processes mapping it
+    static void* mapSharedFile(const char* path, size_t* size);
+    // maps the whole file read-only, returns nullptr for missing and empty files
+    static const void* mapFileForReading(const char* path, size_t* size);
+    // releases a mapping made by 'mapSharedFile' or 'mapFileForReading'
+    static void unmapFile(const void* memory, size_t size);
+    // appends the data under an exclusive file lock, so appends of concurrent processes are not interleaved
+    static bool appendToFile(const char* path, const char* data, size_t size);
+    // keeps the profiler library loaded after the runtime releases it
+    static bool pinProfilerLibrary();
 };
 #endif //_OS_H
@@ -3,6 +3,11 @@
 #include "coverageTracker.h"
 #include "threadTracker.h"
 #include "profilerState.h"
+#include "profilerStats.h"
+#include "traceLog.h"
+#include "callingContextTree.h"
+#include <mutex>
+#include <set>
 
 using namespace vsharp;
 
@@ -12,7 +17,7 @@ ProbeCall::ProbeCall(INT_PTR methodAddr) {
 
 mdSignature ProbeCall::getSig() {
     ThreadID thread = profilerState->threadInfo->getCurrentThread();
-    threadMappingLock.lock();
+    lockCounted(threadMappingLock);
     auto pos = threadMapping.find(thread);
     if (pos == threadMapping.end()) {
         threadMappingLock.unlock();
@@ -24,7 +29,7 @@ mdSignature ProbeCall::getSig() {
 
 void ProbeCall::setSig(mdSignature sig) {
     ThreadID thread = profilerState->threadInfo->getCurrentThread();
-    threadMappingLock.lock();
+    lockCounted(threadMappingLock);
     threadMapping[thread] = sig;
     threadMappingLock.unlock();
 }
@@ -46,80 +51,233 @@ void vsharp::InitializeProbes() {
     covProbes->Tailcall = new ProbeCall((INT_PTR) &Track_Tailcall);
     covProbes->Stsfld = new ProbeCall((INT_PTR) &Track_Stsfld);
     covProbes->Throw = new ProbeCall((INT_PTR) &Track_Throw);
+    covProbes->CompareInt = new ProbeCall((INT_PTR) &Track_CompareInt);
+    covProbes->CompareString = new ProbeCall((INT_PTR) &Track_CompareString);
+    covProbes->Path = new ProbeCall((INT_PTR) &Track_Path);
     LOG(tout << "probes initialized" << std::endl);
 }
 
 CoverageProbes vsharp::coverageProbes;
 
+// appended to, never reordered: cached IL refers to the probes by these indices
+static ProbeCall* CoverageProbes::* const probesOrder[] = {
+    &CoverageProbes::Coverage, &CoverageProbes::Stsfld, &CoverageProbes::Branch, &CoverageProbes::Enter,
+    &CoverageProbes::EnterMain, &CoverageProbes::Leave, &CoverageProbes::LeaveMain, &CoverageProbes::Finalize_Call,
+    &CoverageProbes::Call, &CoverageProbes::Tailcall, &CoverageProbes::Throw, &CoverageProbes::CompareInt,
+    &CoverageProbes::CompareString, &CoverageProbes::Path
+};
+
+int vsharp::indexOfProbe(INT_PTR addr) {
+    for (size_t i = 0; i < sizeof(probesOrder) / sizeof(probesOrder[0]); i++) {
+        if ((coverageProbes.*probesOrder[i])->addr == addr)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+ProbeCall* vsharp::probeAt(int index) {
+    if (index < 0 || static_cast<size_t>(index) >= sizeof(probesOrder) / sizeof(probesOrder[0]))
+        return nullptr;
+    return coverageProbes.*probesOrder[index];
+}
+
+// Depth of the probes running on a thread. Only the thread writes it, so the probes do not contend on a shared
+// counter; the shutdown and the detach read the depths of all threads in 'waitForProbes'
+struct ProbeDepth {
+    std::atomic<int> depth {0};
+};
+
+static std::mutex probeDepthsMutex;
+static std::set<ProbeDepth*> probeDepths;
+
+struct ThreadProbeDepth {
+    ProbeDepth *probeDepth = nullptr;
+
+    ProbeDepth &get() {
+        if (probeDepth == nullptr) {
+            probeDepth = new ProbeDepth();
+            std::lock_guard<std::mutex> lock(probeDepthsMutex);
+            probeDepths.insert(probeDepth);
+        }
+        return *probeDepth;
+    }
+
+    // no probe runs on an exiting thread
+    ~ThreadProbeDepth() {
+        if (probeDepth == nullptr)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(probeDepthsMutex);
+            probeDepths.erase(probeDepth);
+        }
+        delete probeDepth;
+    }
+};
+
+static thread_local ThreadProbeDepth threadProbeDepth;
+
+void vsharp::waitForProbes() {
+    std::lock_guard<std::mutex> lock(probeDepthsMutex);
+    for (ProbeDepth *probeDepth : probeDepths) {
+        while (probeDepth->depth.load() > 0) {}
+    }
+}
+
+// Holds off the shutdown and the detach while the probe of a tracked thread runs. The depth is raised before
+// the check, so the probe either sees the finished profiler or is waited for; the rewritten code keeps calling
+// the probes after the finish, e.g. in the frames which were running when the methods were reverted
+class ProbeScope {
+private:
+    ProbeDepth *probeDepth = nullptr;
+    bool active = false;
+public:
+    // the entry probe runs on the threads which are not tracked yet
+    explicit ProbeScope(bool anyThread = false) {
+        if (!anyThread && !profilerState->threadTracker->isCurrentThreadTracked()) return;
+        probeDepth = &threadProbeDepth.get();
+        probeDepth->depth.store(probeDepth->depth.load(std::memory_order_relaxed) + 1);
+        active = !profilerState->isFinished;
+    }
+
+    ~ProbeScope() {
+        if (probeDepth != nullptr)
+            probeDepth->depth.store(probeDepth->depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    bool isActive() const {
+        return active;
+    }
+};
+
+// called by the enter probes, whose frames are right above the frames of the entered methods
+static void checkStackDepth(OFFSET offset, int methodId) {
+    int stackMarker;
+    if (profilerState->threadTracker->isPossibleStackOverflow(reinterpret_cast<UINT_PTR>(&stackMarker))
+        && profilerState->threadTracker->reportStackOverflow()) {
+        LOG(tout << "Possible stack overflow: " << methodId);
+        countStat(StackOverflowsPredicted);
+        profilerState->coverageTracker->addCoverage(offset, StackOverflowPredicted, methodId, 0);
+    }
+}
+
 //region Probes declarations
-void vsharp::Track_Coverage(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Track_Coverage(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeCoverageHits);
+    TRACE3(TraceProbes, TraceProbeCoverage, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Coverage: method = " << methodId << ", offset = " << HEX(offset));
-    profilerState->coverageTracker->addCoverage(offset, TrackCoverage, methodId);
+    profilerState->coverageTracker->addCoverage(offset, TrackCoverage, methodId, blockIndex);
 }
 
-void vsharp::Track_Stsfld(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Track_Stsfld(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeStsfldHits);
+    TRACE3(TraceProbes, TraceProbeStsfld, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Stsfld: method = " << methodId << ", offset = " << HEX(offset));
-    profilerState->coverageTracker->addCoverage(offset, StsfldHit, methodId);
+    profilerState->coverageTracker->addCoverage(offset, StsfldHit, methodId, blockIndex);
 }
 
-void vsharp::Branch(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Branch(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeBranchHits);
+    TRACE3(TraceProbes, TraceProbeBranch, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Branch: method = " << methodId << ", offset = " << HEX(offset));
-    profilerState->coverageTracker->addCoverage(offset, BranchHit, methodId);
+    profilerState->coverageTracker->addCoverage(offset, BranchHit, methodId, blockIndex);
 }
 
-void vsharp::Track_Call(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Track_Call(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeCallHits);
+    TRACE3(TraceProbes, TraceProbeCall, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Call: method = " << methodId << ", offset = " << HEX(offset));
-    profilerState->coverageTracker->addCoverage(offset, Call, methodId);
+    profilerState->coverageTracker->addCoverage(offset, Call, methodId, blockIndex);
 }
 
-void vsharp::Track_Tailcall(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Track_Tailcall(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeTailcallHits);
+    TRACE3(TraceProbes, TraceProbeTailcall, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Tailcall: method = " << methodId << ", offset = " << HEX(offset));
     // popping frame before tailcall execution
     profilerState->threadTracker->stackBalanceDown();
-    profilerState->coverageTracker->addCoverage(offset, Tailcall, methodId);
+    if (callingContextProfiler.isEnabled())
+        callingContextProfiler.leave();
+    if (profilerState->granularity != GranularityMethod)
+        profilerState->coverageTracker->addCoverage(offset, Tailcall, methodId, blockIndex);
 }
 
 void vsharp::Track_Enter(OFFSET offset, int methodId, int isSpontaneous) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
-    if (profilerState->threadTracker->isPossibleStackOverflow()) {
-        LOG(tout << "Possible stack overflow: " << methodId);
-    }
+    countStat(ProbeEnterHits);
+    TRACE2(TraceProbes, TraceProbeEnter, methodId, offset);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Enter: " << methodId);
     if (!profilerState->coverageTracker->isCollectMainOnly())
-        profilerState->coverageTracker->addCoverage(offset, Enter, methodId);
+        profilerState->coverageTracker->addCoverage(offset, Enter, methodId, 0);
     profilerState->threadTracker->stackBalanceUp();
+    if (callingContextProfiler.isEnabled())
+        callingContextProfiler.enter(methodId);
+    checkStackDepth(offset, methodId);
 }
 
 void vsharp::Track_EnterMain(OFFSET offset, int methodId, int isSpontaneous) {
+    countStat(ProbeEnterMainHits);
+    TRACE2(TraceProbes, TraceProbeEnterMain, methodId, offset);
+    ProbeScope scope(true);
+    if (!scope.isActive()) return;
     if (profilerState->threadTracker->isCurrentThreadTracked()) {
         // Recursive enter
         LOG(tout << "(recursive) Track_EnterMain: " << methodId);
         profilerState->threadTracker->stackBalanceUp();
+        if (callingContextProfiler.isEnabled())
+            callingContextProfiler.enter(methodId);
+        // in the main only mode the recursion of the main is the only one seen
+        checkStackDepth(offset, methodId);
         return;
     }
-    LOG(tout << "Track_EnterMain: " << methodId);
-    profilerState->threadTracker->trackCurrentThread();
+    int targetId = profilerState->getEntryTarget(methodId);
+    if (targetId == -1) {
+        // the method stays instrumented after its entry target was removed
+        LOG(tout << "Track_EnterMain of removed entry target: " << methodId);
+        return;
+    }
+    LOG(tout << "Track_EnterMain: " << methodId << ", entry target: " << targetId);
+    int stackMarker;
+    profilerState->threadTracker->trackCurrentThread(reinterpret_cast<UINT_PTR>(&stackMarker));
     profilerState->threadTracker->stackBalanceUp();
-    profilerState->coverageTracker->addCoverage(offset, EnterMain, methodId);
+    profilerState->coverageTracker->addCoverage(offset, EnterMain, methodId, 0);
+    if (callingContextProfiler.isEnabled())
+        callingContextProfiler.enter(methodId);
 }
 
-void vsharp::Track_Leave(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Track_Leave(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeLeaveHits);
+    TRACE3(TraceProbes, TraceProbeLeave, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Leave: " << methodId);
-    if (!profilerState->coverageTracker->isCollectMainOnly())
-        profilerState->coverageTracker->addCoverage(offset, Leave, methodId);
+    // on the method level leaves only keep the stack balance
+    if (!profilerState->coverageTracker->isCollectMainOnly() && profilerState->granularity != GranularityMethod)
+        profilerState->coverageTracker->addCoverage(offset, Leave, methodId, blockIndex);
     profilerState->threadTracker->stackBalanceDown();
+    if (callingContextProfiler.isEnabled())
+        callingContextProfiler.leave();
 }
 
-void vsharp::Track_LeaveMain(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
-    profilerState->coverageTracker->addCoverage(offset, LeaveMain, methodId);
+void vsharp::Track_LeaveMain(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeLeaveMainHits);
+    TRACE3(TraceProbes, TraceProbeLeaveMain, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
+    profilerState->coverageTracker->addCoverage(offset, LeaveMain, methodId, blockIndex);
     LOG(tout << "Track_LeaveMain: " << methodId);
+    if (callingContextProfiler.isEnabled())
+        callingContextProfiler.leave();
     if (profilerState->threadTracker->stackBalanceDown()) {
         // first main frame is not yet reached
         return;
@@ -127,13 +285,48 @@ void vsharp::Track_LeaveMain(OFFSET offset, int methodId) {
     profilerState->threadTracker->loseCurrentThread();
 }
 
-void vsharp::Track_Throw(OFFSET offset, int methodId) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+void vsharp::Track_Throw(OFFSET offset, int methodId, int blockIndex) {
+    countStat(ProbeThrowHits);
+    TRACE3(TraceProbes, TraceProbeThrow, methodId, offset, blockIndex);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
     LOG(tout << "Track_Throw: method = " << methodId << ", offset = " << HEX(offset));
-    profilerState->coverageTracker->addCoverage(offset, Leave, methodId);
+    profilerState->coverageTracker->addCoverage(offset, Leave, methodId, blockIndex);
+}
+
+void vsharp::Track_CompareInt(INT64 left, INT64 right, OFFSET offset, int methodId, int kind) {
+    ProbeScope scope;
+    if (!scope.isActive()) return;
+    LOG(tout << "Track_CompareInt: method = " << methodId << ", offset = " << HEX(offset) << ", " << left << " ~ " << right);
+    ComparisonRecord record = {offset, methodId, static_cast<ComparisonKind>(kind), left, right};
+    profilerState->coverageTracker->addComparison(record);
+}
+
+void vsharp::Track_CompareString(UINT_PTR operand, OFFSET offset, int methodId, int literalId, int kind) {
+    ProbeScope scope;
+    if (!scope.isActive()) return;
+    LOG(tout << "Track_CompareString: method = " << methodId << ", offset = " << HEX(offset) << ", literal = " << literalId);
+    ComparisonRecord record = {offset, methodId, static_cast<ComparisonKind>(kind), literalId, -1};
+    if (operand != 0) {
+        // string objects start with the method table pointer followed by the length and the chars
+        INT32 length = *reinterpret_cast<INT32*>(operand + sizeof(UINT_PTR));
+        auto chars = reinterpret_cast<const WCHAR*>(operand + sizeof(UINT_PTR) + sizeof(INT32));
+        record.right = length;
+        std::copy(chars, chars + std::min(length, maxCapturedStringLength), record.operand);
+    }
+    profilerState->coverageTracker->addComparison(record);
+}
+
+void vsharp::Track_Path(int pathId, int methodId) {
+    countStat(ProbePathHits);
+    ProbeScope scope;
+    if (!scope.isActive()) return;
+    LOG(tout << "Track_Path: method = " << methodId << ", path = " << pathId);
+    profilerState->coverageTracker->addPath(methodId, pathId);
 }
 
 void vsharp::Finalize_Call(OFFSET offset) {
-    if (!profilerState->threadTracker->isCurrentThreadTracked()) return;
+    ProbeScope scope;
+    if (!scope.isActive()) return;
 }
 //endregion
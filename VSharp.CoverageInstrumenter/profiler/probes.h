@@ -9,6 +9,19 @@
 
 namespace vsharp {
 
+// which probes the rewriter inserts, every level includes the probes of the previous ones
+enum InstrumentationGranularity {
+    // enter and leave probes only, leaves are kept for the stack balance of the tracked threads
+    GranularityMethod,
+    // probes on the last instructions of the basic blocks: branches, instructions falling through to branch
+    // targets, throws, finally and filter ends, and the starts of the exception handlers
+    GranularityBlock,
+    // call return probes as well
+    GranularityEdge,
+    // static field store probes as well
+    GranularityFull
+};
+
 class ProbeCall {
     std::map<ThreadID, mdSignature> threadMapping;
     std::mutex threadMappingLock;
@@ -23,28 +36,35 @@ public:
 
 /// ------------------------------ Probes declarations ---------------------------
 
-void Track_Coverage(OFFSET offset, int methodId);
+void Track_Coverage(OFFSET offset, int methodId, int blockIndex);
 
-void Track_Stsfld(OFFSET offset, int methodId);
+void Track_Stsfld(OFFSET offset, int methodId, int blockIndex);
 
-void Branch(OFFSET offset, int methodId);
+void Branch(OFFSET offset, int methodId, int blockIndex);
 
-void Track_Call(OFFSET offset, int methodId);
+void Track_Call(OFFSET offset, int methodId, int blockIndex);
 
-void Track_Tailcall(OFFSET offset, int methodId);
+void Track_Tailcall(OFFSET offset, int methodId, int blockIndex);
 
 void Track_Enter(OFFSET offset, int methodId, int isSpontaneous);
 
 void Track_EnterMain(OFFSET offset, int methodId, int isSpontaneous);
 
-void Track_Leave(OFFSET offset, int methodId);
+void Track_Leave(OFFSET offset, int methodId, int blockIndex);
 
-void Track_LeaveMain(OFFSET offset, int methodId);
+void Track_LeaveMain(OFFSET offset, int methodId, int blockIndex);
 
-void Track_Throw(OFFSET offset, int methodId);
+void Track_Throw(OFFSET offset, int methodId, int blockIndex);
 
 void Finalize_Call(OFFSET offset);
 
+void Track_CompareInt(INT64 left, INT64 right, OFFSET offset, int methodId, int kind);
+
+// 'operand' is the address of the pinned runtime string, 0 if it is null
+void Track_CompareString(UINT_PTR operand, OFFSET offset, int methodId, int literalId, int kind);
+
+void Track_Path(int pathId, int methodId);
+
 struct CoverageProbes {
     ProbeCall* Coverage;
     ProbeCall* Stsfld;
@@ -57,11 +77,19 @@ struct CoverageProbes {
     ProbeCall* Call;
     ProbeCall* Tailcall;
     ProbeCall* Throw;
+    ProbeCall* CompareInt;
+    ProbeCall* CompareString;
+    ProbeCall* Path;
 };
 
 extern CoverageProbes coverageProbes;
 
 CoverageProbes* getProbes();
 void InitializeProbes();
+// probes are indexed in a fixed order, so the index identifies a probe across processes; -1 for unknown addresses
+int indexOfProbe(INT_PTR addr);
+ProbeCall* probeAt(int index);
+// waits for the probes running on all threads; the probes started after 'isFinished' is set do nothing
+void waitForProbes();
 }
 #endif // PROBES_H_
@@ -1,6 +1,17 @@
 #include "profilerState.h"
 #include "probes.h"
+#include "traceLog.h"
+#include "callingContextTree.h"
+#include "eventPipeExport.h"
+#include "profilerStats.h"
+#include "serialization.h"
+#include "sharedCoverageMap.h"
+#include "firstHitTable.h"
+#include "ilCache.h"
+#include <algorithm>
 #include <codecvt>
+#include <fstream>
+#include <limits>
 #include <locale>
 
 using namespace vsharp;
@@ -17,14 +28,36 @@ bool ProfilerState::isCorrectFunctionId(FunctionID id) {
     return incorrectFunctionId != id;
 }
 
-ProfilerState::ProfilerState(ICorProfilerInfo8 *corProfilerInfo) {
-    const char* isPassive = std::getenv("COVERAGE_TOOL_ENABLE_PASSIVE");
+ProfilerState::ProfilerState(ICorProfilerInfo8 *corProfilerInfo, std::map<std::string, std::string> settings_)
+    : settings(std::move(settings_)) {
+    const char* isPassive = setting("COVERAGE_TOOL_ENABLE_PASSIVE");
 
 #ifdef _LOGGING
     const char* name = isPassive == nullptr ? "lastrun.log" : "lastcoverage.log";
     open_log(name);
 #endif
 
+    const char* traceFile = setting("COVERAGE_TOOL_TRACE_FILE");
+    if (traceFile != nullptr) {
+        const char* traceMask = setting("COVERAGE_TOOL_TRACE_MASK");
+        // all categories except per-probe events are traced by default
+        UINT32 mask = ~TraceProbes;
+        if (traceMask != nullptr) {
+            char* end = nullptr;
+            unsigned long parsed = std::strtoul(traceMask, &end, 0);
+            if (end != traceMask && *end == '\0')
+                mask = (UINT32) parsed;
+            else
+                LOG_ERROR(tout << "Malformed COVERAGE_TOOL_TRACE_MASK " << traceMask << ", default mask is used");
+        }
+        traceLog.start(traceFile, mask);
+    }
+
+    const char* callingContextResult = setting("COVERAGE_TOOL_PROFILE_CCT");
+    if (callingContextResult != nullptr) {
+        callingContextProfiler.initialize(callingContextResult, setting("COVERAGE_TOOL_PROFILE_CCT_FORMAT"));
+    }
+
     InitializeProbes();
     if (isPassive != nullptr) {
         LOG(tout << "WORKING IN PASSIVE MODE" << std::endl);
@@ -35,50 +68,317 @@ ProfilerState::ProfilerState(ICorProfilerInfo8 *corProfilerInfo) {
         std::u16string assemblyNameU16;
         std::u16string moduleNameU16;
 
-        ConvertToWCHAR(std::getenv("COVERAGE_TOOL_METHOD_ASSEMBLY_NAME"), assemblyNameU16);
-        ConvertToWCHAR(std::getenv("COVERAGE_TOOL_METHOD_MODULE_NAME"), moduleNameU16);
-        int mainToken = std::stoi(std::getenv("COVERAGE_TOOL_METHOD_TOKEN"));
+        ConvertToWCHAR(setting("COVERAGE_TOOL_METHOD_ASSEMBLY_NAME"), assemblyNameU16);
+        ConvertToWCHAR(setting("COVERAGE_TOOL_METHOD_MODULE_NAME"), moduleNameU16);
+        int mainToken = std::stoi(setting("COVERAGE_TOOL_METHOD_TOKEN"));
 
-        size_t mainAssemblyNameLength = assemblyNameU16.size();
-        auto* mainAssemblyName = new WCHAR[mainAssemblyNameLength];
-        memcpy(mainAssemblyName, assemblyNameU16.data(), mainAssemblyNameLength * sizeof(WCHAR));
+        addEntryTarget(
+            (char*) assemblyNameU16.data(),
+            (int) assemblyNameU16.size(),
+            (char*) moduleNameU16.data(),
+            (int) moduleNameU16.size(),
+            mainToken);
+        passiveResultPath = setting("COVERAGE_TOOL_RESULT_NAME");
 
-        size_t mainModuleNameLength = moduleNameU16.size();
-        auto* mainModuleName = new WCHAR[mainModuleNameLength];
-        memcpy(mainModuleName, moduleNameU16.data(), mainModuleNameLength * sizeof(WCHAR));
+        if (setting("COVERAGE_TOOL_PERSISTENT")) {
+            LOG(tout << "Persistent passive mode, coverage is written per test");
+            isPersistentRun = true;
+            // test sections are appended to the result, so the previous one is dropped
+            std::ofstream fout(passiveResultPath, std::ios::out|std::ios::binary|std::ios::trunc);
+        }
+    }
+
+    const char* baselinePath = setting("COVERAGE_TOOL_BASELINE");
+    if (baselinePath != nullptr) {
+        coverageBaseline = new CoverageBaseline();
+        if (!coverageBaseline->load(baselinePath)) {
+            delete coverageBaseline;
+            coverageBaseline = nullptr;
+        }
+    }
+
+    // the file is created and sized by the process that runs the workers
+    const char* sharedMapPath = setting("COVERAGE_TOOL_SHARED_MAP");
+    if (sharedMapPath != nullptr) {
+        sharedCoverageMap.attach(sharedMapPath);
+    }
+
+    if (setting("COVERAGE_TOOL_CAPTURE_COMPARISONS")) {
+        captureComparisons = true;
+    }
+
+    if (setting("COVERAGE_TOOL_PROFILE_PATHS")) {
+        profilePaths = true;
+    }
+
+    const char* granularityName = setting("COVERAGE_TOOL_GRANULARITY");
+    if (granularityName != nullptr) {
+        if (strcmp(granularityName, "method") == 0) {
+            granularity = GranularityMethod;
+        } else if (strcmp(granularityName, "block") == 0) {
+            granularity = GranularityBlock;
+        } else if (strcmp(granularityName, "edge") == 0) {
+            granularity = GranularityEdge;
+        } else if (strcmp(granularityName, "full") != 0) {
+            LOG_ERROR(tout << "Unknown instrumentation granularity '" << granularityName << "', full is used");
+        }
+    }
+
+    const char* ilCachePath = setting("COVERAGE_TOOL_IL_CACHE");
+    if (ilCachePath != nullptr) {
+        ilCache.open(ilCachePath);
+    }
 
-        mainMethodInfo = {
-                (mdMethodDef) mainToken,
-                (ULONG) mainAssemblyNameLength,
-                mainAssemblyName,
-                (ULONG) mainModuleNameLength,
-                mainModuleName
-        };
-        passiveResultPath = std::getenv("COVERAGE_TOOL_RESULT_NAME");
+    if (setting("COVERAGE_TOOL_FIRST_HITS")) {
+        firstHitTable.enable();
     }
 
-    if (std::getenv("COVERAGE_TOOL_INSTRUMENT_MAIN_ONLY")) {
+    if (setting("COVERAGE_TOOL_INSTRUMENT_MAIN_ONLY")) {
         collectMainOnly = true;
     }
 
-    mainFunctionId = -1;
+    // ';'-separated assembly names, methods of these assemblies are instrumented along with the entry methods
+    const char* assemblies = setting("COVERAGE_TOOL_INSTRUMENT_ASSEMBLIES");
+    if (assemblies != nullptr) {
+        std::u16string names;
+        ConvertToWCHAR(assemblies, names);
+        size_t start = 0;
+        while (start <= names.size()) {
+            size_t end = std::min(names.find(u';', start), names.size());
+            if (end > start)
+                instrumentedAssemblies.push_back(names.substr(start, end - start));
+            start = end + 1;
+        }
+        collectMainOnly = false;
+    }
+
+    // limits are given in bytes of coverage records, unset limits mean no limit
+    const char* invocationLimit = setting("COVERAGE_TOOL_INVOCATION_MEMORY_LIMIT");
+    const char* processLimit = setting("COVERAGE_TOOL_PROCESS_MEMORY_LIMIT");
+    const char* overflowPolicy = setting("COVERAGE_TOOL_OVERFLOW_POLICY");
+    auto policy = OverflowStopRecording;
+    if (overflowPolicy != nullptr && strcmp(overflowPolicy, "counts") == 0) {
+        policy = OverflowHitCounts;
+    } else if (overflowPolicy != nullptr && strcmp(overflowPolicy, "ring") == 0) {
+        policy = OverflowRing;
+    }
+    auto coverageBudget = new CoverageBudget(
+        invocationLimit == nullptr ? 0 : std::max<size_t>(1, std::stoull(invocationLimit) / sizeof(CoverageRecord)),
+        processLimit == nullptr ? 0 : std::max<size_t>(1, std::stoull(processLimit) / sizeof(CoverageRecord)),
+        policy);
+
     threadInfo = new ThreadInfo(corProfilerInfo);
-    threadTracker = new ThreadTracker(threadInfo);
-    coverageTracker = new CoverageTracker(threadTracker, threadInfo, collectMainOnly);
+    // bytes of the stack an invocation may use before an overflow is predicted; unset or 0 disables the prediction
+    const char* stackLimitValue = setting("COVERAGE_TOOL_STACK_LIMIT");
+    UINT_PTR stackLimit = stackLimitValue == nullptr ? 0 : static_cast<UINT_PTR>(std::stoull(stackLimitValue));
+    if (stackLimit == 0)
+        stackLimit = std::numeric_limits<UINT_PTR>::max();
+    threadTracker = new ThreadTracker(threadInfo, stackLimit);
+    coverageTracker = new CoverageTracker(threadTracker, threadInfo, collectMainOnly, coverageBudget);
 }
 
-void vsharp::ProfilerState::setEntryMain(char *assemblyName, int assemblyNameLength, char *moduleName, int moduleNameLength, int methodToken) {
+const char* ProfilerState::setting(const char* name) const {
+    auto value = settings.find(name);
+    if (value != settings.end())
+        return value->second.c_str();
+    return std::getenv(name);
+}
+
+bool ProfilerState::isInstrumentedAssembly(const WCHAR* assemblyName) const {
+    if (instrumentedAssemblies.empty())
+        return true;
+    std::u16string name(reinterpret_cast<const char16_t*>(assemblyName));
+    return std::find(instrumentedAssemblies.begin(), instrumentedAssemblies.end(), name) != instrumentedAssemblies.end();
+}
+
+void ProfilerState::writeResult() {
+    if (isPersistentRun) {
+        // the last test may be interrupted by the process exit
+        endTest();
+        profilerStats.writeSidecar(std::string(passiveResultPath) + ".stats");
+    } else if (isPassiveRun) {
+        size_t size;
+        auto bytes = coverageTracker->serializeCoverageReport(&size);
+
+        std::ofstream fout;
+        fout.open(passiveResultPath, std::ios::out|std::ios::binary);
+        fout.write(bytes, static_cast<long>(size));
+        fout.close();
+        delete[] bytes;
+
+        profilerStats.writeSidecar(std::string(passiveResultPath) + ".stats");
+    }
+
+    callingContextProfiler.writeResult([this](int methodId) {
+        return coverageTracker->getMethodName(methodId);
+    });
+}
+
+//region EntryTargets
+int vsharp::ProfilerState::addEntryTarget(char *assemblyName, int assemblyNameLength, char *moduleName, int moduleNameLength, int methodToken) {
     auto* wcharAssemblyName = new WCHAR[assemblyNameLength];
     memcpy(wcharAssemblyName, assemblyName, assemblyNameLength * sizeof(WCHAR));
 
     auto* wcharModuleName = new WCHAR[moduleNameLength];
     memcpy(wcharModuleName, moduleName, moduleNameLength * sizeof(WCHAR));
 
-    mainMethodInfo = {
+    lockCounted(entryTargetsMutex);
+    int targetId = nextEntryTargetId++;
+    entryTargets[targetId] = {
             (mdMethodDef) methodToken,
             (ULONG) assemblyNameLength,
             wcharAssemblyName,
             (ULONG) moduleNameLength,
             wcharModuleName
     };
+    updateActiveEntryMethodsUnsafe();
+    entryTargetsMutex.unlock();
+    LOG(tout << "Entry target " << targetId << " added, token: " << methodToken);
+    return targetId;
+}
+
+bool vsharp::ProfilerState::removeEntryTarget(int targetId) {
+    lockCounted(entryTargetsMutex);
+    auto target = entryTargets.find(targetId);
+    bool found = target != entryTargets.end();
+    if (found) {
+        delete[] target->second.assemblyName;
+        delete[] target->second.moduleName;
+        entryTargets.erase(target);
+        updateActiveEntryMethodsUnsafe();
+    }
+    entryTargetsMutex.unlock();
+    LOG(tout << "Entry target " << targetId << (found ? " removed" : " was not registered"));
+    return found;
+}
+
+int vsharp::ProfilerState::setEntryMain(char *assemblyName, int assemblyNameLength, char *moduleName, int moduleNameLength, int methodToken) {
+    lockCounted(entryTargetsMutex);
+    for (auto& target : entryTargets) {
+        delete[] target.second.assemblyName;
+        delete[] target.second.moduleName;
+    }
+    entryTargets.clear();
+    entryTargetsMutex.unlock();
+    return addEntryTarget(assemblyName, assemblyNameLength, moduleName, moduleNameLength, methodToken);
+}
+
+int vsharp::ProfilerState::findEntryTargetUnsafe(const WCHAR *moduleName, int moduleSize, mdMethodDef method) {
+    // NOTE: decrementing 'moduleSize', because of null terminator
+    for (auto& target : entryTargets) {
+        auto& info = target.second;
+        if (info.moduleNameLength != moduleSize - 1 || info.token != method)
+            continue;
+        if (memcmp(info.moduleName, moduleName, info.moduleNameLength * sizeof(WCHAR)) == 0)
+            return target.first;
+    }
+    return -1;
+}
+
+void vsharp::ProfilerState::updateActiveEntryMethodsUnsafe() {
+    activeEntryMethods.clear();
+    for (auto& method : entryMethods) {
+        auto& info = method.second;
+        int targetId = findEntryTargetUnsafe(info.moduleName, (int) info.moduleNameLength, info.token);
+        if (targetId != -1)
+            activeEntryMethods[method.first] = targetId;
+    }
+}
+
+int vsharp::ProfilerState::findEntryTarget(const WCHAR *moduleName, int moduleSize, mdMethodDef method) {
+    lockCounted(entryTargetsMutex);
+    int targetId = findEntryTargetUnsafe(moduleName, moduleSize, method);
+    entryTargetsMutex.unlock();
+    return targetId;
+}
+
+void vsharp::ProfilerState::addEntryFunction(FunctionID functionId, ModuleID moduleId) {
+    lockCounted(entryTargetsMutex);
+    entryFunctionIds[functionId] = moduleId;
+    entryTargetsMutex.unlock();
+}
+
+void vsharp::ProfilerState::addEntryMethod(int methodId, const MethodInfo& info) {
+    lockCounted(entryTargetsMutex);
+    entryMethods[methodId] = info;
+    int targetId = findEntryTargetUnsafe(info.moduleName, (int) info.moduleNameLength, info.token);
+    if (targetId != -1)
+        activeEntryMethods[methodId] = targetId;
+    entryTargetsMutex.unlock();
+}
+
+bool vsharp::ProfilerState::isEntryFunction(FunctionID functionId) {
+    lockCounted(entryTargetsMutex);
+    bool result = entryFunctionIds.find(functionId) != entryFunctionIds.end();
+    entryTargetsMutex.unlock();
+    return result;
+}
+
+void vsharp::ProfilerState::unloadEntryModule(ModuleID moduleId, const std::vector<size_t>& methodIds) {
+    lockCounted(entryTargetsMutex);
+    for (auto function = entryFunctionIds.begin(); function != entryFunctionIds.end();) {
+        if (function->second == moduleId)
+            function = entryFunctionIds.erase(function);
+        else
+            ++function;
+    }
+    // the names of the methods are freed once they are archived
+    for (auto methodId : methodIds) {
+        entryMethods.erase(static_cast<int>(methodId));
+        activeEntryMethods.erase(static_cast<int>(methodId));
+    }
+    entryTargetsMutex.unlock();
+}
+
+int vsharp::ProfilerState::getEntryTarget(int methodId) {
+    lockCounted(entryTargetsMutex);
+    auto method = activeEntryMethods.find(methodId);
+    int targetId = method == activeEntryMethods.end() ? -1 : method->second;
+    entryTargetsMutex.unlock();
+    return targetId;
+}
+//endregion
+
+void vsharp::ProfilerState::beginTest(char *testName, int testNameLength) {
+    lockCounted(testsMutex);
+    if (isInTest) {
+        LOG(tout << "Test was not ended before the next one, ending it");
+        endTestUnsafe();
+    }
+    currentTestName.assign(reinterpret_cast<char16_t*>(testName), testNameLength);
+    isInTest = true;
+    testsMutex.unlock();
+}
+
+void vsharp::ProfilerState::endTest() {
+    lockCounted(testsMutex);
+    endTestUnsafe();
+    testsMutex.unlock();
+}
+
+// section layout: test name length, test name, report size, report
+void vsharp::ProfilerState::endTestUnsafe() {
+    if (!isInTest) return;
+    isInTest = false;
+    // the events of the test are written before the section which closes it
+    if (coverageEventPipe.isEnabled())
+        coverageEventPipe.flushAll();
+
+    size_t reportSize;
+    auto report = coverageTracker->serializeCoverageReport(&reportSize);
+    coverageTracker->clear();
+    threadTracker->clear();
+
+    auto header = std::vector<char>();
+    serializePrimitive(static_cast<int> (currentTestName.size()), header);
+    serializePrimitiveArray(currentTestName.data(), currentTestName.size(), header);
+    serializePrimitive(static_cast<int> (reportSize), header);
+
+    std::ofstream fout;
+    fout.open(passiveResultPath, std::ios::out|std::ios::binary|std::ios::app);
+    fout.write(header.data(), static_cast<long>(header.size()));
+    fout.write(report, static_cast<long>(reportSize));
+    fout.close();
+    delete[] report;
+    LOG(tout << "Test coverage section written, report size: " << reportSize);
 }
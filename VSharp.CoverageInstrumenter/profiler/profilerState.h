@@ -3,29 +3,81 @@
 
 #include "threadTracker.h"
 #include "coverageTracker.h"
+#include "coverageBaseline.h"
+#include "probes.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
 
 namespace vsharp {
 
 class ProfilerState {
 private:
     static const FunctionID incorrectFunctionId = 0;
+    std::mutex testsMutex;
+    bool isInTest = false;
+    std::u16string currentTestName;
+
+    // entry targets by target id, a process may fuzz many of them at once
+    std::mutex entryTargetsMutex;
+    int nextEntryTargetId = 0;
+    std::map<int, MethodInfo> entryTargets;
+    // methods instrumented as entries by coverage method id; they stay instrumented after their target is removed
+    std::map<int, MethodInfo> entryMethods;
+    // coverage method id -> target id, only for methods of the registered targets
+    std::map<int, int> activeEntryMethods;
+    // function id -> module id, function ids are reused by the runtime after their module is unloaded
+    std::map<FunctionID, ModuleID> entryFunctionIds;
+    // simple names of the assemblies to instrument besides the entry methods, empty means all
+    std::vector<std::u16string> instrumentedAssemblies;
+    // given with the attach request instead of the environment of the process
+    std::map<std::string, std::string> settings;
+
+    void endTestUnsafe();
+    int findEntryTargetUnsafe(const WCHAR *moduleName, int moduleSize, mdMethodDef method);
+    void updateActiveEntryMethodsUnsafe();
 public:
     ThreadTracker* threadTracker;
     CoverageTracker* coverageTracker;
+    CoverageBaseline* coverageBaseline = nullptr;
     ThreadInfo* threadInfo;
 
     bool isPassiveRun = false;
+    // passive run of many tests in one process, the result file gets a coverage section per test
+    bool isPersistentRun = false;
     bool collectMainOnly = true;
-    bool isFinished = false;
-    char *passiveResultPath = nullptr;
-    MethodInfo mainMethodInfo;
-    FunctionID mainFunctionId;
+    std::atomic<bool> isFinished {false};
+    bool captureComparisons = false;
+    bool profilePaths = false;
+    InstrumentationGranularity granularity = GranularityFull;
+    const char *passiveResultPath = nullptr;
 
     bool isCorrectFunctionId(FunctionID id);
+    bool isInstrumentedAssembly(const WCHAR* assemblyName) const;
+    // returns the attach setting or the environment variable, nullptr if neither is set
+    const char* setting(const char* name) const;
+    // writes the report of the passive run and the calling context tree to their result files
+    void writeResult();
 
-    void setEntryMain(char* assemblyName, int assemblyNameLength, char* moduleName, int moduleNameLength, int methodToken);
+    int addEntryTarget(char* assemblyName, int assemblyNameLength, char* moduleName, int moduleNameLength, int methodToken);
+    bool removeEntryTarget(int targetId);
+    // replaces all entry targets with the given one
+    int setEntryMain(char* assemblyName, int assemblyNameLength, char* moduleName, int moduleNameLength, int methodToken);
+    // returns the target id or -1; 'moduleSize' includes the null terminator
+    int findEntryTarget(const WCHAR *moduleName, int moduleSize, mdMethodDef method);
+    void addEntryFunction(FunctionID functionId, ModuleID moduleId);
+    void addEntryMethod(int methodId, const MethodInfo& info);
+    bool isEntryFunction(FunctionID functionId);
+    // forgets the entry functions and methods of the module, the targets stay registered
+    void unloadEntryModule(ModuleID moduleId, const std::vector<size_t>& methodIds);
+    // returns the target id of the instrumented entry method or -1 if its target was removed
+    int getEntryTarget(int methodId);
+    void beginTest(char* testName, int testNameLength);
+    void endTest();
 
-    explicit ProfilerState(ICorProfilerInfo8 *corProfilerInfo);
+    // 'settings' take precedence over the environment
+    explicit ProfilerState(ICorProfilerInfo8 *corProfilerInfo, std::map<std::string, std::string> settings = {});
 };
 
 extern ProfilerState* profilerState;
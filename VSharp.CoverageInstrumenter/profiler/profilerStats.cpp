@@ -0,0 +1,99 @@
+#include "profilerStats.h"
+#include "logging.h"
+#include <cstring>
+#include "serialization.h"
+#include <fstream>
+
+using namespace vsharp;
+
+static const char* counterNames[CountersCount] = {
+    "methods_instrumented",
+    "instrument_ns",
+    "rewrite_ns",
+    "il_bytes_added",
+    "probe_coverage",
+    "probe_stsfld",
+    "probe_branch",
+    "probe_call",
+    "probe_tailcall",
+    "probe_enter",
+    "probe_enter_main",
+    "probe_leave",
+    "probe_leave_main",
+    "probe_throw",
+    "probe_path",
+    "records_produced",
+    "report_bytes_produced",
+    "reports_serialized",
+    "serialize_ns",
+    "lock_contentions",
+    "coverage_overflows",
+    "baseline_probes_skipped",
+    "eventpipe_batches_written",
+    "shared_map_new_edges",
+    "path_profiled_methods",
+    "modules_unloaded",
+    "il_cache_hits",
+    "il_cache_misses",
+    "stack_overflows_predicted"
+};
+
+ProfilerStats vsharp::profilerStats;
+
+static thread_local ThreadCounters* threadCounters = nullptr;
+
+ThreadCounters::ThreadCounters() {
+    for (auto& value : values) {
+        value.store(0, std::memory_order_relaxed);
+    }
+}
+
+ThreadCounters* vsharp::currentThreadCounters() {
+    if (threadCounters == nullptr) {
+        threadCounters = profilerStats.registerThread();
+    }
+    return threadCounters;
+}
+
+ThreadCounters* ProfilerStats::registerThread() {
+    // counters of finished threads are kept, so their values stay in the totals
+    auto counters = new ThreadCounters();
+    threadCountersMutex.lock();
+    threadCounters.push_back(counters);
+    threadCountersMutex.unlock();
+    return counters;
+}
+
+std::vector<UINT64> ProfilerStats::aggregate() {
+    auto result = std::vector<UINT64>(CountersCount, 0);
+    threadCountersMutex.lock();
+    for (auto counters : threadCounters) {
+        for (int i = 0; i < CountersCount; i++) {
+            result[i] += counters->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    threadCountersMutex.unlock();
+    return result;
+}
+
+void ProfilerStats::serialize(std::vector<char>& buffer) {
+    auto values = aggregate();
+    serializePrimitive(static_cast<int> (CountersCount), buffer);
+    for (int i = 0; i < CountersCount; i++) {
+        auto nameLength = std::strlen(counterNames[i]);
+        serializePrimitive(static_cast<int> (nameLength), buffer);
+        serializePrimitiveArray(counterNames[i], nameLength, buffer);
+        serializePrimitive(values[i], buffer);
+    }
+}
+
+void ProfilerStats::writeSidecar(const std::string& path) {
+    auto values = aggregate();
+    std::ofstream fout;
+    fout.open(path, std::ios::out);
+    for (int i = 0; i < CountersCount; i++) {
+        fout << counterNames[i] << " " << values[i] << "\n";
+    }
+    fout.close();
+    LOG(tout << "Profiler stats written to " << path);
+}
@@ -0,0 +1,97 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_PROFILERSTATS_H
+#define VSHARP_COVERAGEINSTRUMENTER_PROFILERSTATS_H
+
+#include "cor.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vsharp {
+
+enum ProfilerCounter {
+    MethodsInstrumented,
+    InstrumentNanoseconds,
+    RewriteNanoseconds,
+    ILBytesAdded,
+    ProbeCoverageHits,
+    ProbeStsfldHits,
+    ProbeBranchHits,
+    ProbeCallHits,
+    ProbeTailcallHits,
+    ProbeEnterHits,
+    ProbeEnterMainHits,
+    ProbeLeaveHits,
+    ProbeLeaveMainHits,
+    ProbeThrowHits,
+    ProbePathHits,
+    RecordsProduced,
+    ReportBytesProduced,
+    ReportsSerialized,
+    SerializeNanoseconds,
+    LockContentions,
+    CoverageOverflows,
+    BaselineProbesSkipped,
+    EventPipeBatchesWritten,
+    SharedMapNewEdges,
+    PathProfiledMethods,
+    ModulesUnloaded,
+    ILCacheHits,
+    ILCacheMisses,
+    StackOverflowsPredicted,
+    CountersCount
+};
+
+// Counters are owned by a single thread, so they are updated without read-modify-write instructions
+struct ThreadCounters {
+    std::atomic<UINT64> values[CountersCount];
+
+    ThreadCounters();
+};
+
+class ProfilerStats {
+private:
+    std::mutex threadCountersMutex;
+    std::vector<ThreadCounters*> threadCounters;
+public:
+    ThreadCounters* registerThread();
+    std::vector<UINT64> aggregate();
+    void serialize(std::vector<char>& buffer);
+    void writeSidecar(const std::string& path);
+};
+
+extern ProfilerStats profilerStats;
+
+ThreadCounters* currentThreadCounters();
+
+inline void countStat(ProfilerCounter counter, UINT64 value = 1) {
+    auto& slot = currentThreadCounters()->values[counter];
+    slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// Acquires the mutex, counting the acquisitions which had to wait for another thread
+template <typename Mutex> void lockCounted(Mutex& mutex) {
+    if (!mutex.try_lock()) {
+        countStat(LockContentions);
+        mutex.lock();
+    }
+}
+
+class StatTimer {
+private:
+    ProfilerCounter counter;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit StatTimer(ProfilerCounter counter_)
+        : counter(counter_), start(std::chrono::steady_clock::now()) {}
+
+    ~StatTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        countStat(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_PROFILERSTATS_H
@@ -0,0 +1,88 @@
+#include "sharedCoverageMap.h"
+#include "logging.h"
+#include "os.h"
+#include "profilerStats.h"
+
+using namespace vsharp;
+
+SharedCoverageMap vsharp::sharedCoverageMap;
+
+const size_t SharedCoverageMap::methodsChunkSize;
+const size_t SharedCoverageMap::maxMethodsChunks;
+
+static const UINT64 fnvOffset = 14695981039346656037ULL;
+static const UINT64 fnvPrime = 1099511628211ULL;
+
+static UINT64 mix(UINT64 value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return value;
+}
+
+bool SharedCoverageMap::attach(const char* path) {
+    size_t size;
+    auto memory = OS::mapSharedFile(path, &size);
+    if (memory == nullptr) {
+        LOG_ERROR(tout << "Failed to map the shared coverage map " << path);
+        return false;
+    }
+    if (size < sizeof(UINT64) || (size & (size - 1)) != 0) {
+        LOG_ERROR(tout << "Shared coverage map size must be a power of two, got " << size);
+        OS::unmapFile(memory, size);
+        return false;
+    }
+    words = reinterpret_cast<std::atomic<UINT64>*>(memory);
+    wordsMask = size / sizeof(UINT64) - 1;
+    LOG(tout << "Attached to the shared coverage map " << path << " of " << size << " bytes");
+    return true;
+}
+
+void SharedCoverageMap::registerMethod(int methodId, const WCHAR* moduleName, ULONG moduleNameLength, mdMethodDef token) {
+    size_t chunk = static_cast<size_t>(methodId) / methodsChunkSize;
+    if (chunk >= maxMethodsChunks) return;
+    auto hashes = methodHashes[chunk].load(std::memory_order_acquire);
+    if (hashes == nullptr) {
+        // methods are registered under the instrumenter lock, so the chunk has a single writer
+        hashes = new UINT64[methodsChunkSize]();
+        methodHashes[chunk].store(hashes, std::memory_order_release);
+    }
+
+    // workers may load the module from different directories, so only the file name is hashed
+    ULONG start = 0;
+    for (ULONG i = 0; i < moduleNameLength && moduleName[i] != 0; i++) {
+        if (moduleName[i] == '/' || moduleName[i] == '\\')
+            start = i + 1;
+    }
+    UINT64 hash = fnvOffset;
+    for (ULONG i = start; i < moduleNameLength && moduleName[i] != 0; i++) {
+        hash = (hash ^ static_cast<UINT64>(moduleName[i])) * fnvPrime;
+    }
+    hash = (hash ^ token) * fnvPrime;
+    hashes[methodId % methodsChunkSize] = hash;
+}
+
+UINT64 SharedCoverageMap::hit(int methodId, OFFSET offset, UINT64 previousSite) {
+    size_t chunk = static_cast<size_t>(methodId) / methodsChunkSize;
+    auto hashes = chunk < maxMethodsChunks ? methodHashes[chunk].load(std::memory_order_acquire) : nullptr;
+    if (hashes == nullptr) return previousSite;
+
+    UINT64 site = mix(hashes[methodId % methodsChunkSize] ^ offset);
+    UINT64 edge = site ^ previousSite;
+    auto& word = words[(edge >> 6) & wordsMask];
+    UINT64 bit = static_cast<UINT64>(1) << (edge & 63);
+    // the plain load keeps the cache line shared while no new edges are found
+    if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+        UINT64 previous = word.fetch_or(bit, std::memory_order_relaxed);
+        if ((previous & bit) == 0) {
+            newEdges.fetch_add(1, std::memory_order_relaxed);
+            countStat(SharedMapNewEdges);
+        }
+    }
+    // shifted, so the edges A->B and B->A differ
+    return site >> 1;
+}
+
+UINT64 SharedCoverageMap::takeNewEdges() {
+    return newEdges.exchange(0, std::memory_order_relaxed);
+}
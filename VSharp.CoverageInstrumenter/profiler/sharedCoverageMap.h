@@ -0,0 +1,42 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_SHAREDCOVERAGEMAP_H
+#define VSHARP_COVERAGEINSTRUMENTER_SHAREDCOVERAGEMAP_H
+
+#include "cor.h"
+#include "memory.h"
+#include <atomic>
+
+namespace vsharp {
+
+// Edge bitmap shared by the processes that map the same file, e.g. parallel fuzzing workers.
+// An edge is a pair of consecutive probe sites of a thread, so its index is stable across processes
+class SharedCoverageMap {
+private:
+    static const size_t methodsChunkSize = 1024;
+    static const size_t maxMethodsChunks = 4096;
+
+    std::atomic<UINT64>* words = nullptr;
+    size_t wordsMask = 0;
+    std::atomic<UINT64> newEdges {0};
+    // methodId -> hash of (module file name, token); chunks are never moved, so probes read them without locks
+    std::atomic<UINT64*> methodHashes[maxMethodsChunks] {};
+public:
+    // the file size must be a power of two bytes, at least 8
+    bool attach(const char* path);
+
+    bool isAttached() const {
+        return words != nullptr;
+    }
+
+    // called once per method before its code runs
+    void registerMethod(int methodId, const WCHAR* moduleName, ULONG moduleNameLength, mdMethodDef token);
+    // marks the edge from 'previousSite' and returns the value to pass for the next site of the thread
+    UINT64 hit(int methodId, OFFSET offset, UINT64 previousSite);
+    // edges first hit by this process since the last call
+    UINT64 takeNewEdges();
+};
+
+extern SharedCoverageMap sharedCoverageMap;
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_SHAREDCOVERAGEMAP_H
@@ -8,6 +8,7 @@
 #include <map>
 #include <vector>
 #include "threadInfo.h"
+#include "profilerStats.h"
 
 
 template <typename T> class ThreadStorage {
@@ -29,7 +30,7 @@ public:
 
     void store(T data) {
         ThreadID thread = threadInfo->getCurrentThread();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         profiler_assert(!exist_(thread));
         innerStorage[thread] = data;
         innerStorageLock.unlock();
@@ -37,14 +38,14 @@ public:
 
     void storeOrUpdate(T data) {
         ThreadID thread = threadInfo->getCurrentThread();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         innerStorage[thread] = data;
         innerStorageLock.unlock();
     }
 
     T load() {
         ThreadID thread = threadInfo->getCurrentThread();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         profiler_assert(exist_(thread));
         T result = innerStorage[thread];
         innerStorageLock.unlock();
@@ -53,7 +54,7 @@ public:
 
     T update(T (*f)(T)) {
         ThreadID thread = threadInfo->getCurrentThread();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         profiler_assert(exist_(thread));
         auto result = f(innerStorage[thread]);
         innerStorage[thread] = result;
@@ -62,7 +63,7 @@ public:
     }
 
     size_t size() {
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         auto result = innerStorage.size();
         innerStorageLock.unlock();
         return result;
@@ -70,7 +71,7 @@ public:
 
     bool exist() {
         ThreadID thread = threadInfo->getCurrentThread();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         auto e = innerStorage.find(thread);
         auto result = e != innerStorage.end();
         innerStorageLock.unlock();
@@ -79,21 +80,21 @@ public:
 
     void remove() {
         ThreadID thread = threadInfo->getCurrentThread();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         profiler_assert(exist_(thread));
         innerStorage.erase(thread);
         innerStorageLock.unlock();
     }
 
     void clear() {
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         innerStorage.clear();
         innerStorageLock.unlock();
     }
 
     std::vector<std::pair<ThreadID, T>> items() {
         auto result = std::vector<std::pair<ThreadID, T>>();
-        innerStorageLock.lock();
+        vsharp::lockCounted(innerStorageLock);
         for (auto e: innerStorage) {
             result.emplace_back(e.first, e.second);
         }
@@ -1,12 +1,26 @@
 #include "threadTracker.h"
 #include "profilerState.h"
+#include "traceLog.h"
+#include "callingContextTree.h"
+#include <algorithm>
 
 using namespace vsharp;
 
-void ThreadTracker::trackCurrentThread() {
+// checked on every enter, so kept out of the locked thread storages; 0 while the thread is not tracked
+static thread_local UINT_PTR stackBottom = 0;
+// marked by the harness for the next invocation of the thread
+static thread_local UINT_PTR markedStackBottom = 0;
+static thread_local bool stackOverflowReported = false;
+
+void ThreadTracker::trackCurrentThread(UINT_PTR stackPointer) {
     LOG(tout << "<<Thread tracked>>");
+    TRACE0(TraceThreads, TraceThreadTracked);
     stackBalances->store(0);
     inFilterMapping->store(0);
+    // the bottom of the previous invocation of a reused thread is not kept
+    stackBottom = std::max(stackPointer, markedStackBottom);
+    markedStackBottom = 0;
+    stackOverflowReported = false;
 }
 
 void ThreadTracker::stackBalanceUp() {
@@ -39,6 +53,7 @@ bool ThreadTracker::isCurrentThreadTracked() {
 }
 
 void ThreadTracker::onCurrentThreadFinished() {
+    stackBottom = 0;
     profilerState->coverageTracker->invocationFinished();
     stackBalances->remove();
     inFilterMapping->remove();
@@ -52,11 +67,13 @@ void ThreadTracker::loseCurrentThread() {
     profiler_assert(stackBalances->load() == 0);
     profiler_assert(inFilterMapping->load() == 0);
     LOG(tout << "<<Thread lost>>" << std::endl);
+    TRACE0(TraceThreads, TraceThreadLost);
     onCurrentThreadFinished();
 }
 
 void ThreadTracker::abortCurrentThread() {
     LOG(tout << "<<Thread aborted>>" << std::endl);
+    TRACE0(TraceThreads, TraceThreadAborted);
     onCurrentThreadFinished();
 }
 
@@ -72,10 +89,14 @@ void ThreadTracker::unwindFunctionLeave() {
     LOG(tout << "Unwind leave" << std::endl);
     auto functionId = unwindFunctionIds->load();
     unwindFunctionIds->remove();
-    if (profilerState->collectMainOnly && profilerState->mainFunctionId != functionId) return;
-    if ((!isInFilter() || stackBalance() > 1) && !stackBalanceDown()) {
-        // stack is empty; function left
-        loseCurrentThread();
+    if (profilerState->collectMainOnly && !profilerState->isEntryFunction(functionId)) return;
+    if (!isInFilter() || stackBalance() > 1) {
+        if (callingContextProfiler.isEnabled())
+            callingContextProfiler.leave();
+        if (!stackBalanceDown()) {
+            // stack is empty; function left
+            loseCurrentThread();
+        }
     }
 }
 
@@ -121,13 +142,45 @@ void ThreadTracker::clear() {
     stackBalances->clear();
     unwindFunctionIds->clear();
     inFilterMapping->clear();
+    // the predicted invocations are dropped along with the threads
+    lockCounted(predictionsLock);
+    predictedOverflows.clear();
+    predictionsLock.unlock();
+}
+
+void ThreadTracker::markStackBottom(UINT_PTR stackPointer) {
+    markedStackBottom = stackPointer;
+}
+
+bool ThreadTracker::isPossibleStackOverflow(UINT_PTR stackPointer) {
+    // the stack grows down; threads, which entered no main, have no bottom
+    return stackBottom != 0 && stackBottom > stackPointer && stackBottom - stackPointer > stackLimit;
 }
 
-bool ThreadTracker::isPossibleStackOverflow() {
-    return false;
+bool ThreadTracker::reportStackOverflow() {
+    if (stackOverflowReported) return false;
+    stackOverflowReported = true;
+    if (hasMapping()) {
+        int mappedId = getCurrentThreadMappedId();
+        lockCounted(predictionsLock);
+        predictedOverflows.push_back(mappedId);
+        predictionsLock.unlock();
+    }
+    return true;
+}
+
+int ThreadTracker::takeStackOverflowPrediction() {
+    int mappedId = -1;
+    lockCounted(predictionsLock);
+    if (!predictedOverflows.empty()) {
+        mappedId = predictedOverflows.back();
+        predictedOverflows.pop_back();
+    }
+    predictionsLock.unlock();
+    return mappedId;
 }
 
-ThreadTracker::ThreadTracker(ThreadInfo *threadInfo) {
+ThreadTracker::ThreadTracker(ThreadInfo *threadInfo, UINT_PTR stackLimit) : stackLimit(stackLimit) {
     threadIdMapping = new ThreadStorage<int>(threadInfo);
     stackBalances = new ThreadStorage<int>(threadInfo);
     unwindFunctionIds = new ThreadStorage<FunctionID>(threadInfo);
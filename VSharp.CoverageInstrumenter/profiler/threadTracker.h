@@ -2,6 +2,8 @@
 #define VSHARP_COVERAGEINSTRUMENTER_THREADTRACKER_H
 
 #include "threadStorage.h"
+#include <mutex>
+#include <vector>
 
 namespace vsharp {
 
@@ -11,6 +13,11 @@ private:
     ThreadStorage<int>* stackBalances;
     ThreadStorage<FunctionID>* unwindFunctionIds;
     ThreadStorage<int>* inFilterMapping;
+    // distance in bytes from the stack bottom after which an overflow is predicted
+    UINT_PTR stackLimit;
+    // mapped ids of the threads, whose running invocations are predicted to overflow
+    std::mutex predictionsLock;
+    std::vector<int> predictedOverflows;
 
     void onCurrentThreadFinished();
 public:
@@ -19,7 +26,9 @@ public:
     int getCurrentThreadMappedId();
     std::vector<std::pair<ThreadID, int>> getMapping();
     bool isCurrentThreadTracked();
-    void trackCurrentThread();
+    // 'stackPointer' is an address on the stack of the entered main, the bottom of the invocation
+    // unless the harness marked a higher one
+    void trackCurrentThread(UINT_PTR stackPointer);
     void loseCurrentThread();
     void abortCurrentThread();
     // returns 'true' if the stack is not empty
@@ -35,9 +44,16 @@ public:
     void filterLeave();
     bool isInFilter();
 
-    bool isPossibleStackOverflow();
+    // 'stackPointer' is an address on the current stack, the bottom of the next invocation of the thread
+    void markStackBottom(UINT_PTR stackPointer);
+    bool isPossibleStackOverflow(UINT_PTR stackPointer);
+    // returns 'true' only for the first prediction of the current invocation; the prediction
+    // of a mapped thread is also queued for 'takeStackOverflowPrediction'
+    bool reportStackOverflow();
+    // returns the mapped id of a thread predicted to overflow, or -1 if there are none
+    int takeStackOverflowPrediction();
 
-    explicit ThreadTracker(ThreadInfo* threadInfo);
+    ThreadTracker(ThreadInfo* threadInfo, UINT_PTR stackLimit);
 };
 
 }
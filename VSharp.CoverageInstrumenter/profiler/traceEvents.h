@@ -0,0 +1,65 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_TRACEEVENTS_H
+#define VSHARP_COVERAGEINSTRUMENTER_TRACEEVENTS_H
+
+#include <cstdint>
+
+// Shared by the profiler and the offline trace decoder, so it must not depend on PAL headers
+
+#define TRACE_FILE_MAGIC 0x45434152545356ULL // "VSTRACE"
+#define TRACE_FILE_VERSION 1
+#define TRACE_EVENT_ARGS 3
+
+namespace vsharp {
+
+enum TraceCategory : uint32_t {
+    TraceProbes = 1,
+    TraceThreads = 2,
+    TraceInstrumentation = 4,
+    TraceReports = 8
+};
+
+// X(id, category, argument names)
+#define TRACE_EVENTS(X) \
+    X(ProbeCoverage, TraceProbes, "method offset block") \
+    X(ProbeStsfld, TraceProbes, "method offset block") \
+    X(ProbeBranch, TraceProbes, "method offset block") \
+    X(ProbeCall, TraceProbes, "method offset block") \
+    X(ProbeTailcall, TraceProbes, "method offset block") \
+    X(ProbeEnter, TraceProbes, "method offset") \
+    X(ProbeEnterMain, TraceProbes, "method offset") \
+    X(ProbeLeave, TraceProbes, "method offset block") \
+    X(ProbeLeaveMain, TraceProbes, "method offset block") \
+    X(ProbeThrow, TraceProbes, "method offset block") \
+    X(ThreadTracked, TraceThreads, "") \
+    X(ThreadLost, TraceThreads, "") \
+    X(ThreadAborted, TraceThreads, "") \
+    X(MethodInstrumented, TraceInstrumentation, "method token module") \
+    X(ReportSerialized, TraceReports, "bytes threads") \
+    X(EventsDropped, TraceReports, "count") \
+    X(CoverageOverflow, TraceReports, "method records") \
+    X(ModuleUnloaded, TraceInstrumentation, "module methods")
+
+#define TRACE_EVENT_ENUM(id, category, args) Trace##id,
+enum TraceEventId : uint32_t {
+    TRACE_EVENTS(TRACE_EVENT_ENUM)
+    TraceEventsCount
+};
+#undef TRACE_EVENT_ENUM
+
+struct TraceRecord {
+    uint64_t timestamp;
+    uint64_t thread;
+    uint32_t eventId;
+    uint32_t argCount;
+    uint64_t args[TRACE_EVENT_ARGS];
+};
+
+struct TraceFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_TRACEEVENTS_H
@@ -0,0 +1,153 @@
+#include "traceLog.h"
+#include "logging.h"
+#include <chrono>
+
+using namespace vsharp;
+
+TraceLog vsharp::traceLog;
+
+namespace {
+
+// marks the ring of an exited thread, so the drain thread can free it after the last drain
+struct ThreadTraceRing {
+    TraceRing* ring = nullptr;
+
+    ~ThreadTraceRing() {
+        if (ring != nullptr)
+            ring->orphaned.store(true, std::memory_order_release);
+    }
+};
+
+thread_local ThreadTraceRing threadTraceRing;
+thread_local UINT64 threadTraceId = 0;
+
+}
+
+//region TraceRing
+bool TraceRing::push(const TraceRecord& record) {
+    auto currentHead = head.load(std::memory_order_relaxed);
+    if (currentHead - tail.load(std::memory_order_acquire) == capacity) {
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    records[currentHead % capacity] = record;
+    head.store(currentHead + 1, std::memory_order_release);
+    return true;
+}
+
+size_t TraceRing::drain(FILE* file) {
+    auto currentTail = tail.load(std::memory_order_relaxed);
+    auto currentHead = head.load(std::memory_order_acquire);
+    auto count = currentHead - currentTail;
+    while (currentTail != currentHead) {
+        // writing contiguous chunks up to the end of the buffer
+        auto start = currentTail % capacity;
+        auto chunk = std::min(currentHead - currentTail, capacity - start);
+        std::fwrite(&records[start], sizeof(TraceRecord), chunk, file);
+        currentTail += chunk;
+    }
+    tail.store(currentTail, std::memory_order_release);
+    return count;
+}
+//endregion
+
+//region TraceLog
+TraceLog::~TraceLog() {
+    stop();
+}
+
+void TraceLog::start(const char* path, UINT32 mask_) {
+    file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        LOG(tout << "Failed to open trace file " << path);
+        return;
+    }
+    TraceFileHeader header = { TRACE_FILE_MAGIC, TRACE_FILE_VERSION, sizeof(TraceRecord) };
+    std::fwrite(&header, sizeof(header), 1, file);
+    drainThread = std::thread(&TraceLog::drainLoop, this);
+    mask.store(mask_, std::memory_order_relaxed);
+    LOG(tout << "Trace log started with mask " << HEX(mask_));
+}
+
+void TraceLog::stop() {
+    if (file == nullptr) return;
+    mask.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(drainMutex);
+        stopRequested = true;
+    }
+    drainWakeup.notify_one();
+    drainThread.join();
+    drainAll();
+    std::fclose(file);
+    file = nullptr;
+}
+
+void TraceLog::setMask(UINT32 mask_) {
+    // events can be enabled only while the drain thread is running
+    if (file != nullptr)
+        mask.store(mask_, std::memory_order_relaxed);
+}
+
+TraceRing* TraceLog::registerThread() {
+    auto ring = new TraceRing();
+    ringsMutex.lock();
+    rings.push_back(ring);
+    ringsMutex.unlock();
+    return ring;
+}
+
+void TraceLog::drainAll() {
+    ringsMutex.lock();
+    UINT64 dropped = 0;
+    for (auto it = rings.begin(); it != rings.end();) {
+        auto ring = *it;
+        // reading the flag before draining, so no records pushed before the thread exit are lost
+        bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+        ring->drain(file);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (orphaned) {
+            delete ring;
+            it = rings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    ringsMutex.unlock();
+    if (dropped > 0) {
+        TraceRecord record = {};
+        record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        record.eventId = TraceEventsDropped;
+        record.argCount = 1;
+        record.args[0] = dropped;
+        std::fwrite(&record, sizeof(record), 1, file);
+    }
+    std::fflush(file);
+}
+
+void TraceLog::drainLoop() {
+    std::unique_lock<std::mutex> lock(drainMutex);
+    while (!stopRequested) {
+        drainWakeup.wait_for(lock, std::chrono::milliseconds(10));
+        drainAll();
+    }
+}
+//endregion
+
+void vsharp::traceEvent(TraceEventId id, UINT32 argCount, UINT64 arg0, UINT64 arg1, UINT64 arg2) {
+    if (threadTraceRing.ring == nullptr) {
+        threadTraceRing.ring = traceLog.registerThread();
+        threadTraceId = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    }
+    TraceRecord record;
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    record.thread = threadTraceId;
+    record.eventId = id;
+    record.argCount = argCount;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.args[2] = arg2;
+    threadTraceRing.ring->push(record);
+}
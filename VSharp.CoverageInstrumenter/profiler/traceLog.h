@@ -0,0 +1,73 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_TRACELOG_H
+#define VSHARP_COVERAGEINSTRUMENTER_TRACELOG_H
+
+#include "cor.h"
+#include "traceEvents.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vsharp {
+
+// Single-producer single-consumer ring: only the owning thread writes, only the drain thread reads
+class TraceRing {
+private:
+    static const size_t capacity = 4096;
+    TraceRecord records[capacity];
+    std::atomic<size_t> head {0};
+    std::atomic<size_t> tail {0};
+public:
+    std::atomic<UINT64> dropped {0};
+    std::atomic<bool> orphaned {false};
+
+    bool push(const TraceRecord& record);
+    // returns the number of drained records
+    size_t drain(FILE* file);
+};
+
+class TraceLog {
+private:
+    std::atomic<UINT32> mask {0};
+    FILE* file = nullptr;
+    std::mutex ringsMutex;
+    std::vector<TraceRing*> rings;
+    std::thread drainThread;
+    std::mutex drainMutex;
+    std::condition_variable drainWakeup;
+    bool stopRequested = false;
+
+    void drainLoop();
+    void drainAll();
+public:
+    // the drain thread is joined on process exit if the profiler was not shut down
+    ~TraceLog();
+
+    void start(const char* path, UINT32 mask);
+    void stop();
+    TraceRing* registerThread();
+    void setMask(UINT32 mask);
+
+    bool isEnabled(TraceCategory category) const {
+        return (mask.load(std::memory_order_relaxed) & category) != 0;
+    }
+};
+
+extern TraceLog traceLog;
+
+void traceEvent(TraceEventId id, UINT32 argCount, UINT64 arg0, UINT64 arg1, UINT64 arg2);
+
+}
+
+#define TRACE0(CATEGORY, ID) \
+    do { if (vsharp::traceLog.isEnabled(CATEGORY)) vsharp::traceEvent(ID, 0, 0, 0, 0); } while (0)
+#define TRACE1(CATEGORY, ID, A0) \
+    do { if (vsharp::traceLog.isEnabled(CATEGORY)) vsharp::traceEvent(ID, 1, (UINT64) (A0), 0, 0); } while (0)
+#define TRACE2(CATEGORY, ID, A0, A1) \
+    do { if (vsharp::traceLog.isEnabled(CATEGORY)) vsharp::traceEvent(ID, 2, (UINT64) (A0), (UINT64) (A1), 0); } while (0)
+#define TRACE3(CATEGORY, ID, A0, A1, A2) \
+    do { if (vsharp::traceLog.isEnabled(CATEGORY)) vsharp::traceEvent(ID, 3, (UINT64) (A0), (UINT64) (A1), (UINT64) (A2)); } while (0)
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_TRACELOG_H
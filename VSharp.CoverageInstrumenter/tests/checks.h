@@ -0,0 +1,26 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_TESTS_CHECKS_H
+#define VSHARP_COVERAGEINSTRUMENTER_TESTS_CHECKS_H
+
+#include <iostream>
+
+// failed checks are reported and counted, the test goes on
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+// the exit code of the test
+static int checksResult() {
+    if (failures != 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_TESTS_CHECKS_H
@@ -0,0 +1,64 @@
+#include "profiler/coverageBaseline.h"
+#include "profiler/coverageReport.h"
+#include "checks.h"
+#include <cstdio>
+#include <fstream>
+
+using namespace vsharp;
+
+static const char16_t moduleName[] = u"/tmp/Asm.dll";
+
+static const std::set<OFFSET>* find(const CoverageBaseline& baseline, mdMethodDef token) {
+    // the runtime gives module names with the terminating zero
+    return baseline.find(reinterpret_cast<const WCHAR*>(moduleName), sizeof(moduleName) / sizeof(char16_t), token);
+}
+
+static std::string writeBaseline(const report::Report& report) {
+    std::string path = "coverageBaselineTests.report";
+    std::vector<char> buffer;
+    report::writeReport(report, buffer);
+    std::ofstream fout(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    fout.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    return path;
+}
+
+static void loadsCoveredOffsets() {
+    report::Report report;
+    report.methods[1] = {0x06000001, u"Asm", moduleName, {0, 0x10, 0x20}, {}};
+    report.methods[2] = {0x06000002, u"Asm", moduleName, {0, 0x8}, {}};
+    report::ThreadReport first {}, second {};
+    first.coveredBlocks.push_back({1, 3, {0x1}});
+    second.coveredBlocks.push_back({1, 3, {0x4}});
+    // no covered blocks at all
+    second.coveredBlocks.push_back({2, 2, {0x0}});
+    report.threads.push_back(first);
+    report.threads.push_back(second);
+    std::string path = writeBaseline(report);
+
+    CoverageBaseline baseline;
+    CHECK(baseline.load(path.c_str()));
+    auto covered = find(baseline, 0x06000001);
+    CHECK(covered != nullptr && *covered == (std::set<OFFSET>{0, 0x20}));
+    CHECK(find(baseline, 0x06000002) == nullptr);
+    CHECK(find(baseline, 0x06000003) == nullptr);
+    std::remove(path.c_str());
+}
+
+static void rejectsMissingAndDamagedReports() {
+    CoverageBaseline baseline;
+    CHECK(!baseline.load("coverageBaselineTests.missing"));
+
+    std::string path = "coverageBaselineTests.damaged";
+    std::ofstream fout(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    fout << "not a report";
+    fout.close();
+    CHECK(!baseline.load(path.c_str()));
+    CHECK(find(baseline, 0x06000001) == nullptr);
+    std::remove(path.c_str());
+}
+
+int main() {
+    loadsCoveredOffsets();
+    rejectsMissingAndDamagedReports();
+    return checksResult();
+}
@@ -0,0 +1,151 @@
+#include "profiler/coverageReport.h"
+#include "tools/coverageAggregate.h"
+#include "checks.h"
+#include <cstring>
+
+using namespace vsharp::report;
+
+static Report makeReport(const std::vector<uint32_t>& offsets, const std::vector<uint64_t>& bitset) {
+    Report report;
+    report.methods[3] = {0x06000001, u"Asm", u"/tmp/Asm.dll", offsets, {}};
+    ThreadReport thread {};
+    thread.threadId = 1;
+    thread.records.push_back({0x10, 2, 3, 77});
+    thread.coveredBlocks.push_back({3, static_cast<int32_t>(offsets.size()), bitset});
+    thread.comparisons.push_back({0x4, 3, 6, 0, 5, u"lit", u"ope"});
+    thread.hitCounts.push_back({3, 0x10, 42});
+    thread.paths.push_back({3, 1, 9});
+    report.threads.push_back(thread);
+    return report;
+}
+
+static void roundTripsReports() {
+    Report written = makeReport({0, 0x10, 0x20}, {0x5});
+    written.methods[3].firstHits = {100, 0, 300};
+    std::vector<char> buffer;
+    writeReport(written, buffer);
+
+    Report read;
+    CHECK(readReport(buffer.data(), buffer.size(), read));
+    CHECK(read.methods.size() == 1);
+    auto& method = read.methods[3];
+    CHECK(method.token == 0x06000001);
+    CHECK(method.assemblyName == u"Asm" && method.moduleName == u"/tmp/Asm.dll");
+    CHECK(method.blockOffsets == written.methods[3].blockOffsets);
+    CHECK(method.firstHits == written.methods[3].firstHits);
+    CHECK(read.threads.size() == 1);
+    auto& thread = read.threads[0];
+    CHECK(thread.threadId == 1 && !thread.aborted);
+    CHECK(thread.records.size() == 1 && thread.records[0].offset == 0x10 && thread.records[0].thread == 77);
+    CHECK(thread.coveredBlocks.size() == 1 && thread.coveredBlocks[0].bitset == std::vector<uint64_t>{0x5});
+    CHECK(thread.hitCounts.size() == 1 && thread.hitCounts[0].hits == 42);
+    CHECK(thread.paths.size() == 1 && thread.paths[0].pathId == 1);
+}
+
+static void rejectsMalformedReports() {
+    std::vector<char> buffer;
+    writeReport(makeReport({0, 0x10}, {0x1}), buffer);
+    Report report;
+    for (size_t size = 0; size < buffer.size(); size++) {
+        Report truncated;
+        CHECK(!readReport(buffer.data(), size, truncated));
+    }
+    buffer.push_back(0);
+    CHECK(!readReport(buffer.data(), buffer.size(), report));
+    // a negative method count
+    int32_t negative = -1;
+    std::memcpy(buffer.data(), &negative, sizeof(negative));
+    CHECK(!readReport(buffer.data(), buffer.size(), report));
+}
+
+static void appendSection(const std::u16string& name, const Report& report, std::vector<char>& file) {
+    std::vector<char> bytes;
+    writeReport(report, bytes);
+    auto nameLength = static_cast<uint32_t>(name.size());
+    auto reportSize = static_cast<uint32_t>(bytes.size());
+    file.insert(file.end(), reinterpret_cast<const char*>(&nameLength), reinterpret_cast<const char*>(&nameLength + 1));
+    file.insert(file.end(), reinterpret_cast<const char*>(name.data()), reinterpret_cast<const char*>(name.data() + name.size()));
+    file.insert(file.end(), reinterpret_cast<const char*>(&reportSize), reinterpret_cast<const char*>(&reportSize + 1));
+    file.insert(file.end(), bytes.begin(), bytes.end());
+}
+
+static void readsTestSections() {
+    std::vector<char> file;
+    appendSection(u"First", makeReport({0, 0x10}, {0x1}), file);
+    appendSection(u"Second", makeReport({0, 0x10}, {0x2}), file);
+    std::vector<std::pair<std::u16string, Report>> tests;
+    CHECK(readTestReports(file.data(), file.size(), tests));
+    CHECK(tests.size() == 2);
+    CHECK(tests[0].first == u"First" && tests[1].first == u"Second");
+    CHECK(tests[1].second.threads[0].coveredBlocks[0].bitset == std::vector<uint64_t>{0x2});
+
+    tests.clear();
+    CHECK(!readTestReports(file.data(), file.size() - 1, tests));
+}
+
+static void mergesSameLayouts() {
+    MethodCoverage coverage;
+    coverage.merge({0, 0x10, 0x20}, {0x1});
+    coverage.merge({0, 0x10, 0x20}, {0x4});
+    CHECK(coverage.blockOffsets == (std::vector<uint32_t>{0, 0x10, 0x20}));
+    CHECK(coverage.bitset == std::vector<uint64_t>{0x5});
+    CHECK(coverage.coveredCount() == 2);
+}
+
+static void mergesUnionOfLayouts() {
+    MethodCoverage coverage;
+    // 0x10 covered; 0x20 uncovered in both, but still counted as a block
+    coverage.merge({0, 0x10, 0x20}, {0x2});
+    // 0x30 covered, 0x8 uncovered
+    coverage.merge({0x8, 0x20, 0x30}, {0x4});
+    CHECK(coverage.blockOffsets == (std::vector<uint32_t>{0, 0x8, 0x10, 0x20, 0x30}));
+    CHECK(coverage.bitset == std::vector<uint64_t>{0x4 | 0x10});
+    CHECK(coverage.coveredCount() == 2);
+
+    // layouts of more than one word
+    std::vector<uint32_t> wide;
+    for (uint32_t i = 0; i < 70; i++)
+        wide.push_back(i * 2);
+    MethodCoverage big;
+    big.merge(wide, {0, 0x20});
+    big.merge({1, 137}, {0x2});
+    CHECK(big.blockOffsets.size() == 72);
+    CHECK(big.coveredCount() == 2);
+    auto covered = [&big](uint32_t offset) {
+        size_t i = std::find(big.blockOffsets.begin(), big.blockOffsets.end(), offset) - big.blockOffsets.begin();
+        return i < big.blockOffsets.size() && ((big.bitset[i / 64] >> (i % 64)) & 1) != 0;
+    };
+    CHECK(covered(69 * 2));
+    CHECK(covered(137));
+    CHECK(!covered(1));
+}
+
+static void aggregatesMethodsOfReports() {
+    Aggregate aggregate;
+    aggregate.add(makeReport({0, 0x10}, {0x1}));
+    Report other = makeReport({0, 0x10}, {0x2});
+    // the same method under another id of another process
+    other.methods[8] = other.methods[3];
+    other.methods.erase(3);
+    other.threads[0].coveredBlocks[0].methodId = 8;
+    aggregate.add(other);
+    CHECK(aggregate.methods.size() == 1);
+    auto& coverage = aggregate.methods[{u"/tmp/Asm.dll", 0x06000001}];
+    CHECK(coverage.assemblyName == u"Asm");
+    CHECK(coverage.coveredCount() == 2);
+
+    Aggregate total;
+    total.add(aggregate);
+    total.add(makeReport({0x40}, {0x1}));
+    CHECK((total.methods[{u"/tmp/Asm.dll", 0x06000001}].blockOffsets.size() == 3));
+}
+
+int main() {
+    roundTripsReports();
+    rejectsMalformedReports();
+    readsTestSections();
+    mergesSameLayouts();
+    mergesUnionOfLayouts();
+    aggregatesMethodsOfReports();
+    return checksResult();
+}
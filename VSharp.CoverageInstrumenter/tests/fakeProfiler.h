@@ -0,0 +1,74 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_TESTS_FAKEPROFILER_H
+#define VSHARP_COVERAGEINSTRUMENTER_TESTS_FAKEPROFILER_H
+
+#include "cor.h"
+#include "corprof.h"
+#include <vector>
+
+// takes the body the rewriter gives to the runtime
+class CapturingFunctionControl : public ICorProfilerFunctionControl {
+public:
+    std::vector<BYTE> body;
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void**) override { return E_NOINTERFACE; }
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+    HRESULT STDMETHODCALLTYPE SetCodegenFlags(DWORD) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE SetILInstrumentedCodeMap(ULONG, COR_IL_MAP[]) override { return S_OK; }
+
+    HRESULT STDMETHODCALLTYPE SetILFunctionBody(ULONG size, LPCBYTE data) override {
+        body.assign(data, data + size);
+        return S_OK;
+    }
+};
+
+// gives the rewriter the original body of the method, the rest of the runtime is absent
+class MethodBodyProfilerInfo : public ICorProfilerInfo {
+public:
+    std::vector<BYTE> header;
+
+    HRESULT STDMETHODCALLTYPE GetILFunctionBody(ModuleID, mdMethodDef, LPCBYTE *ppMethodHeader, ULONG *pcbMethodSize) override {
+        *ppMethodHeader = header.data();
+        if (pcbMethodSize != nullptr)
+            *pcbMethodSize = static_cast<ULONG>(header.size());
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void**) override { return E_NOINTERFACE; }
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+    HRESULT STDMETHODCALLTYPE GetClassFromObject(ObjectID, ClassID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetClassFromToken(ModuleID, mdTypeDef, ClassID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetCodeInfo(FunctionID, LPCBYTE*, ULONG*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetEventMask(DWORD*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetFunctionFromIP(LPCBYTE, FunctionID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetFunctionFromToken(ModuleID, mdToken, FunctionID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetHandleFromThread(ThreadID, HANDLE*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetObjectSize(ObjectID, ULONG*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE IsArrayClass(ClassID, CorElementType*, ClassID*, ULONG*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetThreadInfo(ThreadID, DWORD*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetCurrentThreadID(ThreadID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetClassIDInfo(ClassID, ModuleID*, mdTypeDef*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetFunctionInfo(FunctionID, ClassID*, ModuleID*, mdToken*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetEventMask(DWORD) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetEnterLeaveFunctionHooks(FunctionEnter*, FunctionLeave*, FunctionTailcall*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetFunctionIDMapper(FunctionIDMapper*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetTokenAndMetaDataFromFunction(FunctionID, REFIID, IUnknown**, mdToken*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetModuleInfo(ModuleID, LPCBYTE*, ULONG, ULONG*, WCHAR[], AssemblyID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetModuleMetaData(ModuleID, DWORD, REFIID, IUnknown**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetILFunctionBodyAllocator(ModuleID, IMethodMalloc**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetILFunctionBody(ModuleID, mdMethodDef, LPCBYTE) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetAppDomainInfo(AppDomainID, ULONG, ULONG*, WCHAR[], ProcessID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetAssemblyInfo(AssemblyID, ULONG, ULONG*, WCHAR[], AppDomainID*, ModuleID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetFunctionReJIT(FunctionID) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE ForceGC() override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetILInstrumentedCodeMap(FunctionID, BOOL, ULONG, COR_IL_MAP[]) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetInprocInspectionInterface(IUnknown**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetInprocInspectionIThisThread(IUnknown**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetThreadContext(ThreadID, ContextID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE BeginInprocDebugging(BOOL, DWORD*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE EndInprocDebugging(DWORD) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetILToNativeMapping(FunctionID, ULONG32, ULONG32*, COR_DEBUG_IL_TO_NATIVE_MAP[]) override { return E_NOTIMPL; }
+};
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_TESTS_FAKEPROFILER_H
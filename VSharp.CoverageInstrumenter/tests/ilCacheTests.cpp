@@ -0,0 +1,171 @@
+#include "profiler/ilCache.h"
+#include "profiler/ILRewriter.h"
+#include "profiler/probes.h"
+#include "checks.h"
+#include "fakeProfiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace vsharp;
+
+static const char* cachePath = "ilCacheTests.cache";
+
+static ILCacheKey makeKey(mdMethodDef token, UINT64 settingsHash = 1) {
+    ILCacheKey key;
+    std::memset(&key, 0, sizeof(key));
+    key.mvid.Data1 = 0x1234;
+    key.token = token;
+    key.ilHash = 0xABCDEF00 + token;
+    key.settingsHash = settingsHash;
+    return key;
+}
+
+// the body is filled with the token, so records of different methods are told apart in the file
+static RewrittenIL makeMethod(mdMethodDef token, std::vector<ILRelocation> relocations) {
+    RewrittenIL method;
+    method.body.assign(32, static_cast<BYTE>(token));
+    method.relocations = std::move(relocations);
+    return method;
+}
+
+static const ILRelocation methodIdAt4 = {4, RelocationMethodId, 0};
+static const ILRelocation branchAddressAt12 = {12, RelocationProbeAddress, 2};
+
+static std::vector<char> readFile() {
+    std::ifstream file(cachePath, std::ios::in | std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::vector<char>& data) {
+    std::ofstream file(cachePath, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+static bool isCached(mdMethodDef token, UINT64 settingsHash = 1) {
+    ILCache cache;
+    cache.open(cachePath);
+    CachedIL method;
+    return cache.find(makeKey(token, settingsHash), method);
+}
+
+static void keepsMethodsAcrossRuns() {
+    std::remove(cachePath);
+    {
+        ILCache cache;
+        cache.open(cachePath);
+        cache.add(makeKey(1), makeMethod(1, {methodIdAt4, branchAddressAt12}), {0, 5, 9});
+        CachedIL added;
+        CHECK(cache.find(makeKey(1), added));
+        cache.flush();
+        size_t size = readFile().size();
+        // the flushed methods are not appended twice
+        cache.flush();
+        CHECK(size > 0 && readFile().size() == size);
+    }
+
+    ILCache cache;
+    cache.open(cachePath);
+    CachedIL method;
+    CHECK(cache.find(makeKey(1), method));
+    CHECK(method.bodySize == 32 && std::all_of(method.body, method.body + 32, [](BYTE b) { return b == 1; }));
+    CHECK(method.relocations.size() == 2);
+    CHECK(method.relocations[1].offset == 12 && method.relocations[1].kind == RelocationProbeAddress && method.relocations[1].probe == 2);
+    CHECK(method.blockOffsets == (std::vector<OFFSET>{0, 5, 9}));
+    CHECK(!cache.find(makeKey(1, 2), method));
+    CHECK(!cache.find(makeKey(2), method));
+}
+
+static void skipsInvalidRecords() {
+    std::remove(cachePath);
+    ILCache cache;
+    cache.open(cachePath);
+    cache.add(makeKey(1), makeMethod(1, {methodIdAt4}), {0});
+    // the operand does not fit into the body
+    cache.add(makeKey(2), makeMethod(2, {{30, RelocationMethodId, 0}}), {0});
+    // there is no such probe
+    cache.add(makeKey(3), makeMethod(3, {{4, RelocationProbeSignature, 99}}), {0});
+    cache.add(makeKey(4), makeMethod(4, {}), {0});
+    cache.add(makeKey(5), makeMethod(5, {}), {0});
+    cache.flush();
+    CHECK(isCached(1) && !isCached(2) && !isCached(3) && isCached(4) && isCached(5));
+
+    // a damaged body fails the checksum, the records after it are still found
+    std::vector<char> data = readFile();
+    std::vector<char> bodyOf4(32, 4);
+    auto body = std::search(data.begin(), data.end(), bodyOf4.begin(), bodyOf4.end());
+    CHECK(body != data.end());
+    *(body + 8) ^= 0x40;
+    writeFile(data);
+    CHECK(isCached(1) && !isCached(4) && isCached(5));
+
+    // a torn append of a crashed process hides nothing before it
+    data.insert(data.end(), data.begin(), data.begin() + 24);
+    writeFile(data);
+    CHECK(isCached(1) && isCached(5));
+}
+
+static void appendsOfProcessesAreNotInterleaved() {
+    std::remove(cachePath);
+    const int processes = 8, methods = 200;
+    std::vector<pid_t> children;
+    for (int p = 0; p < processes; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            ILCache cache;
+            cache.open(cachePath);
+            for (int m = 0; m < methods; m++) {
+                auto token = static_cast<mdMethodDef>(p * methods + m);
+                cache.add(makeKey(token), makeMethod(token, {methodIdAt4}), {0});
+            }
+            cache.flush();
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    ILCache cache;
+    cache.open(cachePath);
+    CachedIL method;
+    int found = 0;
+    for (int token = 0; token < processes * methods; token++)
+        found += cache.find(makeKey(static_cast<mdMethodDef>(token)), method) ? 1 : 0;
+    CHECK(found == processes * methods);
+}
+
+static void patchesRelocations() {
+    RewrittenIL rewritten = makeMethod(7, {methodIdAt4, branchAddressAt12});
+    CapturingFunctionControl control;
+    ILRewriter rewriter(nullptr, &control, 0, 0x06000007);
+    CHECK(SUCCEEDED(rewriter.ExportCached(rewritten.body.data(), static_cast<UINT32>(rewritten.body.size()), rewritten.relocations, 1234)));
+    CHECK(control.body.size() == 32);
+    INT32 methodId;
+    std::memcpy(&methodId, &control.body[4], sizeof(methodId));
+    CHECK(methodId == 1234);
+    size_t address;
+    std::memcpy(&address, &control.body[12], sizeof(address));
+    CHECK(address == static_cast<size_t>(probeAt(2)->addr));
+    CHECK(control.body[0] == 7 && control.body[8] == 7 && control.body[20] == 7);
+
+    std::vector<ILRelocation> unknownKind = {{4, 17, 0}};
+    CHECK(FAILED(rewriter.ExportCached(rewritten.body.data(), static_cast<UINT32>(rewritten.body.size()), unknownKind, 1234)));
+}
+
+int main() {
+    InitializeProbes();
+    keepsMethodsAcrossRuns();
+    skipsInvalidRecords();
+    appendsOfProcessesAreNotInterleaved();
+    patchesRelocations();
+    std::remove(cachePath);
+    return checksResult();
+}
@@ -0,0 +1,46 @@
+#include "profiler/ILRewriter.h"
+#include "profiler/profilerState.h"
+#include "checks.h"
+#include "fakeProfiler.h"
+#include <set>
+
+using namespace vsharp;
+
+// static int Abs(int x) => x < 0 ? -x : x, with a tiny header
+static const std::vector<BYTE> ifElseMethod = {
+    (10 << 2) | CorILMethod_TinyFormat,
+    0x02,                   // 0: ldarg.0
+    0x16,                   // 1: ldc.i4.0
+    0x2F, 4,                // 2: bge.s 8
+    0x02,                   // 4: ldarg.0
+    0x65,                   // 5: neg
+    0x2B, 1,                // 6: br.s 9
+    0x02,                   // 8: ldarg.0
+    0x2A                    // 9: ret
+};
+
+// offsets of the probe sites, in no particular order
+static std::set<OFFSET> blocksOf(const std::vector<BYTE>& method, InstrumentationGranularity granularity) {
+    MethodBodyProfilerInfo info;
+    info.header = method;
+    CapturingFunctionControl control;
+    std::vector<OFFSET> blockOffsets;
+    HRESULT hr = RewriteIL(&info, &control, 0, 0x06000001, 1, false, false, false, granularity, nullptr, blockOffsets, nullptr);
+    CHECK(SUCCEEDED(hr));
+    CHECK(!control.body.empty());
+    return std::set<OFFSET>(blockOffsets.begin(), blockOffsets.end());
+}
+
+static void blockLevelKeepsBlocksEndingWithBranches() {
+    std::set<OFFSET> block = blocksOf(ifElseMethod, GranularityBlock);
+    CHECK(block == blocksOf(ifElseMethod, GranularityFull));
+    CHECK(block == (std::set<OFFSET>{0, 2, 6, 8, 9}));
+    // only the enter and the return are left on the method level
+    CHECK(blocksOf(ifElseMethod, GranularityMethod) == (std::set<OFFSET>{0, 9}));
+}
+
+int main() {
+    profilerState = new ProfilerState(nullptr);
+    blockLevelKeepsBlocksEndingWithBranches();
+    return checksResult();
+}
@@ -0,0 +1,64 @@
+#include "profiler/profilerState.h"
+#include "checks.h"
+
+using namespace vsharp;
+
+static const UINT_PTR stackLimit = 4096;
+
+static void predictsOnlyBelowTheBottomOfTheInvocation() {
+    auto tracker = profilerState->threadTracker;
+    // the thread entered no main
+    CHECK(!tracker->isPossibleStackOverflow(0x1000));
+
+    tracker->trackCurrentThread(0x100000);
+    CHECK(!tracker->isPossibleStackOverflow(0x100000 - stackLimit));
+    CHECK(tracker->isPossibleStackOverflow(0x100000 - stackLimit - 1));
+    tracker->loseCurrentThread();
+    CHECK(!tracker->isPossibleStackOverflow(0x1000));
+
+    // the bottom of the previous invocation is not kept by the reused thread
+    tracker->trackCurrentThread(0x80000);
+    CHECK(!tracker->isPossibleStackOverflow(0x80000 - 100));
+    tracker->loseCurrentThread();
+
+    // the bottom marked by the harness is used by the next invocation only
+    tracker->markStackBottom(0x90000);
+    tracker->trackCurrentThread(0x80000);
+    CHECK(tracker->isPossibleStackOverflow(0x90000 - stackLimit - 1));
+    tracker->loseCurrentThread();
+    tracker->trackCurrentThread(0x80000);
+    CHECK(!tracker->isPossibleStackOverflow(0x90000 - stackLimit - 1));
+    tracker->loseCurrentThread();
+}
+
+static void dropsPredictionsOnClear() {
+    auto tracker = profilerState->threadTracker;
+    tracker->mapCurrentThread(7);
+    tracker->trackCurrentThread(0x100000);
+    CHECK(tracker->reportStackOverflow());
+    // reported once per invocation
+    CHECK(!tracker->reportStackOverflow());
+    tracker->loseCurrentThread();
+    CHECK(tracker->takeStackOverflowPrediction() == 7);
+    CHECK(tracker->takeStackOverflowPrediction() == -1);
+
+    tracker->trackCurrentThread(0x100000);
+    CHECK(tracker->reportStackOverflow());
+    tracker->clear();
+    CHECK(tracker->takeStackOverflowPrediction() == -1);
+}
+
+static void predictsNothingWithoutLimit() {
+    ProfilerState state(nullptr);
+    state.threadTracker->trackCurrentThread(0x100000);
+    CHECK(!state.threadTracker->isPossibleStackOverflow(0x10));
+    state.threadTracker->clear();
+}
+
+int main() {
+    profilerState = new ProfilerState(nullptr, {{"COVERAGE_TOOL_STACK_LIMIT", std::to_string(stackLimit)}});
+    predictsOnlyBelowTheBottomOfTheInvocation();
+    dropsPredictionsOnClear();
+    predictsNothingWithoutLimit();
+    return checksResult();
+}
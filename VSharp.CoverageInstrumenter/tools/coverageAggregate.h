@@ -0,0 +1,109 @@
+#ifndef VSHARP_COVERAGEINSTRUMENTER_COVERAGEAGGREGATE_H
+#define VSHARP_COVERAGEINSTRUMENTER_COVERAGEAGGREGATE_H
+
+#include "profiler/coverageReport.h"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Covered blocks of reports merged per method; used by the offline merge tool
+
+namespace vsharp {
+namespace report {
+
+static inline size_t popCount(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_popcountll(word));
+#else
+    size_t count = 0;
+    for (; word != 0; word &= word - 1)
+        count++;
+    return count;
+#endif
+}
+
+typedef std::pair<std::u16string, uint32_t> MethodKey;
+
+struct MethodCoverage {
+    std::u16string assemblyName;
+    std::vector<uint32_t> blockOffsets;
+    std::vector<uint64_t> bitset;
+
+    size_t coveredCount() const {
+        size_t count = 0;
+        for (auto word : bitset)
+            count += popCount(word);
+        return count;
+    }
+
+    // reports of the same build share block offsets, so bitsets are usually merged word by word
+    void merge(const std::vector<uint32_t>& offsets, const std::vector<uint64_t>& bits) {
+        if (blockOffsets.empty() && bitset.empty()) {
+            blockOffsets = offsets;
+            bitset = bits;
+            bitset.resize((blockOffsets.size() + 63) / 64, 0);
+            return;
+        }
+        if (offsets == blockOffsets) {
+            for (size_t i = 0; i < bitset.size() && i < bits.size(); i++)
+                bitset[i] |= bits[i];
+            return;
+        }
+        // layouts differ, so blocks are matched by offsets; the layout becomes the union of both,
+        // so blocks uncovered in both reports are still counted
+        std::vector<uint32_t> ours(blockOffsets);
+        std::vector<uint32_t> theirs(offsets);
+        std::sort(ours.begin(), ours.end());
+        std::sort(theirs.begin(), theirs.end());
+        std::vector<uint32_t> merged;
+        std::set_union(ours.begin(), ours.end(), theirs.begin(), theirs.end(), std::back_inserter(merged));
+        merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+        std::vector<uint64_t> mergedBits((merged.size() + 63) / 64, 0);
+        auto markCovered = [&merged, &mergedBits](const std::vector<uint32_t>& layout, const std::vector<uint64_t>& layoutBits) {
+            for (size_t i = 0; i < layout.size() && i / 64 < layoutBits.size(); i++) {
+                if (((layoutBits[i / 64] >> (i % 64)) & 1) == 0)
+                    continue;
+                size_t index = std::lower_bound(merged.begin(), merged.end(), layout[i]) - merged.begin();
+                mergedBits[index / 64] |= static_cast<uint64_t>(1) << (index % 64);
+            }
+        };
+        markCovered(blockOffsets, bitset);
+        markCovered(offsets, bits);
+        blockOffsets.swap(merged);
+        bitset.swap(mergedBits);
+    }
+};
+
+struct Aggregate {
+    std::map<MethodKey, MethodCoverage> methods;
+
+    void add(const Report& report) {
+        for (auto& thread : report.threads) {
+            for (auto& blocks : thread.coveredBlocks) {
+                auto method = report.methods.find(blocks.methodId);
+                if (method == report.methods.end())
+                    continue;
+                auto& coverage = methods[{method->second.moduleName, method->second.token}];
+                coverage.assemblyName = method->second.assemblyName;
+                coverage.merge(method->second.blockOffsets, blocks.bitset);
+            }
+        }
+    }
+
+    void add(const Aggregate& other) {
+        for (auto& el : other.methods) {
+            auto& coverage = methods[el.first];
+            coverage.assemblyName = el.second.assemblyName;
+            coverage.merge(el.second.blockOffsets, el.second.bitset);
+        }
+    }
+};
+
+}
+}
+
+#endif //VSHARP_COVERAGEINSTRUMENTER_COVERAGEAGGREGATE_H
@@ -0,0 +1,398 @@
+#include "coverageAggregate.h"
+#include "profiler/coverageReport.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Offline merge and query of coverage reports written by the coverage profiler
+// Usage:
+//   vsharpCoverageMerge merge <output report> <reports...>
+//   vsharpCoverageMerge summary <reports...>
+//   vsharpCoverageMerge index <output index> <reports...>
+//   vsharpCoverageMerge query <index> <method token> [block IL offset] [--module <module name part>]
+
+using namespace vsharp::report;
+
+#define INDEX_FILE_MAGIC 0x5844494f43535656ULL // "VVSCOIDX"
+#define INDEX_FILE_VERSION 1
+
+//region Memory-mapped files
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+public:
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+            return false;
+        size = static_cast<size_t>(fileSize.QuadPart);
+        if (size == 0)
+            return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr)
+            return false;
+        data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        return data != nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size == 0) {
+            close(fd);
+            return true;
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = static_cast<const char*>(mapped);
+        return true;
+#endif
+    }
+
+    const char* bytes() const { return data; }
+    size_t length() const { return size; }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data != nullptr) UnmapViewOfFile(data);
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data != nullptr) munmap(const_cast<char*>(data), size);
+#endif
+    }
+};
+//endregion
+
+//region Coverage aggregation
+static std::string toUtf8(const std::u16string& str) {
+    std::string result;
+    for (size_t i = 0; i < str.size(); i++) {
+        uint32_t c = str[i];
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < str.size() && str[i + 1] >= 0xDC00 && str[i + 1] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (str[i + 1] - 0xDC00);
+            i++;
+        }
+        if (c < 0x80) {
+            result += static_cast<char>(c);
+        } else if (c < 0x800) {
+            result += static_cast<char>(0xC0 | (c >> 6));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            result += static_cast<char>(0xE0 | (c >> 12));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            result += static_cast<char>(0xF0 | (c >> 18));
+            result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    return result;
+}
+
+struct TestCoverage {
+    std::string name;
+    Aggregate coverage;
+};
+
+// a test is either a whole report file or a section of a persistent passive mode result
+static bool readTests(const std::string& path, std::vector<TestCoverage>& tests) {
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    Report report;
+    if (readReport(file.bytes(), file.length(), report)) {
+        tests.push_back({path, Aggregate()});
+        tests.back().coverage.add(report);
+        return true;
+    }
+    std::vector<std::pair<std::u16string, Report>> sections;
+    if (!readTestReports(file.bytes(), file.length(), sections))
+        return false;
+    for (auto& section : sections) {
+        tests.push_back({path + ":" + toUtf8(section.first), Aggregate()});
+        tests.back().coverage.add(section.second);
+    }
+    return true;
+}
+
+// parses the files on all cores; tests keep the order of the files
+static bool readAllTests(const std::vector<std::string>& paths, std::vector<TestCoverage>& tests) {
+    std::vector<std::vector<TestCoverage>> perFile(paths.size());
+    std::vector<char> failed(paths.size(), 0);
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            if (!readTests(paths[i], perFile[i]))
+                failed[i] = 1;
+        }
+    };
+    size_t threadsCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), paths.size()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadsCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    bool result = true;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (failed[i]) {
+            std::fprintf(stderr, "Can't read coverage report %s\n", paths[i].c_str());
+            result = false;
+            continue;
+        }
+        for (auto& test : perFile[i])
+            tests.push_back(std::move(test));
+    }
+    return result;
+}
+
+static Aggregate mergeTests(const std::vector<TestCoverage>& tests) {
+    Aggregate result;
+    for (auto& test : tests)
+        result.add(test.coverage);
+    return result;
+}
+//endregion
+
+//region Commands
+static int mergeReports(const std::string& outputPath, const std::vector<std::string>& paths) {
+    std::vector<TestCoverage> tests;
+    if (!readAllTests(paths, tests))
+        return 1;
+    auto merged = mergeTests(tests);
+
+    // the merged report has a single thread with covered blocks only
+    Report report;
+    ThreadReport thread {};
+    int32_t methodId = 0;
+    for (auto& el : merged.methods) {
+        report.methods[methodId] = {el.first.second, el.second.assemblyName, el.first.first, el.second.blockOffsets};
+        thread.coveredBlocks.push_back({methodId, static_cast<int32_t>(el.second.blockOffsets.size()), el.second.bitset});
+        methodId++;
+    }
+    report.threads.push_back(thread);
+
+    std::vector<char> buffer;
+    writeReport(report, buffer);
+    std::ofstream fout(outputPath, std::ios::out | std::ios::binary);
+    fout.write(buffer.data(), static_cast<long>(buffer.size()));
+    if (!fout) {
+        std::fprintf(stderr, "Can't write %s\n", outputPath.c_str());
+        return 1;
+    }
+    std::printf("Merged %zu tests, %zu methods\n", tests.size(), merged.methods.size());
+    return 0;
+}
+
+static int printSummary(const std::vector<std::string>& paths) {
+    std::vector<TestCoverage> tests;
+    if (!readAllTests(paths, tests))
+        return 1;
+    auto merged = mergeTests(tests);
+
+    size_t totalCovered = 0;
+    size_t totalBlocks = 0;
+    for (auto& el : merged.methods) {
+        auto covered = el.second.coveredCount();
+        auto blocks = el.second.blockOffsets.size();
+        totalCovered += covered;
+        totalBlocks += blocks;
+        std::printf("%s!0x%08x %zu/%zu\n", toUtf8(el.first.first).c_str(), el.first.second, covered, blocks);
+    }
+    std::printf("Total: %zu/%zu blocks of %zu methods in %zu tests\n", totalCovered, totalBlocks, merged.methods.size(), tests.size());
+    return 0;
+}
+
+template <typename T> static void writeValue(std::ofstream& out, const T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T> static bool readValue(std::ifstream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// layout: header, test names, then per method: module, token, block offsets and bitsets of covering tests
+static int buildIndex(const std::string& indexPath, const std::vector<std::string>& paths) {
+    std::vector<TestCoverage> tests;
+    if (!readAllTests(paths, tests))
+        return 1;
+
+    std::map<MethodKey, std::vector<size_t>> coveringTests;
+    auto merged = mergeTests(tests);
+    for (size_t i = 0; i < tests.size(); i++) {
+        for (auto& el : tests[i].coverage.methods)
+            coveringTests[el.first].push_back(i);
+    }
+
+    std::ofstream out(indexPath, std::ios::out | std::ios::binary);
+    writeValue(out, static_cast<uint64_t>(INDEX_FILE_MAGIC));
+    writeValue(out, static_cast<uint32_t>(INDEX_FILE_VERSION));
+    writeValue(out, static_cast<uint32_t>(tests.size()));
+    for (auto& test : tests) {
+        writeValue(out, static_cast<uint32_t>(test.name.size()));
+        out.write(test.name.data(), static_cast<long>(test.name.size()));
+    }
+    writeValue(out, static_cast<uint32_t>(merged.methods.size()));
+    for (auto& el : merged.methods) {
+        auto& offsets = el.second.blockOffsets;
+        writeValue(out, static_cast<uint32_t>(el.first.first.size()));
+        out.write(reinterpret_cast<const char*>(el.first.first.data()), static_cast<long>(el.first.first.size() * sizeof(char16_t)));
+        writeValue(out, el.first.second);
+        writeValue(out, static_cast<uint32_t>(offsets.size()));
+        out.write(reinterpret_cast<const char*>(offsets.data()), static_cast<long>(offsets.size() * sizeof(uint32_t)));
+        auto& covering = coveringTests[el.first];
+        writeValue(out, static_cast<uint32_t>(covering.size()));
+        for (auto test : covering) {
+            // rebasing the test bitset onto the merged block offsets
+            MethodCoverage rebased;
+            rebased.blockOffsets = offsets;
+            rebased.bitset.assign((offsets.size() + 63) / 64, 0);
+            auto& own = tests[test].coverage.methods[el.first];
+            rebased.merge(own.blockOffsets, own.bitset);
+            writeValue(out, static_cast<uint32_t>(test));
+            out.write(reinterpret_cast<const char*>(rebased.bitset.data()), static_cast<long>(rebased.bitset.size() * sizeof(uint64_t)));
+        }
+    }
+    if (!out) {
+        std::fprintf(stderr, "Can't write %s\n", indexPath.c_str());
+        return 1;
+    }
+    std::printf("Indexed %zu tests, %zu methods\n", tests.size(), merged.methods.size());
+    return 0;
+}
+
+static int queryIndex(const std::string& indexPath, uint32_t token, bool byBlock, uint32_t blockOffset, const std::string& modulePart) {
+    std::ifstream in(indexPath, std::ios::in | std::ios::binary);
+    uint64_t magic = 0;
+    uint32_t version = 0;
+    if (!readValue(in, magic) || magic != INDEX_FILE_MAGIC || !readValue(in, version) || version != INDEX_FILE_VERSION) {
+        std::fprintf(stderr, "%s is not a coverage index\n", indexPath.c_str());
+        return 1;
+    }
+
+    uint32_t count = 0;
+    readValue(in, count);
+    std::vector<std::string> testNames(count);
+    for (auto& name : testNames) {
+        uint32_t length = 0;
+        readValue(in, length);
+        name.resize(length);
+        in.read(&name[0], length);
+    }
+
+    uint32_t methodsCount = 0;
+    readValue(in, methodsCount);
+    for (uint32_t m = 0; m < methodsCount && in; m++) {
+        uint32_t moduleLength = 0;
+        readValue(in, moduleLength);
+        std::u16string module(moduleLength, 0);
+        in.read(reinterpret_cast<char*>(&module[0]), moduleLength * sizeof(char16_t));
+        uint32_t methodToken = 0;
+        uint32_t blocksCount = 0;
+        readValue(in, methodToken);
+        readValue(in, blocksCount);
+        std::vector<uint32_t> offsets(blocksCount);
+        in.read(reinterpret_cast<char*>(offsets.data()), blocksCount * sizeof(uint32_t));
+        uint32_t coveringCount = 0;
+        readValue(in, coveringCount);
+        size_t words = (blocksCount + 63) / 64;
+        auto moduleName = toUtf8(module);
+        bool matches = methodToken == token && moduleName.find(modulePart) != std::string::npos;
+        auto block = std::find(offsets.begin(), offsets.end(), blockOffset) - offsets.begin();
+        if (matches && byBlock && block == static_cast<long>(offsets.size())) {
+            std::fprintf(stderr, "%s!0x%08x has no probe site at IL offset 0x%x\n", moduleName.c_str(), methodToken, blockOffset);
+            matches = false;
+        }
+        std::vector<uint64_t> bitset(words);
+        for (uint32_t i = 0; i < coveringCount && in; i++) {
+            uint32_t test = 0;
+            readValue(in, test);
+            in.read(reinterpret_cast<char*>(bitset.data()), words * sizeof(uint64_t));
+            if (!matches || test >= testNames.size())
+                continue;
+            if (byBlock && ((bitset[block / 64] >> (block % 64)) & 1) == 0)
+                continue;
+            std::printf("%s!0x%08x %s\n", moduleName.c_str(), methodToken, testNames[test].c_str());
+        }
+    }
+    return 0;
+}
+//endregion
+
+static int usage(const char* name) {
+    std::fprintf(stderr,
+        "Usage:\n"
+        "  %s merge <output report> <reports...>\n"
+        "  %s summary <reports...>\n"
+        "  %s index <output index> <reports...>\n"
+        "  %s query <index> <method token> [block IL offset] [--module <module name part>]\n",
+        name, name, name, name);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3)
+        return usage(argv[0]);
+    std::string command = argv[1];
+    std::vector<std::string> arguments(argv + 2, argv + argc);
+
+    if (command == "merge" && arguments.size() >= 2)
+        return mergeReports(arguments[0], std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+    if (command == "summary")
+        return printSummary(arguments);
+    if (command == "index" && arguments.size() >= 2)
+        return buildIndex(arguments[0], std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+    if (command == "query" && arguments.size() >= 2) {
+        std::string modulePart;
+        std::vector<std::string> positional;
+        for (size_t i = 1; i < arguments.size(); i++) {
+            if (arguments[i] == "--module" && i + 1 < arguments.size())
+                modulePart = arguments[++i];
+            else
+                positional.push_back(arguments[i]);
+        }
+        if (positional.empty())
+            return usage(argv[0]);
+        auto token = static_cast<uint32_t>(std::stoul(positional[0], nullptr, 0));
+        bool byBlock = positional.size() > 1;
+        auto blockOffset = byBlock ? static_cast<uint32_t>(std::stoul(positional[1], nullptr, 0)) : 0;
+        return queryIndex(arguments[0], token, byBlock, blockOffset, modulePart);
+    }
+    return usage(argv[0]);
+}
@@ -0,0 +1,89 @@
+#include "profiler/traceEvents.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Offline decoder of binary traces written by the coverage profiler (COVERAGE_TOOL_TRACE_FILE)
+// Usage: vsharpTraceDecoder <trace file> [category mask]
+
+using namespace vsharp;
+
+struct EventDescription {
+    const char* name;
+    uint32_t category;
+    const char* args;
+};
+
+#define TRACE_EVENT_DESCRIPTION(id, category, args) { #id, category, args },
+static const EventDescription descriptions[] = {
+    TRACE_EVENTS(TRACE_EVENT_DESCRIPTION)
+};
+#undef TRACE_EVENT_DESCRIPTION
+
+static void printRecord(const TraceRecord& record, uint64_t startTimestamp) {
+    std::printf("%12.3f us [%016llx] ",
+        (record.timestamp - startTimestamp) / 1000.0,
+        static_cast<unsigned long long>(record.thread));
+    if (record.eventId >= TraceEventsCount) {
+        std::printf("<unknown event %u>\n", record.eventId);
+        return;
+    }
+    auto& description = descriptions[record.eventId];
+    std::printf("%s", description.name);
+    std::istringstream argNames(description.args);
+    for (uint32_t i = 0; i < record.argCount && i < TRACE_EVENT_ARGS; i++) {
+        std::string argName;
+        if (!(argNames >> argName))
+            argName = "arg" + std::to_string(i);
+        std::printf(" %s=%llu", argName.c_str(), static_cast<unsigned long long>(record.args[i]));
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <trace file> [category mask]\n", argv[0]);
+        return 1;
+    }
+    uint32_t mask = argc > 2 ? std::stoul(argv[2], nullptr, 0) : ~0u;
+
+    FILE* file = std::fopen(argv[1], "rb");
+    if (file == nullptr) {
+        std::fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_FILE_MAGIC) {
+        std::fprintf(stderr, "%s is not a coverage profiler trace\n", argv[1]);
+        std::fclose(file);
+        return 1;
+    }
+    if (header.version != TRACE_FILE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        std::fprintf(stderr, "Unsupported trace version %u\n", header.version);
+        std::fclose(file);
+        return 1;
+    }
+
+    // records of different threads are drained in batches, so they are ordered by time only within a thread
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.eventId < TraceEventsCount && (descriptions[record.eventId].category & mask) == 0)
+            continue;
+        records.push_back(record);
+    }
+    std::fclose(file);
+
+    uint64_t startTimestamp = records.empty() ? 0 : records[0].timestamp;
+    for (auto& r : records) {
+        if (r.timestamp < startTimestamp)
+            startTimestamp = r.timestamp;
+    }
+    for (auto& r : records) {
+        printRecord(r, startTimestamp);
+    }
+    return 0;
+}
@@ -1,6 +1,16 @@
 #include "./profiler/os.h"
 
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <cstdlib>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 std::string OS::unicodeToAnsi(const WCHAR *str) {
     std::basic_string<WCHAR> ws(str);
@@ -9,4 +19,77 @@ std::string OS::unicodeToAnsi(const WCHAR *str) {
 
 void OS::sleepSeconds(int seconds) {
     sleep(seconds);
-}
\ No newline at end of file
+}
+
+UINT64 OS::cycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    // served by vDSO, so no syscall is made
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<UINT64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void* OS::mapSharedFile(const char* path, size_t* size) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* memory = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // the mapping keeps the file referenced
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+    *size = static_cast<size_t>(st.st_size);
+    return memory;
+}
+
+const void* OS::mapFileForReading(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* memory = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+    *size = static_cast<size_t>(st.st_size);
+    return memory;
+}
+
+void OS::unmapFile(const void* memory, size_t size) {
+    munmap(const_cast<void*>(memory), size);
+}
+
+bool OS::appendToFile(const char* path, const char* data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return false;
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return false;
+    }
+    // the lock also covers partial writes, which O_APPEND alone does not
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) break;
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return size == 0;
+}
+
+bool OS::pinProfilerLibrary() {
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&OS::pinProfilerLibrary), &info) == 0 || info.dli_fname == nullptr)
+        return false;
+    // the library is already loaded, the flag only marks it to stay mapped when it is closed
+    return dlopen(info.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_NODELETE) != nullptr;
+}
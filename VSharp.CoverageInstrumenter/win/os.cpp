@@ -1,6 +1,10 @@
 #include "./profiler/os.h"
 
 #include <windows.h>
+#include <cstdlib>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
 
 std::string OS::unicodeToAnsi(const WCHAR *str) {
     std::wstring ws(str);
@@ -9,4 +13,80 @@ std::string OS::unicodeToAnsi(const WCHAR *str) {
 
 void OS::sleepSeconds(int seconds) {
     Sleep(seconds * 1000);
-}
\ No newline at end of file
+}
+
+UINT64 OS::cycleCounter() {
+#if defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+#endif
+}
+
+void* OS::mapSharedFile(const char* path, size_t* size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) return nullptr;
+    void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    // the view keeps the mapping referenced
+    CloseHandle(mapping);
+    if (memory == nullptr) return nullptr;
+    *size = static_cast<size_t>(fileSize.QuadPart);
+    return memory;
+}
+
+const void* OS::mapFileForReading(const char* path, size_t* size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) return nullptr;
+    const void* memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (memory == nullptr) return nullptr;
+    *size = static_cast<size_t>(fileSize.QuadPart);
+    return memory;
+}
+
+void OS::unmapFile(const void* memory, size_t size) {
+    UnmapViewOfFile(memory);
+}
+
+bool OS::appendToFile(const char* path, const char* data, size_t size) {
+    HANDLE file = CreateFileA(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    OVERLAPPED whole = {};
+    if (!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &whole)) {
+        CloseHandle(file);
+        return false;
+    }
+    while (size > 0) {
+        DWORD written;
+        if (!WriteFile(file, data, static_cast<DWORD>(size), &written, nullptr)) break;
+        data += written;
+        size -= written;
+    }
+    UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &whole);
+    CloseHandle(file);
+    return size == 0;
+}
+
+bool OS::pinProfilerLibrary() {
+    HMODULE module;
+    return GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+                              reinterpret_cast<LPCWSTR>(&OS::pinProfilerLibrary), &module) != 0;
+}
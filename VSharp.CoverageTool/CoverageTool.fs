@@ -18,12 +18,30 @@ module private ExternalCalls =
     [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
     extern void SetEntryMain(byte* assemblyName, int assemblyNameLength, byte* moduleName, int moduleNameLength, int methodToken)
 
+    [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
+    extern int AddEntryTarget(byte* assemblyName, int assemblyNameLength, byte* moduleName, int moduleNameLength, int methodToken)
+
+    [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
+    extern int RemoveEntryTarget(int targetId)
+
     [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
     extern void GetHistory(nativeint size, nativeint data)
 
     [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
     extern void SetCurrentThreadId(int id)
 
+    [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
+    extern void GetProfilerStats(nativeint size, nativeint data)
+
+    [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
+    extern uint64 TakeSharedMapNewEdges()
+
+    [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
+    extern void SetStackBottom()
+
+    [<DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)>]
+    extern int TakeStackOverflowPrediction()
+
 module private Configuration =
 
     let (|Windows|MacOs|Linux|) _ =
@@ -64,6 +82,8 @@ module private Configuration =
         moduleName: string
         [<EnvironmentVariable("COVERAGE_TOOL_METHOD_TOKEN")>]
         methodToken: string
+        [<EnvironmentVariable("COVERAGE_TOOL_PERSISTENT")>]
+        persistent: string
     }
 
     let private withCoverageToolConfiguration mainOnly processInfo =
@@ -83,7 +103,7 @@ module private Configuration =
     let withAllMethodsCoverageToolConfiguration =
         withCoverageToolConfiguration false
 
-    let withPassiveModeConfiguration (method : MethodBase) resultName processInfo =
+    let withPassiveModeConfiguration (method : MethodBase) resultName persistent processInfo =
         let configuration =
             {
                 passiveModeEnable = enabled
@@ -91,9 +111,50 @@ module private Configuration =
                 assemblyName = method.Module.Assembly.FullName
                 moduleName = method.Module.FullyQualifiedName
                 methodToken = method.MetadataToken.ToString()
+                persistent = if persistent then enabled else ""
             }
         withConfiguration configuration processInfo
 
+    [<EnvironmentConfiguration>]
+    type private SharedCoverageMapConfiguration = {
+        [<EnvironmentVariable("COVERAGE_TOOL_SHARED_MAP")>]
+        sharedMapPath: string
+    }
+
+    let withSharedCoverageMap (path : string) processInfo =
+        withConfiguration { sharedMapPath = path } processInfo
+
+    [<EnvironmentConfiguration>]
+    type private GranularityConfiguration = {
+        [<EnvironmentVariable("COVERAGE_TOOL_GRANULARITY")>]
+        granularity: string
+    }
+
+    // "method", "block", "edge" or "full"
+    let withInstrumentationGranularity (granularity : string) processInfo =
+        withConfiguration { granularity = granularity } processInfo
+
+    [<EnvironmentConfiguration>]
+    type private ILCacheConfiguration = {
+        [<EnvironmentVariable("COVERAGE_TOOL_IL_CACHE")>]
+        ilCachePath: string
+    }
+
+    // rewritten method bodies are reused by the next runs with the same cache file
+    let withILCache (path : string) processInfo =
+        withConfiguration { ilCachePath = path } processInfo
+
+    [<EnvironmentConfiguration>]
+    type private StackLimitConfiguration = {
+        [<EnvironmentVariable("COVERAGE_TOOL_STACK_LIMIT")>]
+        stackLimit: string
+    }
+
+    // bytes of the stack an invocation may use before a stack overflow is predicted;
+    // without the limit, or with 0, nothing is predicted
+    let withStackLimit (bytes : int64) processInfo =
+        withConfiguration { stackLimit = bytes.ToString() } processInfo
+
     let isCoverageToolAttached () = isConfigured<BaseCoverageToolConfiguration> ()
 
 type InteractionCoverageTool() =
@@ -120,6 +181,31 @@ type InteractionCoverageTool() =
         Marshal.Copy(dataPtr, data, 0, size)
         data
 
+    member this.GetProfilerStats () =
+        let sizePtr = NativePtr.stackalloc<uint> 1
+        let dataPtrPtr = NativePtr.stackalloc<nativeint> 1
+
+        ExternalCalls.GetProfilerStats(NativePtr.toNativeInt sizePtr, NativePtr.toNativeInt dataPtrPtr)
+
+        let size = NativePtr.read sizePtr |> int
+        let dataPtr = NativePtr.read dataPtrPtr
+
+        let data = Array.zeroCreate<byte> size
+        Marshal.Copy(dataPtr, data, 0, size)
+
+        let stats = Dictionary<string, uint64>()
+        let mutable offset = 0
+        let count = System.BitConverter.ToInt32(data, offset)
+        offset <- offset + sizeof<int>
+        for _ in 1 .. count do
+            let nameLength = System.BitConverter.ToInt32(data, offset)
+            offset <- offset + sizeof<int>
+            let name = System.Text.Encoding.ASCII.GetString(data, offset, nameLength)
+            offset <- offset + nameLength
+            stats[name] <- System.BitConverter.ToUInt64(data, offset)
+            offset <- offset + sizeof<uint64>
+        stats
+
     member this.SetEntryMain (assembly : Assembly) (moduleName : string) (methodToken : int) =
         entryMainWasSet <- true
         let assemblyNamePtr = fixed assembly.FullName.ToCharArray()
@@ -135,23 +221,76 @@ type InteractionCoverageTool() =
             methodToken
         )
 
+    // Returns the id of the target, its invocations are recorded until the target is removed;
+    // the target method must not be jitted before it is added
+    member this.AddEntryTarget (assembly : Assembly) (moduleName : string) (methodToken : int) =
+        entryMainWasSet <- true
+        let assemblyNamePtr = fixed assembly.FullName.ToCharArray()
+        let moduleNamePtr = fixed moduleName.ToCharArray()
+        let assemblyNameLength = assembly.FullName.Length
+        let moduleNameLength = moduleName.Length
+
+        ExternalCalls.AddEntryTarget(
+            castPtr assemblyNamePtr,
+            assemblyNameLength,
+            castPtr moduleNamePtr,
+            moduleNameLength,
+            methodToken
+        )
+
+    member this.RemoveEntryTarget (targetId : int) =
+        ExternalCalls.RemoveEntryTarget(targetId) <> 0
+
+    // Number of edges of the shared coverage map first hit by this process since the last call
+    member this.TakeSharedMapNewEdges () =
+        ExternalCalls.TakeSharedMapNewEdges()
+
     member this.SetCurrentThreadId id =
         ExternalCalls.SetCurrentThreadId(id)
 
+    // Marks the current stack depth as the bottom of the next invocation run by the thread;
+    // without the mark, the frame of the entered main is the bottom
+    member this.SetStackBottom () =
+        ExternalCalls.SetStackBottom()
+
+    // Id set by 'SetCurrentThreadId' of a thread, whose running invocation is predicted
+    // to overflow the stack, or None; every prediction is returned once
+    member this.TakeStackOverflowPrediction () =
+        match ExternalCalls.TakeStackOverflowPrediction() with
+        | -1 -> None
+        | threadId -> Some threadId
+
     static member WithCoverageTool (procInfo : ProcessStartInfo) =
         Configuration.withMainOnlyCoverageToolConfiguration procInfo
 
+    // Creates the edge map shared by the worker processes; 'size' must be a power of two bytes
+    static member CreateSharedCoverageMap (path : string) (size : int64) =
+        if size < 8L || (size &&& (size - 1L)) <> 0L then
+            invalidArg (nameof size) "Shared coverage map size must be a power of two"
+        use file = new FileStream(path, FileMode.Create, FileAccess.ReadWrite, FileShare.ReadWrite)
+        file.SetLength size
+
+    static member WithSharedCoverageMap (path : string) (procInfo : ProcessStartInfo) =
+        Configuration.withSharedCoverageMap path procInfo
+
+    // Rewritten method bodies are kept in the file at 'path' and reused by the next processes launched with it
+    static member WithILCache (path : string) (procInfo : ProcessStartInfo) =
+        Configuration.withILCache path procInfo
+
+    // Enables 'TakeStackOverflowPrediction' for invocations using more than 'bytes' of the stack
+    static member WithStackLimit (bytes : int64) (procInfo : ProcessStartInfo) =
+        Configuration.withStackLimit bytes procInfo
+
 type PassiveCoverageTool(workingDirectory: DirectoryInfo, method: MethodBase) =
 
     let resultName = "coverage.cov"
 
-    let getHistory () =
+    let getHistory deserialize =
         let coverageFile = workingDirectory.EnumerateFiles(resultName) |> Seq.tryHead
         match coverageFile with
         | Some coverageFile ->
             File.ReadAllBytes(coverageFile.FullName)
-            |> CoverageDeserializer.getRawReports
-            |> CoverageDeserializer.reportsFromRawReports
+            |> deserialize
             |> Some
         | None -> None
 
@@ -166,49 +305,74 @@ type PassiveCoverageTool(workingDirectory: DirectoryInfo, method: MethodBase) =
         if allCovered then
             Logger.writeLine "All blocks are covered"
 
-    let computeCoverage (cfg: CfgInfo) (visited: CoverageReport[]) =
+    let computeCoverage (cfg: CfgInfo) (visited: RawCoverageReports) =
         let visitedBlocks = HashSet<BasicBlock>()
 
         let token = method.MetadataToken
         let moduleName = method.Module.FullyQualifiedName
-        for coverageReport in visited do
-            for loc in coverageReport.coverageLocations do
-                // Filtering coverage records that are only relevant to this method
-                if loc.methodToken = token && loc.moduleName = moduleName then
-                    let offset = Offset.from loc.offset
-                    let block = cfg.ResolveBasicBlock offset
-                    if block.FinalOffset = offset then
-                        visitedBlocks.Add block |> ignore
+        for KeyValue(methodId, methodInfo) in visited.methods do
+            // Filtering coverage records that are only relevant to this method
+            if int methodInfo.methodToken = token && methodInfo.moduleName = moduleName then
+                let blockOffsets = methodInfo.blockOffsets
+                let covered = CoveredBlocks.create blockOffsets.Length
+                for coverageReport in visited.reports do
+                    for blocks in coverageReport.coveredBlocks do
+                        if blocks.methodId = methodId then
+                            CoveredBlocks.merge covered blocks.bitset
+                Logger.trace $"Covered {CoveredBlocks.count covered} of {blockOffsets.Length} probe sites of {method.Name}"
+                for i in 0 .. blockOffsets.Length - 1 do
+                    if CoveredBlocks.isCovered covered i then
+                        let offset = Offset.from (int blockOffsets[i])
+                        let block = cfg.ResolveBasicBlock offset
+                        if block.FinalOffset = offset then
+                            visitedBlocks.Add block |> ignore
 
         printCoverage cfg.SortedBasicBlocks visitedBlocks
         let coveredSize = visitedBlocks |> Seq.sumBy (fun x -> x.BlockSize)
         (double coveredSize) / (double cfg.MethodSize) * 100. |> int
 
-    member this.RunWithCoverage (args: string) =
+    let runWithCoverage (args: string) persistent =
         let procInfo = ProcessStartInfo()
         procInfo.Arguments <- args
         procInfo.FileName <- DotnetExecutablePath.ExecutablePath
         procInfo.WorkingDirectory <- workingDirectory.FullName
         Configuration.withMainOnlyCoverageToolConfiguration procInfo
-        Configuration.withPassiveModeConfiguration method resultName procInfo
+        Configuration.withPassiveModeConfiguration method resultName persistent procInfo
+        // only the covered blocks are read; blocks of the CFG also end at calls, static field stores are not needed
+        Configuration.withInstrumentationGranularity "edge" procInfo
+
+        let proc = procInfo.StartWithLogging(
+            (fun x -> Logger.info $"{x}"),
+            (fun x -> Logger.error $"{x}")
+        )
+        proc.WaitForExit()
+        if not <| proc.IsSuccess() then
+            Logger.error $"Run with coverage failed with exit code: {proc.ExitCode}"
+        proc.IsSuccess()
 
+    member this.RunWithCoverage (args: string) =
         let method = Application.getMethod method
         if not method.HasBody then
             Logger.warning "CoverageRunner was given a method without body; 100%% coverage assumed"
             100
-        else
-            let proc = procInfo.StartWithLogging(
-                (fun x -> Logger.info $"{x}"),
-                (fun x -> Logger.error $"{x}")
-            )
-            proc.WaitForExit()
-
-            if proc.IsSuccess() then
-                match getHistory () with
-                | Some history -> computeCoverage method.CFG history
-                | None ->
-                    Logger.error "Failed to retrieve coverage locations"
-                    -1
-            else
-                Logger.error $"Run with coverage failed with exit code: {proc.ExitCode}"
+        elif runWithCoverage args false then
+            match getHistory CoverageDeserializer.getRawReports with
+            | Some history -> computeCoverage method.CFG history
+            | None ->
+                Logger.error "Failed to retrieve coverage locations"
                 -1
+        else -1
+
+    /// Runs all tests in one process, the test runner marks the tests, so coverage is computed per test
+    member this.RunWithCoveragePerTest (args: string) =
+        let method = Application.getMethod method
+        let result = Dictionary<string, int>()
+        if not method.HasBody then
+            Logger.warning "CoverageRunner was given a method without body; 100%% coverage assumed"
+        elif runWithCoverage args true then
+            match getHistory CoverageDeserializer.getTestReports with
+            | Some tests ->
+                for testName, history in tests do
+                    result[testName] <- computeCoverage method.CFG history
+            | None -> Logger.error "Failed to retrieve coverage locations"
+        result
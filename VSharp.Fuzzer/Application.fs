@@ -44,11 +44,14 @@ type internal Application (fuzzerOptions: Startup.FuzzerOptions) =
                     let method = Application.getMethod methodBase
                     traceFuzzing $"Resolved Method {methodToken}"
 
-                    coverageTool.SetEntryMain assembly moduleName methodToken
-                    traceFuzzing $"Was set entry main {moduleName} {methodToken}"
-
-                    (fuzzer.AsyncFuzz method).Wait()
-                    traceFuzzing $"Successfully fuzzed {moduleName} {methodToken}"
+                    let entryTarget = coverageTool.AddEntryTarget assembly moduleName methodToken
+                    traceFuzzing $"Was added entry target {moduleName} {methodToken}"
+
+                    try
+                        (fuzzer.AsyncFuzz method).Wait()
+                        traceFuzzing $"Successfully fuzzed {moduleName} {methodToken}"
+                    finally
+                        coverageTool.RemoveEntryTarget entryTarget |> ignore
 
                     (masterProcessService.NotifyFinished (UnitData())).Wait()
                     traceFuzzing $"Notified master process: finished {moduleName} {methodToken}"
@@ -139,10 +139,29 @@ module Services =
                 let rawData =
                     data.rawData
                     |> Array.map (fun x ->
-                        if x.rawCoverageLocations = null then
-                            {x with rawCoverageLocations = [||] }
+                        let x =
+                            if x.rawCoverageLocations = null then
+                                {x with rawCoverageLocations = [||] }
+                            else x
+                        let x =
+                            if x.coveredBlocks = null then
+                                {x with coveredBlocks = [||] }
+                            else x
+                        let x =
+                            if x.comparisons = null then
+                                {x with comparisons = [||] }
+                            else x
+                        let x =
+                            if x.hitCounts = null then
+                                {x with hitCounts = [||] }
+                            else x
+                        if x.paths = null then
+                            {x with paths = [||] }
                         else x
                 )
+                for KeyValue(methodId, methodInfo) in Seq.toArray data.methods do
+                    if methodInfo.firstHits = null then
+                        data.methods[methodId] <- {methodInfo with firstHits = [||] }
                 onTrackCoverage data.methods rawData
             member this.TrackExecutionSeed data =
                 traceData data
@@ -19,6 +19,7 @@ module private CancellableThreads =
     let private internalAbort = typeof<System.Runtime.ControlledExecution>.GetMethod("AbortThread", Reflection.allBindingFlags)
     let private internalGetThreadHandle = typeof<Thread>.GetMethod("GetNativeHandle", Reflection.allBindingFlags)
     let private abortedWasTrying = HashSet<int>()
+    let private aborts = Dictionary<int, unit -> unit>()
     let mutable private cancellableThreadStartedCount = 0
     let private cancellableThreadHandledCount = ref 0
 
@@ -30,28 +31,39 @@ module private CancellableThreads =
             thread.Start()
             thread
 
+        // called both on the cancellation and on the stack overflow prediction
         let abortThread () =
-            if systemThread.IsAlive then
-                abortedWasTrying.Add(threadId) |> ignore
-                traceFuzzing $"Start aborting: {systemThread.ManagedThreadId}"
-                let nativeHandle = internalGetThreadHandle.Invoke(systemThread, [||])
-                internalAbort.Invoke(null, [| nativeHandle |]) |> ignore
-                systemThread.Join()
-                traceFuzzing $"Aborted: {systemThread.ManagedThreadId}"
-                Interlocked.Increment(cancellableThreadHandledCount) |> ignore
-                Logger.error $"{cancellableThreadStartedCount} = {cancellableThreadHandledCount.Value}"
-            else
-                traceFuzzing $"Thread is dead: {systemThread.ManagedThreadId}"
+            lock systemThread (fun () ->
+                if systemThread.IsAlive then
+                    lock abortedWasTrying (fun () -> abortedWasTrying.Add(threadId) |> ignore)
+                    traceFuzzing $"Start aborting: {systemThread.ManagedThreadId}"
+                    let nativeHandle = internalGetThreadHandle.Invoke(systemThread, [||])
+                    internalAbort.Invoke(null, [| nativeHandle |]) |> ignore
+                    systemThread.Join()
+                    traceFuzzing $"Aborted: {systemThread.ManagedThreadId}"
+                    Interlocked.Increment(cancellableThreadHandledCount) |> ignore
+                    Logger.error $"{cancellableThreadStartedCount} = {cancellableThreadHandledCount.Value}"
+                else
+                    traceFuzzing $"Thread is dead: {systemThread.ManagedThreadId}"
+            )
 
         Action abortThread |> cancellationToken.Register |> ignore
+        lock aborts (fun () -> aborts[threadId] <- abortThread)
         systemThread
 
-    let wasAbortTried = abortedWasTrying.Contains
+    let abort threadId =
+        match lock aborts (fun () -> aborts.TryGetValue threadId) with
+        | true, abortThread -> abortThread ()
+        | _ -> ()
+
+    let wasAbortTried threadId = lock abortedWasTrying (fun () -> abortedWasTrying.Contains threadId)
 
     let waitAllThreadsHandled () =
         let spinner = SpinWait()
         while cancellableThreadStartedCount <> cancellableThreadHandledCount.Value do
             spinner.SpinOnce()
+        // the threads of the batch are not aborted anymore
+        lock aborts (fun () -> aborts.Clear())
 
 type internal Fuzzer(
     fuzzerOptions: FuzzerOptions,
@@ -84,6 +96,7 @@ type internal Fuzzer(
     let mutable ignoredCount = 0
 
     let stopwatch = Stopwatch()
+    let stackOverflowPollingInterval = 10
     let getAvailableTime () =
         fuzzerOptions.timeLimitPerMethod - int stopwatch.ElapsedMilliseconds
 
@@ -106,6 +119,7 @@ type internal Fuzzer(
     let fuzzOnce method (generationDatas: GenerationData[]) (results: InvocationResult[]) i threadId =
         fun () ->
             coverageTool.SetCurrentThreadId threadId
+            coverageTool.SetStackBottom ()
             let generationData = generationDatas[i]
             results[i] <- invoke method generationData.this generationData.args
 
@@ -156,7 +170,18 @@ type internal Fuzzer(
                         fuzzingCancellationTokenSource.Token
                 )
             fuzzingCancellationTokenSource.CancelAfter(availableTime)
-            threads |> Array.iter (fun t -> t.Join())
+            // invocations going to overflow the stack are aborted before the overflow kills the process
+            let rec abortPredictedOverflows () =
+                match coverageTool.TakeStackOverflowPrediction () with
+                | Some threadId ->
+                    traceFuzzing $"Stack overflow predicted, aborting: {threadId}"
+                    CancellableThreads.abort threadId
+                    abortPredictedOverflows ()
+                | None -> ()
+            for thread in threads do
+                while not <| thread.Join(stackOverflowPollingInterval) do
+                    abortPredictedOverflows ()
+            abortPredictedOverflows ()
             CancellableThreads.waitAllThreadsHandled ()
             traceFuzzing "Method invoked"
 
@@ -218,7 +243,7 @@ type internal Fuzzer(
             let indices = [|0..batchSize - 1|]
             traceFuzzing "Coverage requested"
             let rawCoverage = coverageTool.GetRawHistory()
-            traceFuzzing "Coverage received"
+            traceFuzzing $"Coverage received, new shared map edges: {coverageTool.TakeSharedMapNewEdges ()}"
             let coverages = CoverageDeserializer.getRawReports rawCoverage
             traceFuzzing $"Coverage reports[{coverages.reports.Length}] deserialized"
             assert (coverages.reports.Length = batchSize)
@@ -258,6 +283,8 @@ type internal Fuzzer(
                         abortedCount <- abortedCount + 1
                     | _ ->
                         traceFuzzing "Invoked"
+                        if CoverageEvents.isStackOverflowPredicted coverage then
+                            traceFuzzing "Stack overflow predicted"
                         assert(not <| Utils.isNull invocationResult)
                         if isNewCoverage then
                             onNewCoverage generationData invocationResult
@@ -40,6 +40,12 @@ let internal fuzzerOptionsFromEnv () =
 let internal getLogPath () =
     fromEnv "LOG_PATH"
 
+// edge map shared by the fuzzer processes of one run, 64 KiB keeps collisions rare for a single assembly
+let private sharedCoverageMapSize = 65536L
+
+// invocations deeper than this are stopped before they overflow, kept below the 1 MB default stack of Windows threads
+let private stackOverflowPredictionLimit = 768L * 1024L
+
 let internal waitDebuggerAttached () =
     let value = Environment.GetEnvironmentVariable("WAIT_DEBUGGER_ATTACHED_FUZZER")
     if value = "1" then
@@ -65,6 +71,14 @@ let internal startFuzzer options developerOptions =
         info.RedirectStandardOutput <- true
 
     InteractionCoverageTool.WithCoverageTool info
+    // restarted fuzzer processes keep the edges found by the previous ones
+    let sharedCoverageMapPath = IO.Path.Combine(options.outputDir, "coverage.map")
+    if not <| IO.File.Exists sharedCoverageMapPath then
+        InteractionCoverageTool.CreateSharedCoverageMap sharedCoverageMapPath sharedCoverageMapSize
+    InteractionCoverageTool.WithSharedCoverageMap sharedCoverageMapPath info
+    InteractionCoverageTool.WithStackLimit stackOverflowPredictionLimit info
+    // restarted fuzzer processes do not rewrite the methods again
+    InteractionCoverageTool.WithILCache (IO.Path.Combine(options.outputDir, "il.cache")) info
     let proc = System.Diagnostics.Process.Start info
 
     let stderrTag = "Fuzzer STDERR"
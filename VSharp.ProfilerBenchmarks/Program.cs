@@ -0,0 +1,306 @@
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.Reflection;
+using System.Runtime;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace VSharp.ProfilerBenchmarks
+{
+    // Small workloads measuring the overhead of the profilers, each stresses one kind of probes
+    public static class Workloads
+    {
+        public static long Loops(int scale)
+        {
+            long sum = 0;
+            for (int i = 0; i < scale * 1000000; i++)
+            {
+                if (i % 3 == 0)
+                    sum += i;
+                else if (i % 5 == 0)
+                    sum -= i / 5;
+                else
+                    sum ^= i;
+            }
+            return sum;
+        }
+
+        private static int Fibonacci(int n)
+        {
+            return n < 2 ? n : Fibonacci(n - 1) + Fibonacci(n - 2);
+        }
+
+        private static int Ackermann(int m, int n)
+        {
+            if (m == 0)
+                return n + 1;
+            if (n == 0)
+                return Ackermann(m - 1, 1);
+            return Ackermann(m - 1, Ackermann(m, n - 1));
+        }
+
+        public static long Recursion(int scale)
+        {
+            long sum = 0;
+            for (int i = 0; i < scale; i++)
+                sum += Fibonacci(25) + Ackermann(2, 200);
+            return sum;
+        }
+
+        private static void Validate(int value)
+        {
+            if (value % 7 == 0)
+                throw new ArgumentException("Divisible by seven", nameof(value));
+            if (value % 11 == 0)
+                throw new InvalidOperationException("Divisible by eleven");
+        }
+
+        private static int ThrowDeep(int depth)
+        {
+            if (depth == 0)
+                throw new InvalidOperationException("Bottom reached");
+            try
+            {
+                return ThrowDeep(depth - 1);
+            }
+            finally
+            {
+                depth++;
+            }
+        }
+
+        public static long Exceptions(int scale)
+        {
+            long caught = 0;
+            for (int i = 0; i < scale * 5000; i++)
+            {
+                try
+                {
+                    Validate(i);
+                }
+                catch (ArgumentException)
+                {
+                    caught++;
+                }
+                catch (InvalidOperationException e) when (e.Message.Length > 0)
+                {
+                    caught += 2;
+                }
+                try
+                {
+                    if (i % 10 == 0)
+                        ThrowDeep(20);
+                }
+                catch (InvalidOperationException)
+                {
+                    caught++;
+                }
+            }
+            return caught;
+        }
+
+        private sealed class Node
+        {
+            public readonly int Value;
+            public Node Next;
+            public readonly int[] Payload;
+
+            public Node(int value, Node next)
+            {
+                Value = value;
+                Next = next;
+                Payload = new int[value % 16 + 1];
+            }
+        }
+
+        public static long Allocations(int scale)
+        {
+            long sum = 0;
+            for (int round = 0; round < scale * 20; round++)
+            {
+                Node list = null;
+                for (int i = 0; i < 20000; i++)
+                    list = new Node(i, list);
+                var strings = new List<string>();
+                for (int i = 0; i < 2000; i++)
+                    strings.Add(i.ToString(CultureInfo.InvariantCulture) + ":" + round);
+                for (var node = list; node != null; node = node.Next)
+                    sum += node.Value + node.Payload.Length;
+                sum += strings.Count;
+            }
+            return sum;
+        }
+
+        private static long sharedCounter;
+        private static readonly object Lock = new object();
+
+        public static long Threads(int scale)
+        {
+            var threads = new Thread[Environment.ProcessorCount];
+            long locked = 0;
+            for (int t = 0; t < threads.Length; t++)
+            {
+                threads[t] = new Thread(() =>
+                {
+                    for (int i = 0; i < scale * 100000; i++)
+                    {
+                        Interlocked.Increment(ref sharedCounter);
+                        if (i % 64 == 0)
+                        {
+                            lock (Lock)
+                                locked++;
+                        }
+                    }
+                });
+                threads[t].Start();
+            }
+            foreach (var thread in threads)
+                thread.Join();
+            var tasks = new Task<long>[threads.Length * 4];
+            for (int t = 0; t < tasks.Length; t++)
+            {
+                int seed = t;
+                tasks[t] = Task.Run(() => Loops(1) + seed);
+            }
+            Task.WaitAll(tasks);
+            return sharedCounter + locked + tasks.Length;
+        }
+
+        private interface IShape
+        {
+            double Area();
+        }
+
+        private readonly struct Square : IShape
+        {
+            private readonly double side;
+            public Square(double side) { this.side = side; }
+            public double Area() => side * side;
+        }
+
+        private sealed class Circle : IShape
+        {
+            private readonly double radius;
+            public Circle(double radius) { this.radius = radius; }
+            public double Area() => Math.PI * radius * radius;
+        }
+
+        private static T Max<T>(IReadOnlyList<T> items) where T : IComparable<T>
+        {
+            T max = items[0];
+            for (int i = 1; i < items.Count; i++)
+                if (items[i].CompareTo(max) > 0)
+                    max = items[i];
+            return max;
+        }
+
+        private static double TotalArea<T>(T[] shapes) where T : IShape
+        {
+            double total = 0;
+            foreach (var shape in shapes)
+                total += shape.Area();
+            return total;
+        }
+
+        private static Dictionary<TKey, int> Histogram<TKey>(IEnumerable<TKey> keys)
+        {
+            var result = new Dictionary<TKey, int>();
+            foreach (var key in keys)
+            {
+                result.TryGetValue(key, out var count);
+                result[key] = count + 1;
+            }
+            return result;
+        }
+
+        public static long Generics(int scale)
+        {
+            double sum = 0;
+            var ints = new List<int>();
+            var strings = new List<string>();
+            var squares = new Square[1000];
+            var circles = new Circle[1000];
+            for (int i = 0; i < 1000; i++)
+            {
+                ints.Add(i * 7919 % 1000);
+                strings.Add((i % 100).ToString(CultureInfo.InvariantCulture));
+                squares[i] = new Square(i);
+                circles[i] = new Circle(i);
+            }
+            for (int round = 0; round < scale * 200; round++)
+            {
+                sum += Max(ints) + Max(strings).Length;
+                sum += TotalArea(squares) + TotalArea(circles);
+                sum += Histogram(ints).Count + Histogram(strings).Count;
+            }
+            return (long)sum;
+        }
+    }
+
+    public static class Program
+    {
+        private static readonly Dictionary<string, Func<int, long>> All = new Dictionary<string, Func<int, long>>
+        {
+            ["loops"] = Workloads.Loops,
+            ["recursion"] = Workloads.Recursion,
+            ["exceptions"] = Workloads.Exceptions,
+            ["allocations"] = Workloads.Allocations,
+            ["threads"] = Workloads.Threads,
+            ["generics"] = Workloads.Generics
+        };
+
+        private static string Escape(string value)
+        {
+            return value.Replace("\\", "\\\\").Replace("\"", "\\\"");
+        }
+
+        // Usage: <workload> [scale] | --list | --describe
+        public static int Main(string[] args)
+        {
+            if (args.Length == 0)
+            {
+                Console.Error.WriteLine("Usage: VSharp.ProfilerBenchmarks <workload> [scale] | --list | --describe");
+                return 1;
+            }
+
+            if (args[0] == "--list")
+            {
+                foreach (var name in All.Keys)
+                    Console.WriteLine(name);
+                return 0;
+            }
+
+            if (args[0] == "--describe")
+            {
+                // the profilers are configured by the entry method, the driver takes it from here
+                var main = MethodBase.GetCurrentMethod();
+                Console.WriteLine(
+                    $"{{\"assembly\": \"{Escape(main.Module.Assembly.FullName)}\", " +
+                    $"\"module\": \"{Escape(main.Module.FullyQualifiedName)}\", " +
+                    $"\"token\": {main.MetadataToken}}}");
+                return 0;
+            }
+
+            if (!All.TryGetValue(args[0], out var workload))
+            {
+                Console.Error.WriteLine($"Unknown workload '{args[0]}'");
+                return 1;
+            }
+            int scale = args.Length > 1 ? int.Parse(args[1], CultureInfo.InvariantCulture) : 1;
+
+            var stopwatch = Stopwatch.StartNew();
+            long result = workload(scale);
+            stopwatch.Stop();
+
+            Console.WriteLine(
+                $"BENCHMARK_RESULT {{\"result\": {result}, " +
+                $"\"workload_ms\": {stopwatch.Elapsed.TotalMilliseconds.ToString(CultureInfo.InvariantCulture)}, " +
+                $"\"jit_ms\": {JitInfo.GetCompilationTime().TotalMilliseconds.ToString(CultureInfo.InvariantCulture)}, " +
+                $"\"jitted_methods\": {JitInfo.GetCompiledMethodCount()}, " +
+                $"\"jitted_il_bytes\": {JitInfo.GetCompiledILBytes()}}}");
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,124 @@
+"""Stub of the concolic server: echoes every method body back to libvsharpConcolic without instrumentation.
+
+It speaks the protocol of VSharp.ClrInteraction/communication/protocol.cpp, so the measured overhead
+is the cost of the profiler callbacks and of the round trips, not of the symbolic execution.
+"""
+
+import os
+import socket
+import struct
+import sys
+import threading
+
+CONFIRMATION = 0x55
+READ_METHOD_BODY = 0x58
+
+
+class ProtocolError(Exception):
+    pass
+
+
+class ConcolicStub:
+    def __init__(self, pipe_path, module_name, method_token, debug_protocol=False):
+        self.pipe_path = pipe_path
+        self.module_name = module_name
+        self.method_token = method_token
+        # profilers built with _DEBUG wait for a command before every method body
+        self.debug_protocol = debug_protocol
+        self.methods = 0
+        self.bytes_received = 0
+        self.error = None
+        self._socket = None
+        self._thread = None
+
+    def start(self):
+        if os.path.exists(self.pipe_path):
+            os.unlink(self.pipe_path)
+        self._socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._socket.bind(self.pipe_path)
+        self._socket.listen(1)
+        self._thread = threading.Thread(target=self._serve, daemon=True)
+        self._thread.start()
+
+    def stop(self, timeout=10):
+        self._thread.join(timeout)
+        self._socket.close()
+        if os.path.exists(self.pipe_path):
+            os.unlink(self.pipe_path)
+
+    def _serve(self):
+        try:
+            connection, _ = self._socket.accept()
+            with connection:
+                self._session(connection)
+        except (OSError, ProtocolError) as e:
+            self.error = str(e)
+
+    @staticmethod
+    def _read_exactly(connection, count):
+        data = bytearray()
+        while len(data) < count:
+            chunk = connection.recv(count - len(data))
+            if not chunk:
+                raise ProtocolError(f"connection closed, expected {count} bytes, got {len(data)}")
+            data.extend(chunk)
+        return bytes(data)
+
+    def _read_confirmation(self, connection):
+        if self._read_exactly(connection, 1)[0] != CONFIRMATION:
+            raise ProtocolError("confirmation expected")
+
+    def _write_buffer(self, connection, data):
+        connection.sendall(struct.pack("<i", len(data)))
+        self._read_confirmation(connection)
+        connection.sendall(data)
+        self._read_confirmation(connection)
+
+    # returns None when the profiler shuts down
+    def _read_buffer(self, connection):
+        count = struct.unpack("<i", self._read_exactly(connection, 4))[0]
+        if count == -1:
+            return None
+        connection.sendall(bytes([CONFIRMATION]))
+        data = self._read_exactly(connection, count)
+        connection.sendall(bytes([CONFIRMATION]))
+        self.bytes_received += count + 4
+        return data
+
+    def _session(self, connection):
+        self._write_buffer(connection, b"Hi!\0")
+        if self._read_buffer(connection) != b"Hi!":
+            raise ProtocolError("handshake failed")
+        # probe addresses are not needed, the bodies are not instrumented
+        self._read_buffer(connection)
+
+        name = self.module_name.encode("utf-16-le")
+        entry_point = struct.pack("<ii", len(self.module_name), self.method_token) + name
+        self._write_buffer(connection, entry_point)
+
+        while True:
+            command = self._read_buffer(connection)
+            if command is None:
+                return
+            body = self._read_buffer(connection)
+            if body is None:
+                return
+            self.methods += 1
+            token, code_length, assembly_length, module_length, max_stack, tokens_length = \
+                struct.unpack_from("<6I", body)
+            code_start = 6 * 4 + tokens_length + assembly_length + module_length
+            code = body[code_start:code_start + code_length]
+            ehs = body[code_start + code_length:]
+            if self.debug_protocol:
+                self._write_buffer(connection, bytes([READ_METHOD_BODY]))
+            self._write_buffer(connection, struct.pack("<iI", code_length, max_stack) + code + ehs)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 4:
+        print("Usage: concolic_stub.py <pipe path> <module path> <method token> [--debug-protocol]", file=sys.stderr)
+        sys.exit(1)
+    stub = ConcolicStub(sys.argv[1], sys.argv[2], int(sys.argv[3]), "--debug-protocol" in sys.argv[4:])
+    stub.start()
+    stub.stop(timeout=None)
+    print(f"methods: {stub.methods}, bytes received: {stub.bytes_received}, error: {stub.error}")
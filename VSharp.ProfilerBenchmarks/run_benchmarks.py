@@ -0,0 +1,209 @@
+"""Measures the overhead of libvsharpCoverage and libvsharpConcolic on the workloads of this project.
+
+Every workload is run without a profiler, with the coverage profiler in each mode and, when the concolic
+profiler is given, with it against a local stub server. The medians of wall time, JIT time, peak RSS and
+bytes of coverage emitted are written as JSON. Runs are offline and Linux-only (peak RSS comes from wait4).
+"""
+
+import argparse
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from concolic_stub import ConcolicStub
+
+PROFILER_GUID = "{2800fea6-9667-4b42-a2b6-45dc98e77e9e}"
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+RESULT_PATTERN = re.compile(r"^BENCHMARK_RESULT (\{.*\})$", re.MULTILINE)
+
+# the concolic profiler sends method bodies over one connection without synchronization,
+# so it supports single-threaded targets only
+CONCOLIC_UNSUPPORTED = {"threads"}
+# besides the passive coverage of Main only, every method of the benchmark assembly, at each instrumentation granularity
+COVERAGE_GRANULARITIES = ["method", "block", "edge", "full"]
+
+
+def build_workloads(configuration):
+    output = os.path.join(SCRIPT_DIR, "bin", "benchmarks")
+    subprocess.run(
+        ["dotnet", "build", os.path.join(SCRIPT_DIR, "VSharp.ProfilerBenchmarks.csproj"),
+         "-c", configuration, "-o", output, "--nologo", "-v", "quiet"],
+        check=True, stdout=subprocess.DEVNULL)
+    return os.path.join(output, "VSharp.ProfilerBenchmarks.dll")
+
+
+def describe(assembly):
+    output = subprocess.run(["dotnet", assembly, "--describe"], check=True, capture_output=True, text=True).stdout
+    return json.loads(output)
+
+
+def list_workloads(assembly):
+    output = subprocess.run(["dotnet", assembly, "--list"], check=True, capture_output=True, text=True).stdout
+    return output.split()
+
+
+def profiler_environment(library):
+    return {
+        "CORECLR_ENABLE_PROFILING": "1",
+        "CORECLR_PROFILER": PROFILER_GUID,
+        "CORECLR_PROFILER_PATH": library,
+    }
+
+
+def coverage_environment(library, entry, result_path, granularity):
+    environment = profiler_environment(library)
+    environment.update({
+        "COVERAGE_TOOL_ENABLE_PASSIVE": "1",
+        "COVERAGE_TOOL_RESULT_NAME": result_path,
+        "COVERAGE_TOOL_METHOD_ASSEMBLY_NAME": entry["assembly"],
+        "COVERAGE_TOOL_METHOD_MODULE_NAME": entry["module"],
+        "COVERAGE_TOOL_METHOD_TOKEN": str(entry["token"]),
+    })
+    if granularity is not None:
+        environment["COVERAGE_TOOL_INSTRUMENT_ASSEMBLIES"] = entry["assembly"].split(",")[0]
+        environment["COVERAGE_TOOL_GRANULARITY"] = granularity
+    return environment
+
+
+def run_measured(assembly, workload, scale, environment, timeout):
+    env = dict(os.environ)
+    # the profilers of the caller must not leak into the measured process
+    for name in list(env):
+        if name.startswith(("CORECLR_", "COVERAGE_TOOL_", "CONCOLIC_")):
+            del env[name]
+    env.update(environment)
+
+    with tempfile.TemporaryFile(mode="w+") as stdout, tempfile.TemporaryFile(mode="w+") as stderr:
+        start = time.monotonic()
+        process = subprocess.Popen(["dotnet", assembly, workload, str(scale)], env=env, stdout=stdout, stderr=stderr)
+        # the child is reaped with wait4 to get its own peak RSS
+        deadline = start + timeout
+        while True:
+            pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+            if pid != 0:
+                break
+            if time.monotonic() > deadline:
+                process.kill()
+                os.wait4(process.pid, 0)
+                return {"error": f"timed out after {timeout} s"}
+            time.sleep(0.005)
+        wall_ms = (time.monotonic() - start) * 1000
+        exit_code = os.waitstatus_to_exitcode(status)
+        stdout.seek(0)
+        stderr.seek(0)
+        output = stdout.read()
+        match = RESULT_PATTERN.search(output)
+        if exit_code != 0 or match is None:
+            return {"error": f"exit code {exit_code}: {stderr.read().strip()[-500:]}"}
+    result = json.loads(match.group(1))
+    result["wall_ms"] = wall_ms
+    # kilobytes on Linux
+    result["peak_rss_kb"] = usage.ru_maxrss
+    return result
+
+
+def median_of(runs, key):
+    values = [run[key] for run in runs if key in run]
+    return statistics.median(values) if values else None
+
+
+def measure(name, assembly, workload, args, environment_factory, after_run=None):
+    runs = []
+    for _ in range(args.repetitions):
+        environment, context = environment_factory()
+        run = run_measured(assembly, workload, args.scale, environment, args.timeout)
+        if after_run is not None:
+            after_run(run, context)
+        if "error" in run:
+            return {"mode": name, "error": run["error"]}
+        runs.append(run)
+    summary = {"mode": name}
+    for key in ["wall_ms", "workload_ms", "jit_ms", "jitted_methods", "peak_rss_kb", "coverage_bytes",
+                "concolic_methods", "concolic_bytes"]:
+        value = median_of(runs, key)
+        if value is not None:
+            summary[key] = value
+    return summary
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--coverage-lib", help="path to libvsharpCoverage.so, coverage modes are skipped without it")
+    parser.add_argument("--concolic-lib", help="path to libvsharpConcolic.so, the concolic mode is skipped without it")
+    parser.add_argument("--concolic-debug-protocol", action="store_true",
+                        help="the concolic profiler is a Debug build and expects commands before method bodies")
+    parser.add_argument("--workloads", nargs="*", help="workloads to run, all by default")
+    parser.add_argument("--scale", type=int, default=10, help="work done by each workload")
+    parser.add_argument("--repetitions", type=int, default=3, help="runs of every mode, medians are reported")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds before a run is killed")
+    parser.add_argument("--configuration", default="Release")
+    parser.add_argument("--output", help="JSON result file, standard output by default")
+    args = parser.parse_args()
+
+    assembly = build_workloads(args.configuration)
+    entry = describe(assembly)
+    workloads = args.workloads or list_workloads(assembly)
+    work_dir = tempfile.mkdtemp(prefix="vsharp-bench-")
+    coverage_path = os.path.join(work_dir, "coverage.bin")
+
+    def coverage_factory(granularity):
+        def factory():
+            if os.path.exists(coverage_path):
+                os.unlink(coverage_path)
+            return coverage_environment(args.coverage_lib, entry, coverage_path, granularity), None
+        return factory
+
+    def coverage_size(run, _):
+        if "error" not in run:
+            run["coverage_bytes"] = os.path.getsize(coverage_path) if os.path.exists(coverage_path) else 0
+
+    def concolic_factory():
+        pipe = os.path.join(work_dir, "concolic.sock")
+        stub = ConcolicStub(pipe, entry["module"], entry["token"], args.concolic_debug_protocol)
+        stub.start()
+        environment = profiler_environment(args.concolic_lib)
+        environment["CONCOLIC_PIPE"] = pipe
+        return environment, stub
+
+    def concolic_finished(run, stub):
+        stub.stop()
+        if stub.error is not None and "error" not in run:
+            run["error"] = f"concolic stub: {stub.error}"
+        run["concolic_methods"] = stub.methods
+        run["concolic_bytes"] = stub.bytes_received
+
+    results = []
+    for workload in workloads:
+        print(f"Running {workload}...", file=sys.stderr)
+        modes = [measure("baseline", assembly, workload, args, lambda: ({}, None))]
+        if args.coverage_lib is not None:
+            modes.append(measure("coverage-main", assembly, workload, args, coverage_factory(None), coverage_size))
+            for granularity in COVERAGE_GRANULARITIES:
+                modes.append(measure(f"coverage-{granularity}", assembly, workload, args,
+                                     coverage_factory(granularity), coverage_size))
+        if args.concolic_lib is not None and workload in CONCOLIC_UNSUPPORTED:
+            modes.append({"mode": "concolic", "skipped": "the concolic profiler supports single-threaded targets only"})
+        elif args.concolic_lib is not None:
+            modes.append(measure("concolic", assembly, workload, args, concolic_factory, concolic_finished))
+
+        baseline = modes[0].get("wall_ms")
+        for mode in modes[1:]:
+            if baseline and "wall_ms" in mode:
+                mode["slowdown"] = round(mode["wall_ms"] / baseline, 3)
+        results.append({"workload": workload, "scale": args.scale, "modes": modes})
+
+    report = json.dumps({"repetitions": args.repetitions, "results": results}, indent=2)
+    if args.output is not None:
+        with open(args.output, "w") as output:
+            output.write(report + "\n")
+    else:
+        print(report)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,4 +1,5 @@
 ﻿#nullable enable
+using System.Collections.Generic;
 using VSharp.Explorer;
 
 namespace VSharp.Test.Benchmarks;
@@ -8,5 +9,6 @@ public readonly record struct BenchmarkResult(
     SVMStatistics Statistics,
     UnitTests Tests,
     BenchmarkTarget Target,
-    int? Coverage = null
+    int? Coverage = null,
+    IReadOnlyDictionary<string, int>? TestsCoverage = null
 );
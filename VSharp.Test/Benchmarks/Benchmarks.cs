@@ -161,7 +161,12 @@ internal static class Benchmarks
 
         if (calculateCoverage)
         {
-            return result with { IsSuccessful = true, Coverage = GetMethodCoverage(result) };
+            return result with
+            {
+                IsSuccessful = true,
+                Coverage = GetMethodCoverage(result),
+                TestsCoverage = GetTestsCoverage(result)
+            };
         }
 
         return result with { IsSuccessful = true };
@@ -217,6 +222,22 @@ internal static class Benchmarks
         }
 
         testsStatsTable.Write();
+
+        foreach (var (title, results) in titleToResults)
+        {
+            if (results.TestsCoverage is null)
+            {
+                continue;
+            }
+
+            var testsCoverageTable = new ConsoleTable("Test", $"{title} coverage (with tool)");
+            foreach (var (testName, coverage) in results.TestsCoverage.OrderByDescending(tc => tc.Value))
+            {
+                testsCoverageTable.AddRow(testName, $"{coverage}%");
+            }
+
+            testsCoverageTable.Write();
+        }
     }
 
     private static int GetMethodCoverage(BenchmarkResult result)
@@ -231,6 +252,19 @@ internal static class Benchmarks
         return coverageTool.RunWithCoverage(runnerWithArgs);
     }
 
+    // All tests are run in one process, so the coverage of every test costs a single run
+    private static IReadOnlyDictionary<string, int> GetTestsCoverage(BenchmarkResult result)
+    {
+        if (result.Target.Method is null)
+        {
+            throw new Exception("Cannot get coverage of BenchmarkTarget without single method");
+        }
+
+        var runnerWithArgs = $"{TestRunnerPath} {result.Tests.TestDirectory}";
+        var coverageTool = new PassiveCoverageTool(result.Tests.TestDirectory, result.Target.Method);
+        return coverageTool.RunWithCoveragePerTest(runnerWithArgs);
+    }
+
     public static Assembly LoadBenchmarkAssembly(string suite, string dllFileName)
     {
         var dllPath = TestContext.Parameters["BenchmarkDllsPath"];
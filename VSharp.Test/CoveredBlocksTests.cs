@@ -0,0 +1,43 @@
+using NUnit.Framework;
+using VSharp;
+
+namespace UnitTests
+{
+    [TestFixture]
+    public sealed class CoveredBlocksTests
+    {
+        [Test]
+        public void CreateAllocatesWordPerSixtyFourBlocks()
+        {
+            Assert.AreEqual(0, CoveredBlocks.create(0).Length);
+            Assert.AreEqual(1, CoveredBlocks.create(1).Length);
+            Assert.AreEqual(1, CoveredBlocks.create(64).Length);
+            Assert.AreEqual(2, CoveredBlocks.create(65).Length);
+            Assert.AreEqual(0, CoveredBlocks.count(CoveredBlocks.create(130)));
+        }
+
+        [Test]
+        public void MergeUnitesBitsets()
+        {
+            var target = CoveredBlocks.create(70);
+            CoveredBlocks.merge(target, new ulong[] { 0x1UL, 0x20UL });
+            CoveredBlocks.merge(target, new ulong[] { 0x1UL | (1UL << 63) });
+            Assert.IsTrue(CoveredBlocks.isCovered(target, 0));
+            Assert.IsTrue(CoveredBlocks.isCovered(target, 63));
+            Assert.IsTrue(CoveredBlocks.isCovered(target, 69));
+            Assert.IsFalse(CoveredBlocks.isCovered(target, 1));
+            Assert.IsFalse(CoveredBlocks.isCovered(target, 64));
+            Assert.AreEqual(3, CoveredBlocks.count(target));
+        }
+
+        [Test]
+        public void MergeIgnoresWordsBeyondTarget()
+        {
+            var target = CoveredBlocks.create(10);
+            CoveredBlocks.merge(target, new ulong[] { 0x2UL, ulong.MaxValue });
+            Assert.AreEqual(1, target.Length);
+            Assert.IsTrue(CoveredBlocks.isCovered(target, 1));
+            Assert.AreEqual(1, CoveredBlocks.count(target));
+        }
+    }
+}
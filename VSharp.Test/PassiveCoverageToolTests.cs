@@ -0,0 +1,40 @@
+using System.IO;
+using System.Linq;
+using NUnit.Framework;
+using VSharp;
+using VSharp.CoverageTool;
+
+namespace UnitTests
+{
+    [TestFixture]
+    public sealed class PassiveCoverageToolTests
+    {
+        private static readonly string TestRunnerPath = typeof(VSharp.TestRunner.TestRunner).Assembly.Location;
+
+        public static int Sign(int x)
+        {
+            if (x > 0)
+                return 1;
+            if (x < 0)
+                return -1;
+            return 0;
+        }
+
+        [Test]
+        public void CoverageIsComputedForEveryTestOfOneRun()
+        {
+            var method = typeof(PassiveCoverageToolTests).GetMethod(nameof(Sign));
+            var outputDirectory = Path.Combine(Directory.GetCurrentDirectory(), "passiveCoverageToolTests");
+            var statistics = TestGenerator.Cover(method, new VSharpOptions(outputDirectory: outputDirectory));
+            var testsDir = statistics.OutputDir;
+
+            var coverageTool = new PassiveCoverageTool(testsDir, method);
+            var testsCoverage = coverageTool.RunWithCoveragePerTest($"{TestRunnerPath} {testsDir.FullName}");
+
+            var testNames = testsDir.EnumerateFiles("*.vst").Select(test => test.Name);
+            CollectionAssert.AreEquivalent(testNames, testsCoverage.Keys);
+            // every test takes one of the three returns, so none of them covers the whole method
+            Assert.IsTrue(testsCoverage.Values.All(coverage => coverage > 0 && coverage < 100));
+        }
+    }
+}
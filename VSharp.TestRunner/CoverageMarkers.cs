@@ -0,0 +1,34 @@
+using System;
+using System.Runtime.InteropServices;
+
+namespace VSharp.TestRunner
+{
+    /// <summary>
+    /// Marks test boundaries for the coverage tool working in the persistent passive mode.
+    /// </summary>
+    internal static class CoverageMarkers
+    {
+        [DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl)]
+        private static extern unsafe void BeginTest(char* testName, int testNameLength);
+
+        [DllImport("libvsharpCoverage", CallingConvention = CallingConvention.Cdecl)]
+        private static extern void EndTest();
+
+        private static readonly bool Enabled =
+            Environment.GetEnvironmentVariable("COVERAGE_TOOL_PERSISTENT") == "1";
+
+        public static unsafe void Begin(string testName)
+        {
+            if (!Enabled) return;
+            fixed (char* name = testName)
+            {
+                BeginTest(name, testName.Length);
+            }
+        }
+
+        public static void End()
+        {
+            if (Enabled) EndTest();
+        }
+    }
+}
@@ -147,7 +147,15 @@ namespace VSharp.TestRunner
 
             foreach (var testFileInfo in testsList)
             {
-                result &= ReproduceTest(testFileInfo, suiteType, true);
+                CoverageMarkers.Begin(testFileInfo.Name);
+                try
+                {
+                    result &= ReproduceTest(testFileInfo, suiteType, true);
+                }
+                finally
+                {
+                    CoverageMarkers.End();
+                }
             }
 
             return result;
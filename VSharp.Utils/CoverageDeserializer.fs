@@ -31,11 +31,71 @@ type RawMethodInfo = {
     methodToken: uint32
     moduleName: string
     assemblyName: string
+    // IL offsets of probe sites, indexed by block index
+    blockOffsets: uint32[]
+    // nanoseconds from the profiler start to the first hit per block index, 0 if not hit;
+    // empty unless COVERAGE_TOOL_FIRST_HITS is set
+    firstHits: uint64[]
+}
+
+type RawCoveredBlocks = {
+    methodId: int
+    blockCount: int
+    bitset: uint64[]
+}
+
+type ComparisonKind =
+    | Equal = 0
+    | NotEqual = 1
+    | Less = 2
+    | LessOrEqual = 3
+    | Greater = 4
+    | GreaterOrEqual = 5
+    | Switch = 6
+    | StringEquality = 7
+    | StringOrder = 8
+
+type RawComparison = {
+    offset: uint32
+    methodId: int
+    kind: ComparisonKind
+    // runtime operand for integer comparisons
+    left: int64
+    // constant operand for integer comparisons, number of targets for switches,
+    // length of the runtime operand for string comparisons (-1 if it is null)
+    right: int64
+    // compared literal for string comparisons, null otherwise
+    literal: string
+    // first 64 chars of the runtime operand for string comparisons, null otherwise
+    operand: string
+}
+
+type RawHitCount = {
+    methodId: int
+    offset: uint32
+    hits: uint64
+}
+
+// number of executions of a Ball-Larus path; the id identifies an acyclic path of the method
+type RawPathCount = {
+    methodId: int
+    pathId: int
+    hits: uint64
 }
 
 type RawCoverageReport = {
     threadId: int
     rawCoverageLocations: RawCoverageLocation[]
+    coveredBlocks: RawCoveredBlocks[]
+    // last compared operands, oldest first
+    comparisons: RawComparison[]
+    // the coverage budget was exceeded, so 'rawCoverageLocations' is incomplete
+    overflowed: bool
+    droppedRecords: uint64
+    // hits recorded after the overflow with the 'counts' policy
+    hitCounts: RawHitCount[]
+    // filled only if the path profiling is enabled
+    paths: RawPathCount[]
 }
 
 type RawCoverageReports = {
@@ -43,6 +103,30 @@ type RawCoverageReports = {
     reports: RawCoverageReport[]
 }
 
+module CoveredBlocks =
+
+    let create blockCount : uint64[] =
+        Array.zeroCreate ((blockCount + 63) / 64)
+
+    let merge (target : uint64[]) (source : uint64[]) =
+        for i in 0 .. min target.Length source.Length - 1 do
+            target[i] <- target[i] ||| source[i]
+
+    let isCovered (bitset : uint64[]) index =
+        bitset[index / 64] &&& (1UL <<< (index % 64)) <> 0UL
+
+    let count (bitset : uint64[]) =
+        bitset |> Array.sumBy System.Numerics.BitOperations.PopCount
+
+module CoverageEvents =
+
+    // values of 'CoverageEvent' of the profiler
+    let [<Literal>] StackOverflowPredicted = 9
+
+    // the invocation used most of its stack, so it likely ends with a fatal stack overflow
+    let isStackOverflowPredicted (report : RawCoverageReport) =
+        report.rawCoverageLocations |> Array.exists (fun x -> x.event = StackOverflowPredicted)
+
 module CoverageDeserializer =
 
     let mutable private data = [||]
@@ -74,11 +158,57 @@ module CoverageDeserializer =
         let result = Encoding.Unicode.GetString(result)
         result
 
+    let inline private readInt64 () =
+        let result = BitConverter.ToInt64(data, dataOffset)
+        increaseOffset sizeof<int64>
+        result
+
     let inline private deserializeMethodData () =
         let methodToken = readUInt32 ()
         let assemblyName = readString ()
         let moduleName = readString ()
-        { methodToken = methodToken; assemblyName = assemblyName; moduleName = moduleName }
+        let blockOffsets = Array.init (readInt32 ()) (fun _ -> readUInt32 ())
+        let firstHits = Array.init (readInt32 ()) (fun _ -> readUInt64 ())
+        { methodToken = methodToken; assemblyName = assemblyName; moduleName = moduleName; blockOffsets = blockOffsets; firstHits = firstHits }
+
+    let inline private deserializeCoveredBlocks () =
+        let methodId = readInt32 ()
+        let blockCount = readInt32 ()
+        let bitset = Array.init ((blockCount + 63) / 64) (fun _ -> readUInt64 ())
+        { methodId = methodId; blockCount = blockCount; bitset = bitset }
+
+    let inline private deserializeComparison () =
+        let offset = readUInt32 ()
+        let methodId = readInt32 ()
+        let kind = readInt32 () |> enum<ComparisonKind>
+        let left = readInt64 ()
+        let right = readInt64 ()
+        let readChars () =
+            let size = readInt32 ()
+            let result = Encoding.Unicode.GetString(data, dataOffset, 2 * size)
+            increaseOffset (2 * size)
+            result
+        let literal, operand =
+            match kind with
+            | ComparisonKind.StringEquality
+            | ComparisonKind.StringOrder ->
+                let literal = readChars ()
+                let operand = readChars ()
+                literal, if right < 0L then null else operand
+            | _ -> null, null
+        { offset = offset; methodId = methodId; kind = kind; left = left; right = right; literal = literal; operand = operand }
+
+    let inline private deserializeHitCount () =
+        let methodId = readInt32 ()
+        let offset = readUInt32 ()
+        let hits = readUInt64 ()
+        { methodId = methodId; offset = offset; hits = hits }
+
+    let inline private deserializePathCount () =
+        let methodId = readInt32 ()
+        let pathId = readInt32 ()
+        let hits = readUInt64 ()
+        { methodId = methodId; pathId = pathId; hits = hits }
 
     let inline private deserializeCoverageInfo () =
         let offset = readUInt32 ()
@@ -117,11 +247,30 @@ module CoverageDeserializer =
             {
                 threadId = threadId
                 rawCoverageLocations = [||]
+                coveredBlocks = [||]
+                comparisons = [||]
+                overflowed = false
+                droppedRecords = 0UL
+                hitCounts = [||]
+                paths = [||]
             }
         else
+            let locations = deserializeCoverageInfoFast ()
+            let coveredBlocks = deserializeArray deserializeCoveredBlocks
+            let comparisons = deserializeArray deserializeComparison
+            let overflowed = readInt32 () = 1
+            let droppedRecords = readUInt64 ()
+            let hitCounts = deserializeArray deserializeHitCount
+            let paths = deserializeArray deserializePathCount
             {
                 threadId = threadId
-                rawCoverageLocations = deserializeCoverageInfoFast ()
+                rawCoverageLocations = locations
+                coveredBlocks = coveredBlocks
+                comparisons = comparisons
+                overflowed = overflowed
+                droppedRecords = droppedRecords
+                hitCounts = hitCounts
+                paths = paths
             }
 
     let private deserializeRawReports () =
@@ -132,6 +281,18 @@ module CoverageDeserializer =
             reports = reports
         }
 
+    let private deserializeTestReports () =
+        let tests = ResizeArray()
+        while dataOffset < data.Length do
+            let nameLength = readInt32 ()
+            let testName = Encoding.Unicode.GetString(data, dataOffset, 2 * nameLength)
+            increaseOffset (2 * nameLength)
+            let reportSize = readInt32 ()
+            let reportEnd = dataOffset + reportSize
+            tests.Add((testName, deserializeRawReports ()))
+            dataOffset <- reportEnd
+        tests.ToArray()
+
     let private startNewDeserialization bytes =
         data <- bytes
         dataOffset <- 0
@@ -150,6 +311,17 @@ module CoverageDeserializer =
             Logger.error $"{e.Message}\n\n{e.StackTrace}"
             failwith "CoverageDeserialization failed!"
 
+    // reads the result of the persistent passive mode: (test name, report) per test
+    let getTestReports bytes =
+        try
+            startNewDeserialization bytes
+            deserializeTestReports ()
+        with
+        | e ->
+            Logger.error $"{dataOffset}"
+            Logger.error $"{e.Message}\n\n{e.StackTrace}"
+            failwith "CoverageDeserialization failed!"
+
     let reportsFromRawReports (rawReports : RawCoverageReports) =
 
         let toLocation (x : RawCoverageLocation) =